@@ -0,0 +1,263 @@
+#define BOOST_TEST_MODULE "CoreTest"
+
+#include "MeasurementStore.hpp"
+#include "Pipeline.hpp"
+#include "WorkerPool.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+using namespace slam3d;
+
+// Measurement with a vector of numbers as payload that can be paged
+class VectorMeasurement : public Measurement
+{
+public:
+	typedef boost::shared_ptr<VectorMeasurement> Ptr;
+
+	VectorMeasurement(const std::vector<double>& values)
+	 : Measurement("Robot", "Sensor", Transform::Identity()), mValues(values) {}
+
+	std::vector<double> getValues() const
+	{
+		accessPayload();
+		std::lock_guard<std::mutex> guard(mValuesMutex);
+		return mValues;
+	}
+
+	void setValues(const std::vector<double>& values)
+	{
+		accessPayload();
+		{
+			std::lock_guard<std::mutex> guard(mValuesMutex);
+			mValues = values;
+		}
+		payloadChanged();
+	}
+
+	bool isResident() const
+	{
+		std::lock_guard<std::mutex> guard(mValuesMutex);
+		return !mValues.empty();
+	}
+
+	bool writePayload(std::vector<char>& buffer) const
+	{
+		std::lock_guard<std::mutex> guard(mValuesMutex);
+		const char* data = (const char*)mValues.data();
+		buffer.insert(buffer.end(), data, data + mValues.size() * sizeof(double));
+		return true;
+	}
+
+	void readPayload(const char* data, size_t size)
+	{
+		std::lock_guard<std::mutex> guard(mValuesMutex);
+		mValues.resize(size / sizeof(double));
+		memcpy(mValues.data(), data, size);
+	}
+
+	void releasePayload()
+	{
+		std::lock_guard<std::mutex> guard(mValuesMutex);
+		std::vector<double>().swap(mValues);
+	}
+
+	size_t getPayloadSize() const
+	{
+		std::lock_guard<std::mutex> guard(mValuesMutex);
+		return mValues.size() * sizeof(double);
+	}
+
+private:
+	std::vector<double> mValues;
+	mutable std::mutex mValuesMutex;
+};
+
+std::vector<double> createValues(unsigned n, double offset)
+{
+	std::vector<double> values(n);
+	for(unsigned i = 0; i < n; i++)
+		values[i] = offset + i * 0.5;
+	return values;
+}
+
+BOOST_AUTO_TEST_CASE(worker_pool_drain)
+{
+	std::atomic<unsigned> done(0);
+	{
+		WorkerPool pool(2);
+		for(unsigned i = 0; i < 100; i++)
+		{
+			pool.post([&done]()
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				done++;
+			});
+		}
+	}
+	BOOST_CHECK_EQUAL(done, 100);
+}
+
+BOOST_AUTO_TEST_CASE(worker_pool_bounded)
+{
+	std::promise<void> gate;
+	std::shared_future<void> open = gate.get_future().share();
+	std::atomic<bool> posted(false);
+	std::atomic<unsigned> done(0);
+	{
+		WorkerPool pool(1, 2);
+
+		// The first job occupies the only thread, the next two fill the queue
+		std::future<void> running = pool.post([open, &done](){ open.wait(); done++; });
+		pool.post([&done](){ done++; });
+		pool.post([&done](){ done++; });
+
+		std::thread producer([&pool, &posted, &done]()
+		{
+			pool.post([&done](){ done++; });
+			posted = true;
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		BOOST_CHECK(!posted);
+
+		gate.set_value();
+		producer.join();
+		BOOST_CHECK(posted);
+		running.get();
+	}
+	BOOST_CHECK_EQUAL(done, 4);
+}
+
+BOOST_AUTO_TEST_CASE(worker_pool_exception)
+{
+	WorkerPool pool(2);
+	std::future<int> result = pool.post([]() -> int { throw std::runtime_error("failed"); });
+	BOOST_CHECK_THROW(result.get(), std::runtime_error);
+	BOOST_CHECK_EQUAL(pool.post([](){ return 42; }).get(), 42);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for)
+{
+	std::vector<unsigned> hits(1000, 0);
+	parallelFor(hits.size(), 4, [&hits](size_t begin, size_t end, unsigned chunk)
+	{
+		for(size_t i = begin; i < end; i++)
+			hits[i]++;
+	});
+	BOOST_CHECK_EQUAL(std::count(hits.begin(), hits.end(), 1), hits.size());
+
+	// Chunks can start their own loops on the same pool
+	std::atomic<unsigned> inner(0);
+	parallelFor(16, 0, [&inner](size_t begin, size_t end, unsigned chunk)
+	{
+		for(size_t i = begin; i < end; i++)
+		{
+			parallelFor(100, 0, [&inner](size_t b, size_t e, unsigned c){ inner += e - b; });
+		}
+	});
+	BOOST_CHECK_EQUAL(inner, 1600);
+
+	// An exception is rethrown after all chunks have finished
+	std::atomic<unsigned> done(0);
+	BOOST_CHECK_THROW(parallelFor(100, 4, [&done](size_t begin, size_t end, unsigned chunk)
+	{
+		done += end - begin;
+		if(chunk == 0)
+			throw std::runtime_error("failed");
+	}), std::runtime_error);
+	BOOST_CHECK_EQUAL(done, 100);
+}
+
+BOOST_AUTO_TEST_CASE(pipeline_order_and_flush)
+{
+	std::vector<int> output;
+	std::atomic<unsigned> errors(0);
+	std::atomic<size_t> failed_stage(0);
+	std::vector<Pipeline<int>::Stage> stages;
+	stages.push_back([](int& i){ if(i % 7 == 0) throw std::runtime_error("seven"); return true; });
+	stages.push_back([](int& i){ i *= 2; return i % 3 != 0; });
+	stages.push_back([&output](int& i){ output.push_back(i); return true; });
+
+	std::vector<int> expected;
+	for(int i = 1; i <= 1000; i++)
+	{
+		if(i % 7 != 0 && (2 * i) % 3 != 0)
+			expected.push_back(2 * i);
+	}
+
+	// Boost.Test is not thread-safe, the handler only records the errors
+	Pipeline<int> pipeline(stages, 4, [&errors, &failed_stage](size_t stage, const std::exception& e)
+	{
+		failed_stage = std::max<size_t>(failed_stage, stage);
+		errors++;
+	});
+	for(int i = 1; i <= 1000; i++)
+	{
+		BOOST_REQUIRE(pipeline.push(i));
+	}
+	pipeline.flush();
+	BOOST_CHECK_EQUAL(pipeline.getNumberOfPendingItems(), 0);
+	BOOST_CHECK_EQUAL(errors, 142);
+	BOOST_CHECK_EQUAL(failed_stage, 0);
+	BOOST_CHECK_EQUAL_COLLECTIONS(output.begin(), output.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(pipeline_drain)
+{
+	std::atomic<unsigned> done(0);
+	{
+		std::vector<Pipeline<int>::Stage> stages;
+		stages.push_back([](int& i){ std::this_thread::sleep_for(std::chrono::microseconds(100)); return true; });
+		stages.push_back([&done](int& i){ done++; return true; });
+		Pipeline<int> pipeline(stages, 2);
+		for(int i = 0; i < 100; i++)
+			pipeline.push(i);
+	}
+	BOOST_CHECK_EQUAL(done, 100);
+}
+
+BOOST_AUTO_TEST_CASE(measurement_store_round_trip)
+{
+	const unsigned n = 1000;
+	const size_t size = n * sizeof(double);
+	MeasurementStore store("core_test_store.bin", 3 * size, 4 * size);
+
+	std::vector<VectorMeasurement::Ptr> measurements;
+	for(unsigned i = 0; i < 10; i++)
+	{
+		VectorMeasurement::Ptr m(new VectorMeasurement(createValues(n, i)));
+		store.add(m);
+		measurements.push_back(m);
+	}
+	BOOST_CHECK_LE(store.getResidentSize(), 3 * size);
+	BOOST_CHECK_EQUAL(store.getNumberOfPageOuts(), 7);
+	BOOST_CHECK(!measurements[0]->isResident());
+	BOOST_CHECK(measurements[9]->isResident());
+
+	// Every payload is read back unchanged
+	for(unsigned i = 0; i < measurements.size(); i++)
+	{
+		std::vector<double> expected = createValues(n, i);
+		std::vector<double> values = measurements[i]->getValues();
+		BOOST_CHECK_EQUAL_COLLECTIONS(values.begin(), values.end(), expected.begin(), expected.end());
+		BOOST_CHECK_LE(store.getResidentSize(), 3 * size);
+	}
+	BOOST_CHECK_EQUAL(store.getNumberOfPageIns(), 10);
+
+	// A changed payload is written again when paged out, even if it has grown
+	std::vector<double> changed = createValues(2 * n, 100);
+	measurements[0]->setValues(changed);
+	for(unsigned i = 1; i < measurements.size(); i++)
+	{
+		measurements[i]->getValues();
+	}
+	BOOST_CHECK(!measurements[0]->isResident());
+	std::vector<double> values = measurements[0]->getValues();
+	BOOST_CHECK_EQUAL_COLLECTIONS(values.begin(), values.end(), changed.begin(), changed.end());
+}
@@ -44,9 +44,12 @@ Graph::Graph(Logger* log)
 {
 	// Initialize some members
 	mSolver = NULL;	
+	mMeasurementStore = NULL;
 	mFixNext = false;
 	mOptimized = false;
 	mConstraintsAdded = 0;
+	mPoseVersion = 0;
+	mStructureVersion = 0;
 }
 
 Graph::~Graph()
@@ -111,6 +114,37 @@ bool Graph::optimized()
 IdType Graph::addVertex(Measurement::Ptr m, const Transform &corrected)
 {
 	// Create the new VertexObject and add it to the PoseGraph
+	VertexObject vo = createVertexObject(m, corrected);
+	addVertex(vo);
+	registerVertex(vo);
+	return vo.index;
+}
+
+std::vector<IdType> Graph::addVertices(const std::vector<Measurement::Ptr>& measurements,
+                                       const std::vector<Transform>& corrected)
+{
+	if(measurements.size() != corrected.size())
+	{
+		throw std::runtime_error("addVertices() requires one pose per measurement!");
+	}
+
+	VertexObjectList vertices;
+	std::vector<IdType> ids;
+	for(size_t i = 0; i < measurements.size(); i++)
+	{
+		vertices.push_back(createVertexObject(measurements[i], corrected[i]));
+		ids.push_back(vertices.back().index);
+	}
+	addVertices(vertices);
+	for(VertexObjectList::iterator v = vertices.begin(); v < vertices.end(); ++v)
+	{
+		registerVertex(*v);
+	}
+	return ids;
+}
+
+VertexObject Graph::createVertexObject(Measurement::Ptr m, const Transform& corrected)
+{
 	IdType id = mIndexer.getNext();
 	boost::format v_name("%1%:%2%(%3%)");
 	v_name % m->getRobotName() % m->getSensorName() % id;
@@ -119,24 +153,39 @@ IdType Graph::addVertex(Measurement::Ptr m, const Transform &corrected)
 	vo.label = v_name.str();
 	vo.corrected_pose = corrected;
 	vo.measurement = m;
-	addVertex(vo);
-	mLogger->message(INFO, (boost::format("Created vertex %1% (from %2%:%3%).") % id % m->getRobotName() % m->getSensorName()).str());
+	return vo;
+}
+
+void Graph::registerVertex(const VertexObject& vo)
+{
+	const Measurement::Ptr& m = vo.measurement;
+	mLogger->message(INFO, (boost::format("Created vertex %1% (from %2%:%3%).") % vo.index % m->getRobotName() % m->getSensorName()).str());
 
 	// Add it to the uuid-index, so we can find it by its uuid
-	mUuidIndex.insert(UuidIndex::value_type(m->getUniqueId(), id));
+	mUuidIndex.insert(UuidIndex::value_type(m->getUniqueId(), vo.index));
+
+	if(mMeasurementStore)
+		mMeasurementStore->add(m);
 	
 	// Add it to the SLAM-Backend for incremental optimization
 	if(mSolver)
 	{
-		mSolver->addVertex(id, corrected);
+		mSolver->addVertex(vo.index, vo.corrected_pose);
 		if(mFixNext)
 		{
-			mLogger->message(INFO, (boost::format("Fixed position of vertex %1% in backend.") % id).str());
-			mSolver->setFixed(id);
+			mLogger->message(INFO, (boost::format("Fixed position of vertex %1% in backend.") % vo.index).str());
+			mSolver->setFixed(vo.index);
 			mFixNext = false;
 		}
 	}
-	return id;
+}
+
+void Graph::addVertices(const VertexObjectList& v)
+{
+	for(VertexObjectList::const_iterator it = v.begin(); it < v.end(); ++it)
+	{
+		addVertex(*it);
+	}
 }
 
 void Graph::addTentativeConstraint(IdType source_id, IdType target_id, std::string& sensor)
@@ -146,6 +195,7 @@ void Graph::addTentativeConstraint(IdType source_id, IdType target_id, std::stri
 	eo.target = target_id;
 	eo.constraint = Constraint::Ptr(new TentativeConstraint(sensor));
 	addEdge(eo);
+	mStructureVersion++;
 }
 
 void Graph::addConstraint(IdType source_id, IdType target_id, Constraint::Ptr c)
@@ -156,13 +206,33 @@ void Graph::addConstraint(IdType source_id, IdType target_id, Constraint::Ptr c)
 	eo.target = target_id;
 	eo.constraint = c;
 	addEdge(eo);
+	mStructureVersion++;
 	addToSolver(eo);
 }
 
+void Graph::addConstraints(const EdgeObjectList& edges)
+{
+	addEdges(edges);
+	mStructureVersion++;
+	for(EdgeObjectList::const_iterator e = edges.begin(); e < edges.end(); ++e)
+	{
+		addToSolver(*e);
+	}
+}
+
+void Graph::addEdges(const EdgeObjectList& e)
+{
+	for(EdgeObjectList::const_iterator it = e.begin(); it < e.end(); ++it)
+	{
+		addEdge(*it);
+	}
+}
+
 void Graph::replaceConstraint(IdType source_id, IdType target_id, Constraint::Ptr c)
 {
 	EdgeObject& eo = getEdgeInternal(source_id, target_id, c->getSensorName());
 	eo.constraint = c;
+	mStructureVersion++;
 	addToSolver(eo);
 }
 
@@ -183,6 +253,7 @@ void Graph::removeConstraint(IdType source, IdType target, const std::string& se
 {
 	// Remove from graph
 	removeEdge(source, target, sensor);
+	mStructureVersion++;
 	
 	// Remove from solver
 	// TODO
@@ -269,4 +340,5 @@ VertexObjectList Graph::getNearbyVertices(const Transform &tf, float radius) con
 void Graph::setCorrectedPose(IdType id, const Transform& pose)
 {
 	getVertexInternal(id).corrected_pose = pose;
+	mPoseVersion++;
 }
@@ -76,8 +76,10 @@ laser->addMeasurement(m);
  */
 
 #include "Solver.hpp"
+#include "MeasurementStore.hpp"
 
 #include <flann/flann.hpp>
+#include <atomic>
 #include <map>
 
 namespace slam3d
@@ -206,6 +208,14 @@ namespace slam3d
 		 */
 		void setSolver(Solver* solver);
 
+		/**
+		 * @brief Set a store to page out the measurements of the graph.
+		 * @details All measurements that are added afterwards are managed by
+		 * the store, which has to exist as long as the graph.
+		 * @param store
+		 */
+		void setMeasurementStore(MeasurementStore* store) { mMeasurementStore = store; }
+
 		/**
 		 * @brief Add a given measurement at the given pose
 		 * @details This method creates the VertexObject, adds the new vertex to
@@ -216,6 +226,17 @@ namespace slam3d
 		 */
 		IdType addVertex(Measurement::Ptr m, const Transform &corrected);
 
+		/**
+		 * @brief Add a sequence of measurements at the given poses.
+		 * @details Like addVertex, but all vertices are added to the
+		 * actual graph in a single call to the method below.
+		 * @param measurements
+		 * @param corrected initial pose for each new vertex
+		 * @return ids of the new vertices in the given order
+		 */
+		std::vector<IdType> addVertices(const std::vector<Measurement::Ptr>& measurements,
+		                                const std::vector<Transform>& corrected);
+
 		/**
 		 * @brief Add a placeholder constraint
 		 * @param source_id
@@ -234,6 +255,14 @@ namespace slam3d
 		                           IdType target,
 		                           Constraint::Ptr constraint);
 
+		/**
+		 * @brief Add a sequence of constraints (edges) to the graph.
+		 * @details All edges are added to the actual graph in a single call
+		 * to addEdges, then they are passed to the solver in the given order.
+		 * @param edges
+		 */
+		void addConstraints(const EdgeObjectList& edges);
+
 		/**
 		 * @brief Replace the constraint of the same sensor for the specified edge.
 		 * @param source
@@ -260,6 +289,22 @@ namespace slam3d
 		 */
 		void setCorrectedPose(IdType id, const Transform& pose);
 
+		/**
+		 * @brief Get a stamp that changes whenever a corrected pose is changed.
+		 * @details This can be used to detect whether data derived from the
+		 * vertex poses has to be recomputed, e.g. after optimize().
+		 * @return current pose version
+		 */
+		unsigned long getPoseVersion() const { return mPoseVersion; }
+
+		/**
+		 * @brief Get a stamp that changes whenever an edge is added, removed or replaced.
+		 * @details As long as it stays the same, traversing the graph from a
+		 * vertex yields the same vertices and edges as before.
+		 * @return current structure version
+		 */
+		unsigned long getStructureVersion() const { return mStructureVersion; }
+
 		/**
 		 * @brief Start the backend optimization process.
 		 * @details Requires that a Solver has been set with setSolver.
@@ -406,6 +451,14 @@ namespace slam3d
 		 */
 		virtual void addVertex(const VertexObject& v) = 0;
 
+		/**
+		 * @brief Add the given VertexObjects to the actual graph.
+		 * @details The default implementation calls addVertex for each one,
+		 * specification classes can override it to lock the graph only once.
+		 * @param v VertexObjects to be stored in the graph
+		 */
+		virtual void addVertices(const VertexObjectList& v);
+
 		/**
 		 * @brief Add the given EdgeObject to the actual graph.
 		 * @details This method has to be implemented by the specification class.
@@ -414,6 +467,14 @@ namespace slam3d
 		 */
 		virtual void addEdge(const EdgeObject& e) = 0;
 
+		/**
+		 * @brief Add the given EdgeObjects to the actual graph.
+		 * @details The default implementation calls addEdge for each one,
+		 * specification classes can override it to lock the graph only once.
+		 * @param e EdgeObjects to be stored in the graph
+		 */
+		virtual void addEdges(const EdgeObjectList& e);
+
 		/**
 		 * @brief 
 		 * @param source
@@ -444,6 +505,20 @@ namespace slam3d
 		 */
 		virtual void addToSolver(const EdgeObject& eo);
 
+		/**
+		 * @brief Create the VertexObject for a new measurement.
+		 * @param m measurement
+		 * @param corrected initial pose for the new vertex
+		 */
+		VertexObject createVertexObject(Measurement::Ptr m, const Transform& corrected);
+
+		/**
+		 * @brief Add a vertex that has been stored in the actual graph
+		 * to the uuid-index, the measurement store and the solver.
+		 * @param vo
+		 */
+		void registerVertex(const VertexObject& vo);
+
 		/**
 		 * @brief Re-orthogonalize the rotation-matrix
 		 * @param t input tranform
@@ -454,6 +529,7 @@ namespace slam3d
 	protected:
 		Solver* mSolver;
 		Logger* mLogger;
+		MeasurementStore* mMeasurementStore;
 
 		Indexer mIndexer;
 
@@ -472,6 +548,8 @@ namespace slam3d
 		bool mFixNext;
 		bool mOptimized;
 		unsigned mConstraintsAdded;
+		std::atomic<unsigned long> mPoseVersion;
+		std::atomic<unsigned long> mStructureVersion;
 	};
 }
 
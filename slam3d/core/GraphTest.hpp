@@ -1,8 +1,15 @@
 #include <slam3d/core/Graph.hpp>
+#include <slam3d/core/Mapper.hpp>
+#include <slam3d/core/ScanSensor.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <boost/test/unit_test.hpp>
 
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <thread>
+
 void addVertexToGraph(slam3d::Graph* g, slam3d::IdType exp_id, const std::string& robot, const std::string& sensor)
 {
 	slam3d::Measurement::Ptr m(new slam3d::Measurement(robot, sensor, slam3d::Transform::Identity()));
@@ -42,3 +49,286 @@ void test_graph_construction(slam3d::Graph* graph)
 	BOOST_CHECK_EQUAL(s1_edges.at(0).source, 1);
 	BOOST_CHECK_EQUAL(s1_edges.at(0).target, 2);
 }
+
+class PatchCountingSensor : public slam3d::ScanSensor
+{
+public:
+	PatchCountingSensor(slam3d::Logger* l) : slam3d::ScanSensor("S1", l), patches(0) {}
+
+	slam3d::Measurement::Ptr createCombinedMeasurement(const slam3d::VertexObjectList& vertices, slam3d::Transform pose) const
+	{
+		patches++;
+		return slam3d::Measurement::Ptr(new slam3d::Measurement("R1", "S1", slam3d::Transform::Identity()));
+	}
+
+	slam3d::Constraint::Ptr createConstraint(const slam3d::Measurement::Ptr& source,
+	                                         const slam3d::Measurement::Ptr& target,
+	                                         const slam3d::Transform& odometry,
+	                                         bool loop)
+	{
+		throw slam3d::NoMatch("Not used in this test");
+	}
+
+	mutable unsigned patches;
+};
+
+void test_patch_cache(slam3d::Graph* graph, slam3d::Logger* logger)
+{
+	slam3d::Mapper mapper(graph, logger);
+	PatchCountingSensor sensor(logger);
+	mapper.registerSensor(&sensor);
+	sensor.setPatchBuildingRange(1);
+
+	// A chain of four vertices, the patch around 1 contains 1 and 2
+	for(slam3d::IdType id = 1; id <= 4; id++)
+	{
+		addVertexToGraph(graph, id, "R1", "S1");
+		if(id > 1)
+		{
+			slam3d::SE3Constraint::Ptr c(new slam3d::SE3Constraint("S1", slam3d::TransformWithCovariance::Identity()));
+			graph->addConstraint(id - 1, id, c);
+		}
+	}
+
+	slam3d::Measurement::Ptr patch = sensor.buildPatch(1);
+	BOOST_CHECK_EQUAL(sensor.patches, 1);
+	BOOST_CHECK_EQUAL(sensor.buildPatch(1), patch);
+	BOOST_CHECK_EQUAL(sensor.patches, 1);
+
+	// Changed poses outside of the patch or unchanged poses within keep it
+	unsigned long version = graph->getPoseVersion();
+	graph->setCorrectedPose(4, slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(1, 0, 0)));
+	graph->setCorrectedPose(2, graph->getVertex(2).corrected_pose);
+	BOOST_CHECK_GT(graph->getPoseVersion(), version);
+	BOOST_CHECK_EQUAL(sensor.buildPatch(1), patch);
+	BOOST_CHECK_EQUAL(sensor.patches, 1);
+
+	// A changed pose within the patch invalidates it
+	graph->setCorrectedPose(2, slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(0, 1, 0)));
+	slam3d::Measurement::Ptr rebuilt = sensor.buildPatch(1);
+	BOOST_CHECK_NE(rebuilt, patch);
+	BOOST_CHECK_EQUAL(sensor.patches, 2);
+	BOOST_CHECK_EQUAL(sensor.buildPatch(1), rebuilt);
+	BOOST_CHECK_EQUAL(sensor.patches, 2);
+
+	// A replaced edge invalidates it, although the patch has as many edges as before
+	unsigned long structure = graph->getStructureVersion();
+	size_t edges = graph->getEdges(graph->getVerticesInRange(1, 1)).size();
+	slam3d::TransformWithCovariance twc(slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(0, 1, 0)),
+	                                   slam3d::Covariance<6>::Identity());
+	graph->replaceConstraint(1, 2, slam3d::SE3Constraint::Ptr(new slam3d::SE3Constraint("S1", twc)));
+	BOOST_CHECK_GT(graph->getStructureVersion(), structure);
+	BOOST_CHECK_EQUAL(graph->getEdges(graph->getVerticesInRange(1, 1)).size(), edges);
+	rebuilt = sensor.buildPatch(1);
+	BOOST_CHECK_EQUAL(sensor.patches, 3);
+	BOOST_CHECK_EQUAL(sensor.buildPatch(1), rebuilt);
+	BOOST_CHECK_EQUAL(sensor.patches, 3);
+
+	// Without a cache every patch is built again
+	sensor.setPatchCacheSize(0);
+	sensor.buildPatch(1);
+	sensor.buildPatch(1);
+	BOOST_CHECK_EQUAL(sensor.patches, 5);
+}
+
+// Measurement that knows the pose it was taken from
+class PoseMeasurement : public slam3d::Measurement
+{
+public:
+	PoseMeasurement(const slam3d::Transform& p)
+	 : slam3d::Measurement("R1", "S1", slam3d::Transform::Identity()), pose(p) {}
+
+	slam3d::Transform pose;
+};
+
+// Sensor that registers measurements by their known poses,
+// loop closures wait until they are released
+class GatedLinkingSensor : public slam3d::ScanSensor
+{
+public:
+	GatedLinkingSensor(slam3d::Logger* l) : slam3d::ScanSensor("S1", l), mOpen(false), mWaiting(0) {}
+	~GatedLinkingSensor()
+	{
+		release();
+		shutdown();
+	}
+
+	slam3d::Measurement::Ptr createCombinedMeasurement(const slam3d::VertexObjectList& vertices, slam3d::Transform pose) const
+	{
+		return vertices.at(0).measurement;
+	}
+
+	slam3d::Constraint::Ptr createConstraint(const slam3d::Measurement::Ptr& source,
+	                                         const slam3d::Measurement::Ptr& target,
+	                                         const slam3d::Transform& odometry,
+	                                         bool loop)
+	{
+		if(loop)
+		{
+			std::unique_lock<std::mutex> lock(mGateMutex);
+			mWaiting++;
+			mGate.notify_all();
+			mGate.wait(lock, [this](){ return mOpen; });
+		}
+		slam3d::Transform s = boost::dynamic_pointer_cast<PoseMeasurement>(source)->pose;
+		slam3d::Transform t = boost::dynamic_pointer_cast<PoseMeasurement>(target)->pose;
+		slam3d::TransformWithCovariance twc(s.inverse() * t, slam3d::Covariance<6>::Identity());
+		return slam3d::Constraint::Ptr(new slam3d::SE3Constraint("S1", twc));
+	}
+
+	void waitForLoops(unsigned n)
+	{
+		std::unique_lock<std::mutex> lock(mGateMutex);
+		mGate.wait(lock, [this, n](){ return mWaiting >= n; });
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(mGateMutex);
+		mOpen = true;
+		mGate.notify_all();
+	}
+
+private:
+	std::mutex mGateMutex;
+	std::condition_variable mGate;
+	bool mOpen;
+	unsigned mWaiting;
+};
+
+void test_link_queue(slam3d::Graph* graph, slam3d::Logger* logger)
+{
+	slam3d::Mapper mapper(graph, logger);
+	GatedLinkingSensor sensor(logger);
+	mapper.registerSensor(&sensor);
+	sensor.setMinPoseDistance(0.1, 0.1);
+	sensor.setNeighborRadius(0.5, 1);
+	sensor.setMinLoopLength(5);
+	sensor.setPatchBuildingRange(0);
+	sensor.setLinkQueueSize(1);
+
+	// Drive along a corridor and back, the vertices 21, 22 and 23
+	// close loops with the vertices 1, 7 and 13.
+	auto drive = [&sensor](double x, double y)
+	{
+		slam3d::Transform pose(Eigen::Translation<slam3d::ScalarType, 3>(x, y, 0));
+		BOOST_REQUIRE(sensor.addMeasurement(slam3d::Measurement::Ptr(new PoseMeasurement(pose))));
+	};
+	for(int x = 0; x < 20; x++)
+		drive(x, 0);
+
+	// The worker is busy with the first vertex, the second one fills the queue
+	drive(0, 0.2);
+	sensor.linkLastToNeighbors(true);
+	sensor.waitForLoops(1);
+	drive(6, 0.2);
+	sensor.linkLastToNeighbors(true);
+	sensor.linkLastToNeighbors(true);
+	BOOST_CHECK_EQUAL(mapper.getIngestionStatistics().coalesced_links, 1);
+
+	// The third vertex has to wait for space in the queue
+	drive(12, 0.2);
+	std::atomic<bool> queued(false);
+	std::thread producer([&sensor, &queued]()
+	{
+		sensor.linkLastToNeighbors(true);
+		queued = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	BOOST_CHECK(!queued);
+
+	sensor.release();
+	producer.join();
+	BOOST_CHECK(queued);
+	sensor.waitForLinking();
+	BOOST_CHECK_NO_THROW(graph->getEdge(1, 21, "S1"));
+	BOOST_CHECK_NO_THROW(graph->getEdge(7, 22, "S1"));
+	BOOST_CHECK_NO_THROW(graph->getEdge(13, 23, "S1"));
+}
+
+void test_pipeline_pose(slam3d::Graph* graph, slam3d::Logger* logger)
+{
+	slam3d::Mapper mapper(graph, logger);
+	GatedLinkingSensor sensor(logger);
+	mapper.registerSensor(&sensor);
+	sensor.setMinPoseDistance(0.1, 0.1);
+
+	// Hold the mapping stage after the first vertex
+	std::promise<void> gate;
+	std::shared_future<void> open = gate.get_future().share();
+	sensor.startPipeline(8, false, [open](slam3d::IdType){ open.wait(); });
+
+	// Every scan but the last one is far enough from its predecessor
+	const double x[] = {0, 0.15, 0.3, 0.45, 0.5};
+	for(double p : x)
+	{
+		slam3d::Transform pose(Eigen::Translation<slam3d::ScalarType, 3>(p, 0, 0));
+		BOOST_REQUIRE(sensor.queueMeasurement(slam3d::Measurement::Ptr(new PoseMeasurement(pose))));
+	}
+
+	// The pose includes the scans that have only been registered
+	auto current_x = [&sensor](){ return sensor.getCurrentPose().translation().x(); };
+	for(unsigned i = 0; i < 1000 && std::abs(current_x() - 0.5) > 1e-9; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	BOOST_CHECK_SMALL(current_x() - 0.5, 1e-9);
+	BOOST_CHECK_EQUAL(graph->getVerticesFromSensor("S1").size(), 1);
+
+	gate.set_value();
+	sensor.flushPipeline();
+	BOOST_CHECK_EQUAL(graph->getVerticesFromSensor("S1").size(), 4);
+	BOOST_CHECK_SMALL(current_x() - 0.5, 1e-9);
+
+	// Sequential registration continues from the last scan
+	sensor.stopPipeline();
+	BOOST_CHECK_SMALL(current_x() - 0.5, 1e-9);
+	slam3d::Transform pose(Eigen::Translation<slam3d::ScalarType, 3>(0.6, 0, 0));
+	BOOST_CHECK(sensor.addMeasurement(slam3d::Measurement::Ptr(new PoseMeasurement(pose))));
+	BOOST_CHECK_SMALL(current_x() - 0.6, 1e-9);
+	BOOST_CHECK_SMALL(graph->getVertex(5).corrected_pose.translation().x() - 0.6, 1e-9);
+}
+
+void test_batch_insertion(slam3d::Graph* graph, slam3d::Logger* logger)
+{
+	slam3d::Mapper mapper(graph, logger);
+	GatedLinkingSensor sensor(logger);
+	mapper.registerSensor(&sensor);
+	sensor.setMinPoseDistance(0.1, 0.1);
+
+	// The odometry drifts sideways, the third scan is too close to the second one
+	std::vector<slam3d::Measurement::Ptr> scans;
+	std::vector<slam3d::Transform> odometry;
+	const double x[] = {0, 0.5, 0.55, 1.0, 1.5};
+	for(double p : x)
+	{
+		slam3d::Transform pose(Eigen::Translation<slam3d::ScalarType, 3>(p, 0, 0));
+		scans.push_back(slam3d::Measurement::Ptr(new PoseMeasurement(pose)));
+		odometry.push_back(slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(p, 0.1 * p, 0)));
+	}
+	BOOST_CHECK_EQUAL(sensor.addMeasurements(scans, odometry, 2), 4);
+
+	// A second batch continues the chain of the first one
+	scans.clear();
+	odometry.clear();
+	slam3d::Transform pose(Eigen::Translation<slam3d::ScalarType, 3>(2.0, 0, 0));
+	scans.push_back(slam3d::Measurement::Ptr(new PoseMeasurement(pose)));
+	odometry.push_back(slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(2.0, 0.2, 0)));
+	BOOST_CHECK_EQUAL(sensor.addMeasurements(scans, odometry, 2), 1);
+
+	// The poses follow the registration and not the odometry
+	const double expected[] = {0, 0.5, 1.0, 1.5, 2.0};
+	BOOST_REQUIRE_EQUAL(graph->getVerticesFromSensor("S1").size(), 5);
+	for(slam3d::IdType id = 1; id <= 5; id++)
+	{
+		slam3d::Transform::ConstTranslationPart t = graph->getVertex(id).corrected_pose.translation();
+		BOOST_CHECK_SMALL(t.x() - expected[id - 1], 1e-9);
+		BOOST_CHECK_SMALL(t.y(), 1e-9);
+		if(id > 1)
+		{
+			BOOST_CHECK_NO_THROW(graph->getEdge(id - 1, id, "S1"));
+		}
+	}
+	BOOST_CHECK_EQUAL(graph->getEdgesFromSensor("S1").size(), 4);
+	BOOST_CHECK_SMALL(sensor.getCurrentPose().translation().x() - 2.0, 1e-9);
+}
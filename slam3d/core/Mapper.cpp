@@ -103,6 +103,28 @@ IdType Mapper::addMeasurement(Measurement::Ptr m)
 	return mLastIndex;
 }
 
+std::vector<IdType> Mapper::addMeasurements(const std::vector<Measurement::Ptr>& measurements,
+                                            const std::vector<Transform>& poses)
+{
+	mLogger->message(DEBUG, (boost::format("Add %1% readings from own Sensor.") % measurements.size()).str());
+	std::vector<IdType> ids = mGraph->addVertices(measurements, poses);
+	for(std::vector<IdType>::iterator id = ids.begin(); id < ids.end(); ++id)
+	{
+		mLastIndex = *id;
+		for(PoseSensorList::iterator ps = mPoseSensors.begin(); ps != mPoseSensors.end(); ps++)
+		{
+			try
+			{
+				ps->second->handleNewVertex(*id);
+			}catch(std::exception &e)
+			{
+				mLogger->message(ERROR, (boost::format("PoseSensor '%1%' failed: %2%") % ps->second->getName() % e.what()).str());
+			}
+		}
+	}
+	return ids;
+}
+
 void Mapper::addExternalMeasurement(Measurement::Ptr m, boost::uuids::uuid s, const TransformWithCovariance& twc, const std::string& sensor)
 {
 	if(mGraph->hasMeasurement(m->getUniqueId()))
@@ -137,3 +159,47 @@ const VertexObject& Mapper::getLastVertex() const
 {
 	return mGraph->getVertex(mLastIndex);
 }
+
+void Mapper::setIngestionPolicy(const IngestionPolicy& policy)
+{
+	mLogger->message(INFO, " = IngestionPolicy =");
+	mLogger->message(INFO, (boost::format("drop_stale_frames:      %1%") % policy.drop_stale_frames).str());
+	mLogger->message(INFO, (boost::format("latency_budget:         %1%") % policy.latency_budget).str());
+	std::lock_guard<std::mutex> guard(mIngestionMutex);
+	mIngestionPolicy = policy;
+}
+
+IngestionPolicy Mapper::getIngestionPolicy()
+{
+	std::lock_guard<std::mutex> guard(mIngestionMutex);
+	return mIngestionPolicy;
+}
+
+void Mapper::countIngestionEvent(IngestionEvent event)
+{
+	std::lock_guard<std::mutex> guard(mIngestionMutex);
+	switch(event)
+	{
+	case FRAME_DROPPED:
+		mIngestionStatistics.dropped_frames++;
+		break;
+	case LINKING_SKIPPED:
+		mIngestionStatistics.skipped_links++;
+		break;
+	case LINKING_COALESCED:
+		mIngestionStatistics.coalesced_links++;
+		break;
+	}
+}
+
+IngestionStatistics Mapper::getIngestionStatistics()
+{
+	std::lock_guard<std::mutex> guard(mIngestionMutex);
+	return mIngestionStatistics;
+}
+
+void Mapper::resetIngestionStatistics()
+{
+	std::lock_guard<std::mutex> guard(mIngestionMutex);
+	mIngestionStatistics = IngestionStatistics();
+}
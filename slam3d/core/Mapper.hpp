@@ -30,8 +30,51 @@
 #include "PoseSensor.hpp"
 #include "Graph.hpp"
 
+#include <mutex>
+
 namespace slam3d
 {
+	/**
+	 * @class IngestionPolicy
+	 * @brief How sensors shed load when measurements arrive faster than they
+	 * can be processed.
+	 */
+	struct IngestionPolicy
+	{
+		IngestionPolicy() : drop_stale_frames(false), latency_budget(0) {}
+
+		/// Skip queued measurements once a newer one is waiting behind them
+		bool drop_stale_frames;
+
+		/// Maximum time in seconds from receiving a measurement until it
+		/// is linked to its neighbors, linking is skipped when it would
+		/// take longer; 0 for no limit
+		double latency_budget;
+	};
+
+	/**
+	 * @brief Kinds of work that has been dropped according to the IngestionPolicy.
+	 */
+	enum IngestionEvent {FRAME_DROPPED, LINKING_SKIPPED, LINKING_COALESCED};
+
+	/**
+	 * @class IngestionStatistics
+	 * @brief Counters for the work dropped by all sensors of a mapper.
+	 */
+	struct IngestionStatistics
+	{
+		IngestionStatistics() : dropped_frames(0), skipped_links(0), coalesced_links(0) {}
+
+		/// Measurements that were skipped because a newer one was waiting
+		unsigned long dropped_frames;
+
+		/// Vertices that were not linked to their neighbors to keep the latency budget
+		unsigned long skipped_links;
+
+		/// Requests to link a vertex that was already waiting to be linked
+		unsigned long coalesced_links;
+	};
+
 	class Mapper
 	{
 	public:
@@ -78,6 +121,17 @@ namespace slam3d
 		 */
 		IdType addMeasurement(Measurement::Ptr m);
 
+		/**
+		 * @brief Add a sequence of measurements to the graph at once.
+		 * @details The vertices are added to the graph together, then each
+		 * registered PoseSensor is called on the new vertices in order.
+		 * @param measurements pointers to new measurements
+		 * @param poses initial pose for each new vertex
+		 * @return ids of the newly added vertices
+		 */
+		std::vector<IdType> addMeasurements(const std::vector<Measurement::Ptr>& measurements,
+		                                    const std::vector<Transform>& poses);
+
 		/**
 		 * @brief Add a new measurement from another robot.
 		 * @details The new measurement is added to the graph and directly
@@ -119,6 +173,34 @@ namespace slam3d
 		 */
 		virtual const VertexObject& getLastVertex() const;
 
+		/**
+		 * @brief Set how registered sensors behave under overload.
+		 * @param policy
+		 */
+		void setIngestionPolicy(const IngestionPolicy& policy);
+
+		/**
+		 * @brief Get the policy that registered sensors apply to new measurements.
+		 */
+		IngestionPolicy getIngestionPolicy();
+
+		/**
+		 * @brief Called by sensors to count work that has been dropped.
+		 * @param event
+		 */
+		void countIngestionEvent(IngestionEvent event);
+
+		/**
+		 * @brief Get the number of dropped frames and skipped linking steps
+		 * of all sensors since the last reset.
+		 */
+		IngestionStatistics getIngestionStatistics();
+
+		/**
+		 * @brief Set all ingestion counters to zero.
+		 */
+		void resetIngestionStatistics();
+
 	protected:
 		SensorList mSensors;
 		PoseSensorList mPoseSensors;
@@ -126,6 +208,10 @@ namespace slam3d
 		Graph* mGraph;
 		IdType mLastIndex;
 		Transform mStartPose;
+
+		IngestionPolicy mIngestionPolicy;
+		IngestionStatistics mIngestionStatistics;
+		std::mutex mIngestionMutex;
 	};
 }
 
@@ -0,0 +1,238 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "MeasurementStore.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace slam3d;
+
+MeasurementStore::MeasurementStore(const std::string& file, size_t memory_limit, size_t segment_size)
+ : mFileName(file), mFileSize(0), mSegmentSize(segment_size), mMemoryLimit(memory_limit),
+   mResidentSize(0), mPageIns(0), mPageOuts(0)
+{
+	mFile = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if(mFile < 0)
+		throw StorageError(mFileName, strerror(errno));
+}
+
+MeasurementStore::~MeasurementStore()
+{
+	for(std::vector<Segment>::iterator s = mSegments.begin(); s != mSegments.end(); ++s)
+	{
+		munmap(s->data, s->size);
+	}
+	close(mFile);
+	unlink(mFileName.c_str());
+}
+
+void MeasurementStore::add(const Measurement::Ptr& m)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	if(mEntries.find(m.get()) != mEntries.end())
+		return;
+
+	Entry& entry = mEntries[m.get()];
+	entry.measurement = m;
+	entry.resident = true;
+	entry.stored = false;
+	entry.allocated = false;
+	entry.size = m->getPayloadSize();
+	mRecentlyUsed.push_front(m.get());
+	entry.lru = mRecentlyUsed.begin();
+	mResidentSize += entry.size;
+	m->setStore(this);
+	evict(m.get());
+}
+
+void MeasurementStore::access(const Measurement* m)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	std::unordered_map<const Measurement*, Entry>::iterator it = mEntries.find(m);
+	if(it == mEntries.end())
+		return;
+
+	Entry& entry = it->second;
+	if(entry.resident)
+	{
+		mRecentlyUsed.splice(mRecentlyUsed.begin(), mRecentlyUsed, entry.lru);
+		return;
+	}
+	pageIn(entry);
+	evict(m);
+}
+
+void MeasurementStore::modified(const Measurement* m)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	std::unordered_map<const Measurement*, Entry>::iterator it = mEntries.find(m);
+	if(it == mEntries.end() || !it->second.resident)
+		return;
+
+	// The old copy is overwritten on the next page-out
+	Entry& entry = it->second;
+	entry.stored = false;
+	mResidentSize -= entry.size;
+	entry.size = m->getPayloadSize();
+	mResidentSize += entry.size;
+}
+
+size_t MeasurementStore::getResidentSize() const
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	return mResidentSize;
+}
+
+unsigned long MeasurementStore::getNumberOfPageIns() const
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	return mPageIns;
+}
+
+unsigned long MeasurementStore::getNumberOfPageOuts() const
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	return mPageOuts;
+}
+
+void MeasurementStore::evict(const Measurement* keep)
+{
+	// Start with the least recently used one at the back
+	std::list<const Measurement*>::iterator it = mRecentlyUsed.end();
+	while(mResidentSize > mMemoryLimit && it != mRecentlyUsed.begin())
+	{
+		--it;
+		if(*it == keep)
+			continue;
+		Entry& entry = mEntries[*it];
+		pageOut(entry);
+		if(!entry.resident)
+			it = mRecentlyUsed.erase(it);
+	}
+}
+
+void MeasurementStore::pageOut(Entry& entry)
+{
+	if(!entry.stored)
+	{
+		std::vector<char> buffer;
+		if(!entry.measurement->writePayload(buffer))
+			return;
+		write(buffer, entry);
+		entry.stored = true;
+	}
+	entry.measurement->releasePayload();
+	entry.resident = false;
+	mResidentSize -= entry.size;
+	mPageOuts++;
+}
+
+void MeasurementStore::pageIn(Entry& entry)
+{
+	const Segment& segment = mSegments[entry.segment];
+	entry.measurement->readPayload(segment.data + entry.offset, entry.length);
+	entry.resident = true;
+	entry.size = entry.measurement->getPayloadSize();
+	mResidentSize += entry.size;
+	mRecentlyUsed.push_front(entry.measurement.get());
+	entry.lru = mRecentlyUsed.begin();
+	mPageIns++;
+}
+
+void MeasurementStore::write(const std::vector<char>& data, Entry& entry)
+{
+	// Keep the offsets of the following payloads aligned
+	size_t size = (data.size() + 15) & ~(size_t)15;
+	if(size == 0)
+		size = 16;
+
+	if(entry.allocated && entry.capacity < size)
+	{
+		Slot slot = {entry.segment, entry.offset};
+		mFreeSlots.insert(std::make_pair(entry.capacity, slot));
+		entry.allocated = false;
+	}
+	if(!entry.allocated)
+		allocate(size, entry);
+
+	memcpy(mSegments[entry.segment].data + entry.offset, data.data(), data.size());
+	entry.length = data.size();
+}
+
+void MeasurementStore::allocate(size_t size, Entry& entry)
+{
+	// Use the smallest free slot that fits and put back the rest
+	std::multimap<size_t, Slot>::iterator free = mFreeSlots.lower_bound(size);
+	if(free != mFreeSlots.end())
+	{
+		entry.segment = free->second.segment;
+		entry.offset = free->second.offset;
+		entry.capacity = size;
+		if(free->first > size)
+		{
+			Slot rest = {entry.segment, entry.offset + size};
+			mFreeSlots.insert(std::make_pair(free->first - size, rest));
+		}
+		mFreeSlots.erase(free);
+		entry.allocated = true;
+		return;
+	}
+
+	if(mSegments.empty() || mSegments.back().size - mSegments.back().used < size)
+	{
+		if(!mSegments.empty() && mSegments.back().used < mSegments.back().size)
+		{
+			Slot rest = {mSegments.size() - 1, mSegments.back().used};
+			mFreeSlots.insert(std::make_pair(mSegments.back().size - mSegments.back().used, rest));
+			mSegments.back().used = mSegments.back().size;
+		}
+
+		// Mapped offsets have to be a multiple of the page size
+		size_t page = sysconf(_SC_PAGESIZE);
+		Segment segment;
+		segment.size = (std::max(mSegmentSize, size) + page - 1) / page * page;
+		segment.used = 0;
+		if(ftruncate(mFile, mFileSize + segment.size) != 0)
+			throw StorageError(mFileName, strerror(errno));
+		void* mapped = mmap(NULL, segment.size, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, mFileSize);
+		if(mapped == MAP_FAILED)
+			throw StorageError(mFileName, strerror(errno));
+		segment.data = (char*)mapped;
+		mFileSize += segment.size;
+		mSegments.push_back(segment);
+	}
+
+	Segment& segment = mSegments.back();
+	entry.segment = mSegments.size() - 1;
+	entry.offset = segment.used;
+	entry.capacity = size;
+	entry.allocated = true;
+	segment.used += size;
+}
@@ -0,0 +1,179 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_MEASUREMENTSTORE_HPP
+#define SLAM3D_MEASUREMENTSTORE_HPP
+
+#include "Types.hpp"
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+namespace slam3d
+{
+	/**
+	 * @class StorageError
+	 * @brief Exception thrown when the backing file cannot be used.
+	 */
+	class StorageError : public std::exception
+	{
+	public:
+		StorageError(const std::string& f, const std::string& e) : file(f), error(e){}
+		
+		virtual const char* what() const throw()
+		{
+			std::ostringstream msg;
+			msg << "Measurement storage in '" << file << "' failed: " << error;
+			message = msg.str();
+			return message.c_str();
+		}
+		
+		std::string file;
+		std::string error;
+		
+	private:
+		mutable std::string message;
+	};
+
+	/**
+	 * @class MeasurementStore
+	 * @brief Keeps the payloads of measurements within a memory limit.
+	 * @details When the payloads of all added measurements exceed the memory
+	 * limit, the least recently used ones are written to a memory-mapped file
+	 * and released. They are read back transparently when the measurement
+	 * accesses its payload again (see Measurement::accessPayload). Only
+	 * measurements that implement Measurement::writePayload() are paged,
+	 * others are just kept in memory.
+	 *
+	 * The file grows in segments that are mapped once and never moved, it
+	 * is removed when the store is destroyed. A payload keeps its place in the
+	 * file when it is written again after a change, unless it has grown, in
+	 * which case the old place is reused for other payloads. The store keeps
+	 * a reference to all added measurements, so it must outlive the graph.
+	 * Measurements release data derived from their payload (e.g. registration
+	 * caches) together with it, other references to the payload are not
+	 * affected by paging.
+	 */
+	class MeasurementStore
+	{
+	public:
+		/**
+		 * @brief Constructor
+		 * @param file path of the backing file, an existing file is overwritten
+		 * @param memory_limit maximum size of resident payloads in bytes
+		 * @param segment_size size by which the file grows
+		 * @throw StorageError
+		 */
+		MeasurementStore(const std::string& file, size_t memory_limit, size_t segment_size = 64 << 20);
+		~MeasurementStore();
+
+		/**
+		 * @brief Manage the payload of the given measurement.
+		 * @param m
+		 */
+		void add(const Measurement::Ptr& m);
+
+		/**
+		 * @brief Mark the measurement as used and read its payload if necessary.
+		 * @param m
+		 */
+		void access(const Measurement* m);
+
+		/**
+		 * @brief Discard the stored copy of a changed payload.
+		 * @param m
+		 */
+		void modified(const Measurement* m);
+
+		/**
+		 * @brief Get the size of all payloads currently in memory.
+		 */
+		size_t getResidentSize() const;
+
+		/**
+		 * @brief Get the number of times a payload has been read back.
+		 */
+		unsigned long getNumberOfPageIns() const;
+
+		/**
+		 * @brief Get the number of times a payload has been released.
+		 */
+		unsigned long getNumberOfPageOuts() const;
+
+	private:
+		struct Entry
+		{
+			Measurement::Ptr measurement;
+			bool resident;
+			bool stored;
+			bool allocated;
+			size_t size;
+			size_t segment;
+			size_t offset;
+			size_t length;
+			size_t capacity;
+			std::list<const Measurement*>::iterator lru;
+		};
+
+		struct Segment
+		{
+			char* data;
+			size_t size;
+			size_t used;
+		};
+
+		struct Slot
+		{
+			size_t segment;
+			size_t offset;
+		};
+
+		void evict(const Measurement* keep);
+		void pageOut(Entry& entry);
+		void pageIn(Entry& entry);
+		void write(const std::vector<char>& data, Entry& entry);
+		void allocate(size_t size, Entry& entry);
+
+		std::string mFileName;
+		int mFile;
+		size_t mFileSize;
+		size_t mSegmentSize;
+		size_t mMemoryLimit;
+		size_t mResidentSize;
+		unsigned long mPageIns;
+		unsigned long mPageOuts;
+
+		std::vector<Segment> mSegments;
+		std::multimap<size_t, Slot> mFreeSlots;
+		std::unordered_map<const Measurement*, Entry> mEntries;
+		std::list<const Measurement*> mRecentlyUsed;
+		mutable std::mutex mMutex;
+	};
+}
+
+#endif
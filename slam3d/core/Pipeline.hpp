@@ -0,0 +1,215 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_PIPELINE_HPP
+#define SLAM3D_PIPELINE_HPP
+
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace slam3d
+{
+	/**
+	 * @class Pipeline
+	 * @brief Chain of processing stages, each running on its own thread.
+	 * @details Items are passed between the stages through bounded lock-free
+	 * single-producer/single-consumer queues. As every stage has exactly one
+	 * worker, items leave each stage in the order they were pushed, so the
+	 * results are deterministic as long as a stage only depends on the items
+	 * it has processed before. Different stages work on different items at
+	 * the same time.
+	 *
+	 * A stage returns false to drop an item. An exception thrown by a stage
+	 * also drops the item and is passed to the optional error handler.
+	 * The destructor processes all queued items before joining the workers.
+	 */
+	template <typename T>
+	class Pipeline
+	{
+	public:
+		typedef std::function<bool(T&)> Stage;
+		typedef std::function<void(size_t, const std::exception&)> ErrorHandler;
+
+		/**
+		 * @brief Start one worker for each stage.
+		 * @param stages processing functions in the order they are applied
+		 * @param capacity maximum number of items waiting in front of each stage
+		 * @param error called with the index of the stage and the exception
+		 * when a stage throws, may be empty
+		 */
+		Pipeline(const std::vector<Stage>& stages, unsigned capacity,
+		         const ErrorHandler& error = ErrorHandler())
+		 : mError(error), mShutdown(false), mPushed(0), mFinished(0)
+		{
+			for(typename std::vector<Stage>::const_iterator s = stages.begin(); s != stages.end(); ++s)
+			{
+				mStages.push_back(std::unique_ptr<StageData>(new StageData(*s, capacity > 0 ? capacity : 1)));
+			}
+			for(size_t i = 0; i < mStages.size(); i++)
+			{
+				mThreads.create_thread(std::bind(&Pipeline::run, this, i));
+			}
+		}
+
+		~Pipeline()
+		{
+			flush();
+			mShutdown = true;
+			notify();
+			mThreads.join_all();
+		}
+
+		/**
+		 * @brief Add an item to the first stage.
+		 * @details Calls from multiple threads are serialized, the order of
+		 * the items is the order in which they entered this method.
+		 * @param item
+		 * @param block whether to wait for space if the first queue is full
+		 * @return false if the queue was full and block was false
+		 */
+		bool push(const T& item, bool block = true)
+		{
+			std::lock_guard<std::mutex> guard(mPushMutex);
+			if(mStages.empty())
+				return false;
+			mPushed++;
+			if(!enqueue(0, item, block))
+			{
+				mPushed--;
+				return false;
+			}
+			return true;
+		}
+
+		/**
+		 * @brief Wait until all pushed items have passed or left the pipeline.
+		 */
+		void flush()
+		{
+			wait([this](){ return mFinished == mPushed; });
+		}
+
+		/**
+		 * @brief Get the number of items that are still being processed.
+		 */
+		size_t getNumberOfPendingItems() const { return mPushed - mFinished; }
+
+	private:
+		struct StageData
+		{
+			StageData(const Stage& s, unsigned capacity) : stage(s), queue(capacity) {}
+
+			Stage stage;
+			boost::lockfree::spsc_queue<T> queue;
+		};
+
+		// The queues themselves are lock-free, the mutex is only used to sleep
+		// while a queue is empty or full. Waiters check their condition while
+		// holding it, so a change followed by notify() cannot be missed.
+		template <typename Predicate>
+		void wait(Predicate ready)
+		{
+			std::unique_lock<std::mutex> lock(mSignalMutex);
+			mSignal.wait(lock, ready);
+		}
+
+		void notify()
+		{
+			std::lock_guard<std::mutex> lock(mSignalMutex);
+			mSignal.notify_all();
+		}
+
+		bool enqueue(size_t stage, const T& item, bool block)
+		{
+			boost::lockfree::spsc_queue<T>& queue = mStages[stage]->queue;
+			while(!queue.push(item))
+			{
+				if(!block)
+					return false;
+				wait([&queue](){ return queue.write_available() > 0; });
+			}
+			notify();
+			return true;
+		}
+
+		void run(size_t stage)
+		{
+			StageData& data = *mStages[stage];
+			T item;
+			while(true)
+			{
+				if(!data.queue.pop(item))
+				{
+					if(mShutdown)
+						return;
+					wait([this, &data](){ return mShutdown || data.queue.read_available() > 0; });
+					continue;
+				}
+				notify();
+
+				bool keep = false;
+				try
+				{
+					keep = data.stage(item);
+				}catch(std::exception &e)
+				{
+					if(mError)
+						mError(stage, e);
+				}
+
+				if(keep && stage + 1 < mStages.size())
+				{
+					enqueue(stage + 1, item, true);
+				}else
+				{
+					mFinished++;
+					notify();
+				}
+				item = T();
+			}
+		}
+
+		std::vector<std::unique_ptr<StageData> > mStages;
+		ErrorHandler mError;
+		boost::thread_group mThreads;
+		std::atomic<bool> mShutdown;
+		std::atomic<size_t> mPushed;
+		std::atomic<size_t> mFinished;
+
+		std::mutex mPushMutex;
+		std::mutex mSignalMutex;
+		std::condition_variable mSignal;
+	};
+}
+
+#endif
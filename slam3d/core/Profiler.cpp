@@ -0,0 +1,88 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+using namespace slam3d;
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	size_t i = std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5));
+	return sorted[i];
+}
+
+void Profiler::record(const std::string& stage, double milliseconds)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	mSamples[stage].push_back(milliseconds);
+}
+
+std::map<std::string, Profiler::Statistics> Profiler::getStatistics() const
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	std::map<std::string, Statistics> result;
+	for(std::map<std::string, std::vector<double> >::const_iterator s = mSamples.begin(); s != mSamples.end(); ++s)
+	{
+		if(s->second.empty())
+			continue;
+		std::vector<double> sorted = s->second;
+		std::sort(sorted.begin(), sorted.end());
+
+		Statistics& stats = result[s->first];
+		stats.count = sorted.size();
+		stats.total = 0;
+		for(std::vector<double>::const_iterator v = sorted.begin(); v != sorted.end(); ++v)
+			stats.total += *v;
+		stats.mean = stats.total / stats.count;
+		stats.p50 = percentile(sorted, 0.5);
+		stats.p90 = percentile(sorted, 0.9);
+		stats.p99 = percentile(sorted, 0.99);
+		stats.max = sorted.back();
+	}
+	return result;
+}
+
+void Profiler::print(std::ostream& out) const
+{
+	std::map<std::string, Statistics> stats = getStatistics();
+	out << std::setw(20) << "stage" << std::setw(8) << "count" << std::setw(12) << "total[ms]"
+	    << std::setw(10) << "mean[ms]" << std::setw(10) << "p50[ms]" << std::setw(10) << "p90[ms]"
+	    << std::setw(10) << "p99[ms]" << std::setw(10) << "max[ms]" << std::endl;
+	for(std::map<std::string, Statistics>::const_iterator s = stats.begin(); s != stats.end(); ++s)
+	{
+		out << std::setw(20) << s->first << std::setw(8) << s->second.count << std::setw(12) << s->second.total
+		    << std::setw(10) << s->second.mean << std::setw(10) << s->second.p50 << std::setw(10) << s->second.p90
+		    << std::setw(10) << s->second.p99 << std::setw(10) << s->second.max << std::endl;
+	}
+}
+
+void Profiler::clear()
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	mSamples.clear();
+}
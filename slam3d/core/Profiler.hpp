@@ -0,0 +1,119 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_PROFILER_HPP
+#define SLAM3D_PROFILER_HPP
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace slam3d
+{
+	/**
+	 * @class Profiler
+	 * @brief Collects the duration of named processing stages.
+	 * @details All samples are kept, so that percentiles can be computed.
+	 * Samples can be recorded from multiple threads.
+	 */
+	class Profiler
+	{
+	public:
+		/**
+		 * @struct Statistics
+		 * @brief Summary of the samples of one stage in milliseconds.
+		 */
+		struct Statistics
+		{
+			size_t count;
+			double total;
+			double mean;
+			double p50;
+			double p90;
+			double p99;
+			double max;
+		};
+
+		/**
+		 * @brief Add the duration of one execution of a stage.
+		 * @param stage
+		 * @param milliseconds
+		 */
+		void record(const std::string& stage, double milliseconds);
+
+		/**
+		 * @brief Get the statistics of all recorded stages.
+		 */
+		std::map<std::string, Statistics> getStatistics() const;
+
+		/**
+		 * @brief Write the statistics of all stages as a table.
+		 * @param out
+		 */
+		void print(std::ostream& out) const;
+
+		/**
+		 * @brief Remove all samples.
+		 */
+		void clear();
+
+	private:
+		std::map<std::string, std::vector<double> > mSamples;
+		mutable std::mutex mMutex;
+	};
+
+	/**
+	 * @class ScopedTimer
+	 * @brief Records the time until it is destroyed as a stage in a Profiler.
+	 * @details Does nothing if no profiler is given.
+	 */
+	class ScopedTimer
+	{
+	public:
+		ScopedTimer(Profiler* profiler, const char* stage)
+		 : mProfiler(profiler), mStage(stage)
+		{
+			if(mProfiler)
+				mStart = std::chrono::steady_clock::now();
+		}
+
+		~ScopedTimer()
+		{
+			if(mProfiler)
+				mProfiler->record(mStage, std::chrono::duration<double, std::milli>(
+					std::chrono::steady_clock::now() - mStart).count());
+		}
+
+	private:
+		Profiler* mProfiler;
+		const char* mStage;
+		std::chrono::steady_clock::time_point mStart;
+	};
+}
+
+#endif
@@ -32,43 +32,74 @@
 using namespace slam3d;
 
 ScanSensor::ScanSensor(const std::string& n, Logger* l)
- : Sensor(n,l), mPatchSolver(NULL)
+ : Sensor(n,l), mPatchSolver(NULL), mProfiler(NULL)
 {
 	mNeighborRadius = 1.0;
 	mMaxNeighorLinks = 1;
 	mMinLoopLength = 10;
 	mLinkPrevious = true;
 	mLastTransform = Transform::Identity();
+	mPatchCacheSize = 8;
+	mPatchCacheClock = 0;
+	mLinkQueueSize = 8;
+	mLocalMapSize = 0;
+	mLocalMapVersion = 0;
+	mLocalMapChanged = false;
+	mPipelineTransform = Transform::Identity();
+	mRegisteredTransform = Transform::Identity();
+	mPoseVertex = 0;
+	mPipelineRunning = false;
+	mPipelineLink = false;
+	mPipelineSequence = 0;
+	mNewestQueued = 0;
+	mNewestPreprocessed = 0;
+	mLinkDuration = 0;
 }
 
 ScanSensor::~ScanSensor()
 {
+	shutdown();
+}
+
+void ScanSensor::shutdown()
+{
+	stopPipeline();
+
+	boost::shared_ptr<WorkerPool> worker;
+	{
+		std::lock_guard<std::mutex> guard(mLinkWorkerMutex);
+		worker.swap(mLinkWorker);
+	}
+	// The destructor processes the queued vertices before joining
+	worker.reset();
 }
 
 bool ScanSensor::addMeasurement(const Measurement::Ptr& m)
 {
+	mMeasurementReceived = std::chrono::steady_clock::now();
 	if(mLastVertex == 0)
 	{
 		mLastVertex = mMapper->addMeasurement(m);
+		addKeyframe(mLastVertex);
+		vertexAdded(mLastVertex);
 		return true;
 	}
 
+	Measurement::Ptr local_map = getLocalMap();
+	if(local_map)
+		return addMeasurementToLocalMap(m, local_map);
+
 	Measurement::Ptr source = mMapper->getGraph()->getVertex(mLastVertex).measurement;
 	try
 	{
-		Constraint::Ptr c = createConstraint(source, m, mLastTransform, false);
+		Constraint::Ptr c = match(source, m, mLastTransform, false);
 		SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<SE3Constraint>(c);
-		if(!se3 || checkMinDistance(mLastTransform = se3->getRelativePose().transform))
+		if(se3)
+			setLastTransform(se3->getRelativePose().transform);
+		if(!se3 || checkMinDistance(mLastTransform))
 		{
-			IdType newVertex = mMapper->addMeasurement(m);
-			if(se3)
-			{
-				Transform pose = mMapper->getCurrentPose() * mLastTransform;
-				mMapper->getGraph()->setCorrectedPose(newVertex, pose);
-				mLastTransform = Transform::Identity();
-			}
-			mMapper->getGraph()->addConstraint(mLastVertex, newVertex, c);
-			mLastVertex = newVertex;
+			addRegisteredMeasurement(m, c);
+			setLastTransform(Transform::Identity());
 			return true;
 		}
 	}catch(std::exception &e)
@@ -78,12 +109,283 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m)
 	return false;
 }
 
+IdType ScanSensor::addRegisteredMeasurement(const Measurement::Ptr& m, const Constraint::Ptr& c)
+{
+	IdType newVertex = mMapper->addMeasurement(m);
+	SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<SE3Constraint>(c);
+	if(se3)
+	{
+		Transform pose = mMapper->getCurrentPose() * se3->getRelativePose().transform;
+		mMapper->getGraph()->setCorrectedPose(newVertex, pose);
+	}
+	mMapper->getGraph()->addConstraint(mLastVertex, newVertex, c);
+	mLastVertex = newVertex;
+	addKeyframe(newVertex);
+	vertexAdded(newVertex);
+	return newVertex;
+}
+
+void ScanSensor::startPipeline(unsigned capacity, bool link, const std::function<void(IdType)>& optimize)
+{
+	stopPipeline();
+	mLogger->message(INFO, (boost::format("pipeline_capacity:      %1%") % capacity).str());
+
+	std::lock_guard<std::mutex> guard(mPipelineMutex);
+	mPipelineLink = link;
+	mPipelineOptimize = optimize;
+	mPipelineTransform = mLastTransform;
+	if(mLastVertex)
+		mPipelineSource = mMapper->getGraph()->getVertex(mLastVertex).measurement;
+	else
+		mPipelineSource.reset();
+	{
+		// The registration stage continues from the last transform
+		std::lock_guard<std::mutex> pose_guard(mPoseMutex);
+		mPipelineRunning = true;
+		mPoseVertex = mLastVertex;
+		if(mPipelineSource && mLocalMapSize == 0)
+		{
+			mRegisteredTransform = mLastTransform;
+			mLastTransform = Transform::Identity();
+		}
+	}
+
+	std::vector<Pipeline<PipelineItem>::Stage> stages;
+	stages.push_back([this](PipelineItem& item)
+	{
+		if(isStale(item, mNewestQueued))
+			return false;
+		ScopedTimer timer(mProfiler, "preprocessing");
+		preprocessMeasurement(item.measurement);
+		mNewestPreprocessed = item.sequence;
+		return true;
+	});
+	stages.push_back([this](PipelineItem& item)
+	{
+		if(isStale(item, mNewestPreprocessed))
+			return false;
+		return registerPipelineItem(item);
+	});
+	stages.push_back(std::bind(&ScanSensor::mapPipelineItem, this, std::placeholders::_1));
+	const char* names[] = {"Preprocessing", "Registration", "Mapping"};
+	mPipeline.reset(new Pipeline<PipelineItem>(stages, capacity,
+		[this, names](size_t stage, const std::exception& e)
+		{
+			mLogger->message(ERROR, (boost::format("%1% in pipeline failed: %2%") % names[stage] % e.what()).str());
+		}));
+}
+
+void ScanSensor::stopPipeline()
+{
+	std::lock_guard<std::mutex> guard(mPipelineMutex);
+	mPipeline.reset();
+
+	// Continue sequential registration from the last registered scan
+	std::lock_guard<std::mutex> pose_guard(mPoseMutex);
+	for(std::deque<Transform>::iterator t = mPendingTransforms.begin(); t != mPendingTransforms.end(); ++t)
+	{
+		mLastTransform = mLastTransform * *t;
+	}
+	mLastTransform = mLastTransform * mRegisteredTransform;
+	mPendingTransforms.clear();
+	mRegisteredTransform = Transform::Identity();
+	mPipelineRunning = false;
+}
+
+void ScanSensor::flushPipeline()
+{
+	boost::shared_ptr<Pipeline<PipelineItem> > pipeline;
+	{
+		std::lock_guard<std::mutex> guard(mPipelineMutex);
+		pipeline = mPipeline;
+	}
+	if(pipeline)
+		pipeline->flush();
+}
+
+bool ScanSensor::queueMeasurement(const Measurement::Ptr& m, bool block)
+{
+	boost::shared_ptr<Pipeline<PipelineItem> > pipeline;
+	{
+		std::lock_guard<std::mutex> guard(mPipelineMutex);
+		pipeline = mPipeline;
+	}
+	if(!pipeline)
+		return false;
+	PipelineItem item;
+	item.measurement = m;
+	item.sequence = ++mPipelineSequence;
+	item.received = std::chrono::steady_clock::now();
+	if(!pipeline->push(item, block))
+		return false;
+
+	// With concurrent producers, a newer measurement may have been pushed first
+	unsigned long newest = mNewestQueued;
+	while(newest < item.sequence && !mNewestQueued.compare_exchange_weak(newest, item.sequence));
+	return true;
+}
+
+bool ScanSensor::isStale(const PipelineItem& item, unsigned long newest)
+{
+	if(item.sequence >= newest || !mMapper->getIngestionPolicy().drop_stale_frames)
+		return false;
+	mMapper->countIngestionEvent(FRAME_DROPPED);
+	mLogger->message(DEBUG, (boost::format("Dropped stale measurement %1% in favor of %2%.") % item.sequence % newest).str());
+	return true;
+}
+
+bool ScanSensor::registerPipelineItem(PipelineItem& item)
+{
+	// The first scan and scans for the local map are registered when mapping
+	if(!mPipelineSource || mLocalMapSize > 0)
+	{
+		mPipelineSource = item.measurement;
+		return true;
+	}
+
+	// Same as addMeasurement(), but only with the previous accepted scan
+	try
+	{
+		Constraint::Ptr c = match(mPipelineSource, item.measurement, mPipelineTransform, false);
+		SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<SE3Constraint>(c);
+		if(!se3 || checkMinDistance(mPipelineTransform = se3->getRelativePose().transform))
+		{
+			item.constraint = c;
+			mPipelineSource = item.measurement;
+			std::lock_guard<std::mutex> guard(mPoseMutex);
+			mPendingTransforms.push_back(se3 ? mPipelineTransform : Transform::Identity());
+			mPipelineTransform = Transform::Identity();
+			mRegisteredTransform = mPipelineTransform;
+			return true;
+		}
+		std::lock_guard<std::mutex> guard(mPoseMutex);
+		mRegisteredTransform = mPipelineTransform;
+	}catch(std::exception &e)
+	{
+		mLogger->message(WARNING, (boost::format("Could not add Measurement: %1%") % e.what()).str());
+	}
+	return false;
+}
+
+bool ScanSensor::mapPipelineItem(PipelineItem& item)
+{
+	IdType last = mLastVertex;
+	if(item.constraint)
+	{
+		// The registered transform moves from the pending ones to the new vertex
+		try
+		{
+			addRegisteredMeasurement(item.measurement, item.constraint);
+		}catch(std::exception &e)
+		{
+			std::lock_guard<std::mutex> guard(mPoseMutex);
+			mPendingTransforms.pop_front();
+			throw;
+		}
+		std::lock_guard<std::mutex> guard(mPoseMutex);
+		mPendingTransforms.pop_front();
+		mLastTransform = Transform::Identity();
+		mPoseVertex = mLastVertex;
+	}else
+	{
+		addMeasurement(item.measurement);
+		std::lock_guard<std::mutex> guard(mPoseMutex);
+		mPoseVertex = mLastVertex;
+	}
+	if(mLastVertex == last)
+		return false;
+
+	if(mPipelineLink)
+		linkWithinBudget(mLastVertex, item.received);
+	if(mPipelineOptimize)
+	{
+		try
+		{
+			mPipelineOptimize(mLastVertex);
+		}catch(std::exception &e)
+		{
+			mLogger->message(ERROR, (boost::format("Optimization in pipeline failed: %1%") % e.what()).str());
+		}
+	}
+	return true;
+}
+
+bool ScanSensor::addMeasurementToLocalMap(const Measurement::Ptr& m, const Measurement::Ptr& local_map)
+{
+	Graph* graph = mMapper->getGraph();
+	Transform last_pose = graph->getVertex(mLastVertex).corrected_pose;
+	try
+	{
+		// The local map is in the map frame, so the result is the pose of the scan
+		Constraint::Ptr c = match(local_map, m, last_pose * mLastTransform, false);
+		SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<SE3Constraint>(c);
+		if(!se3)
+		{
+			mLogger->message(ERROR, "Local map odometry requires SE(3) constraints!");
+			return false;
+		}
+		Transform pose = se3->getRelativePose().transform;
+		setLastTransform(last_pose.inverse() * pose);
+		if(!checkMinDistance(mLastTransform))
+			return false;
+
+		// Link the new vertex to the previous one, like in scan-to-scan matching
+		IdType newVertex = mMapper->addMeasurement(m);
+		graph->setCorrectedPose(newVertex, pose);
+		TransformWithCovariance twc(mLastTransform, se3->getRelativePose().covariance);
+		graph->addConstraint(mLastVertex, newVertex, Constraint::Ptr(new SE3Constraint(mName, twc)));
+		mLastVertex = newVertex;
+		setLastTransform(Transform::Identity());
+		addKeyframe(newVertex);
+		vertexAdded(newVertex);
+		return true;
+	}catch(std::exception &e)
+	{
+		mLogger->message(WARNING, (boost::format("Could not add Measurement: %1%") % e.what()).str());
+	}
+	return false;
+}
+
+void ScanSensor::addKeyframe(IdType vertex)
+{
+	if(mLocalMapSize == 0)
+		return;
+	mLocalMapKeyframes.push_back(vertex);
+	while(mLocalMapKeyframes.size() > mLocalMapSize)
+		mLocalMapKeyframes.pop_front();
+	mLocalMapChanged = true;
+}
+
+Measurement::Ptr ScanSensor::getLocalMap()
+{
+	if(mLocalMapSize == 0 || mLocalMapKeyframes.empty())
+		return Measurement::Ptr();
+
+	// Only update when keyframes were added or the graph has been changed
+	Graph* graph = mMapper->getGraph();
+	unsigned long version = graph->getPoseVersion();
+	if(mLocalMapChanged || version != mLocalMapVersion)
+	{
+		VertexObjectList keyframes;
+		for(std::deque<IdType>::iterator k = mLocalMapKeyframes.begin(); k != mLocalMapKeyframes.end(); ++k)
+		{
+			keyframes.push_back(graph->getVertex(*k));
+		}
+		mLocalMap = updateLocalMap(keyframes);
+		mLocalMapVersion = version;
+		mLocalMapChanged = false;
+	}
+	return mLocalMap;
+}
+
 bool ScanSensor::addMeasurement(const Measurement::Ptr& m, const Transform& odom)
 {
+	mMeasurementReceived = std::chrono::steady_clock::now();
 	if(mLastVertex == 0)
 	{
 		mLastVertex = mMapper->addMeasurement(m);
 		mLastOdometry = odom;
+		vertexAdded(mLastVertex);
 		return true;
 	}
 	
@@ -97,7 +399,7 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m, const Transform& odom
 		{
 			try
 			{
-				Constraint::Ptr c = createConstraint(source, m, odom_delta, false);
+				Constraint::Ptr c = match(source, m, odom_delta, false);
 				mMapper->getGraph()->addConstraint(mLastVertex, newVertex, c);
 
 				// Calculate the new pose relative from last pose
@@ -114,11 +416,128 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m, const Transform& odom
 		}
 		mLastOdometry = odom;
 		mLastVertex = newVertex;
+		vertexAdded(newVertex);
 		return true;
 	}
 	return false;
 }
 
+unsigned ScanSensor::addMeasurements(const std::vector<Measurement::Ptr>& scans,
+                                     const std::vector<Transform>& odometry, unsigned threads)
+{
+	if(!odometry.empty() && odometry.size() != scans.size())
+	{
+		mLogger->message(ERROR, "addMeasurements() requires one odometry pose per scan!");
+		return 0;
+	}
+
+	// Preprocessing does not depend on the graph
+	parallelFor(scans.size(), threads, [this, &scans](size_t begin, size_t end, unsigned)
+	{
+		for(size_t i = begin; i < end; i++)
+		{
+			ScopedTimer timer(mProfiler, "preprocessing");
+			preprocessMeasurement(scans[i]);
+		}
+	});
+
+	unsigned added = 0;
+	if(odometry.empty())
+	{
+		for(std::vector<Measurement::Ptr>::const_iterator m = scans.begin(); m != scans.end(); ++m)
+		{
+			if(addMeasurement(*m))
+				added++;
+		}
+		return added;
+	}
+
+	// Select the scans like addMeasurement(scan, odom)
+	std::vector<size_t> selected;
+	Transform last_odometry = mLastOdometry;
+	for(size_t i = 0; i < scans.size(); i++)
+	{
+		if((mLastVertex == 0 && selected.empty()) || checkMinDistance(last_odometry.inverse() * odometry[i]))
+		{
+			selected.push_back(i);
+			last_odometry = odometry[i];
+		}
+	}
+
+	// Register each selected scan with its predecessor, the first one with the last vertex
+	Graph* graph = mMapper->getGraph();
+	std::vector<Constraint::Ptr> constraints(selected.size());
+	if(mLinkPrevious)
+	{
+		Measurement::Ptr last = mLastVertex ? graph->getVertex(mLastVertex).measurement : Measurement::Ptr();
+		Transform last_odom = mLastOdometry;
+		parallelFor(selected.size(), threads, [&](size_t begin, size_t end, unsigned)
+		{
+			for(size_t k = begin; k < end; k++)
+			{
+				Measurement::Ptr source = (k > 0) ? scans[selected[k-1]] : last;
+				if(!source)
+					continue;
+				const Transform& source_odom = (k > 0) ? odometry[selected[k-1]] : last_odom;
+				try
+				{
+					constraints[k] = match(source, scans[selected[k]], source_odom.inverse() * odometry[selected[k]], false);
+				}catch(std::exception &e)
+				{
+					mLogger->message(WARNING, (boost::format("Could not link Measurement to previous: %1%") % e.what()).str());
+				}
+			}
+		});
+	}
+
+	// Chain the poses like addMeasurement(scan, odom) would set them
+	std::vector<Measurement::Ptr> measurements;
+	std::vector<Transform> poses;
+	Transform pose = mMapper->getCurrentPose();
+	Transform last_pose = mLastVertex ? graph->getVertex(mLastVertex).corrected_pose : pose;
+	for(size_t k = 0; k < selected.size(); k++)
+	{
+		SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<SE3Constraint>(constraints[k]);
+		if(se3)
+			pose = last_pose * se3->getRelativePose().transform;
+		measurements.push_back(scans[selected[k]]);
+		poses.push_back(pose);
+		last_pose = pose;
+	}
+
+	// Insert all vertices and then all constraints in a single batch each
+	std::vector<IdType> vertices = mMapper->addMeasurements(measurements, poses);
+	EdgeObjectList edges;
+	for(size_t k = 0; k < selected.size(); k++)
+	{
+		if(!constraints[k])
+			continue;
+		EdgeObject eo;
+		eo.source = (k > 0) ? vertices[k-1] : mLastVertex;
+		eo.target = vertices[k];
+		eo.constraint = constraints[k];
+		edges.push_back(eo);
+	}
+	graph->addConstraints(edges);
+
+	for(size_t k = 0; k < selected.size(); k++)
+	{
+		mLastOdometry = odometry[selected[k]];
+		mLastVertex = vertices[k];
+		vertexAdded(vertices[k]);
+		added++;
+	}
+	mLogger->message(INFO, (boost::format("Added %1% of %2% measurements.") % added % scans.size()).str());
+	return added;
+}
+
+Constraint::Ptr ScanSensor::match(const Measurement::Ptr& source, const Measurement::Ptr& target,
+                                  const Transform& odometry, bool loop)
+{
+	ScopedTimer timer(mProfiler, loop ? "loop_registration" : "registration");
+	return createConstraint(source, target, odometry, loop);
+}
+
 void ScanSensor::link(IdType source_id, IdType target_id)
 {
 	// We have no guess, so we use the current relative pose from the graph
@@ -138,7 +557,7 @@ void ScanSensor::link(IdType source_id, IdType target_id, const Transform& guess
 	// Create the relative pose constraint
 	try
 	{
-		Constraint::Ptr se3 = createConstraint(source_m, target_m, guess, true);
+		Constraint::Ptr se3 = match(source_m, target_m, guess, true);
 		mMapper->getGraph()->replaceConstraint(source_id, target_id, se3);
 	}catch(NoMatch &e)
 	{
@@ -154,33 +573,124 @@ void ScanSensor::linkToNeighbors(IdType vertex)
 	if(mMaxNeighorLinks == 0)
 		return;
 
+	std::vector<IdType> candidates = findLoopCandidates(vertex);
+	if(mLinkPool)
+	{
+		// All candidates are checked before the first one is linked
+		std::vector<IdType> accepted;
+		for(std::vector<IdType>::iterator c = candidates.begin(); c != candidates.end() && accepted.size() < mMaxNeighorLinks; c++)
+		{
+			try
+			{
+				if(isLoopCandidate(vertex, *c))
+					accepted.push_back(*c);
+			}catch(InvalidVertex &e)
+			{
+				mLogger->message(ERROR, e.what());
+				return;
+			}
+		}
+		if(accepted.size() > 1)
+			linkParallel(vertex, accepted);
+		else if(accepted.size() == 1)
+			link(accepted[0], vertex, getLoopGuess(accepted[0], vertex));
+		return;
+	}
+
+	// Each candidate is checked after the previous one has been linked,
+	// as a new loop closure can bring the following ones close in the graph.
+	unsigned count = 0;
+	for(std::vector<IdType>::iterator c = candidates.begin(); c != candidates.end() && count < mMaxNeighorLinks; c++)
+	{
+		try
+		{
+			if(!isLoopCandidate(vertex, *c))
+				continue;
+		}catch(InvalidVertex &e)
+		{
+			mLogger->message(ERROR, e.what());
+			return;
+		}
+		count++;
+		link(*c, vertex, getLoopGuess(*c, vertex));
+	}
+}
+
+Transform ScanSensor::getLoopGuess(IdType candidate, IdType vertex)
+{
+	return mMapper->getGraph()->getTransform(candidate, vertex).transform;
+}
+
+std::vector<IdType> ScanSensor::findLoopCandidates(IdType vertex)
+{
+	ScopedTimer timer(mProfiler, "neighbor_search");
 	mMapper->getGraph()->buildNeighborIndex(mName);
 	VertexObject obj = mMapper->getGraph()->getVertex(vertex);
 	VertexObjectList neighbors = mMapper->getGraph()->getNearbyVertices(obj.corrected_pose, mNeighborRadius);
 	
-	int count = 0;
-	for(auto i = neighbors.rbegin(); i != neighbors.rend() && count < mMaxNeighorLinks; i++)
+	std::vector<IdType> candidates;
+	for(auto i = neighbors.rbegin(); i != neighbors.rend(); i++)
+	{
+		if(i->index != vertex)
+			candidates.push_back(i->index);
+	}
+	rankLoopCandidates(vertex, candidates);
+	return candidates;
+}
+
+bool ScanSensor::isLoopCandidate(IdType vertex, IdType candidate)
+{
+	if(candidate == vertex)
+		return false;
+	try
+	{
+		mMapper->getGraph()->getEdge(vertex, candidate, mName);
+		return false;
+	}
+	catch(InvalidEdge &e){}
+
+	float dist = mMapper->getGraph()->calculateGraphDistance(candidate, vertex);
+	mLogger->message(DEBUG, (boost::format("Distance(%2%,%3%) in Graph is: %1%") % dist % candidate % vertex).str());
+	return dist > mPatchBuildingRange * 2 && dist >= mMinLoopLength;
+}
+
+void ScanSensor::linkParallel(IdType vertex, const std::vector<IdType>& candidates)
+{
+	Graph* graph = mMapper->getGraph();
+	for(std::vector<IdType>::const_iterator c = candidates.begin(); c != candidates.end(); c++)
+	{
+		graph->addTentativeConstraint(*c, vertex, mName);
+	}
+
+	// The patch around the new vertex is the same for all candidates
+	Measurement::Ptr target_m = buildPatch(vertex);
+
+	std::vector< std::future<Constraint::Ptr> > results;
+	results.reserve(candidates.size());
+	for(std::vector<IdType>::const_iterator c = candidates.begin(); c != candidates.end(); c++)
+	{
+		IdType source_id = *c;
+		Transform guess = getLoopGuess(source_id, vertex);
+		results.push_back(mLinkPool->post([this, source_id, target_m, guess]()
+		{
+			Measurement::Ptr source_m = buildPatch(source_id);
+			return match(source_m, target_m, guess, true);
+		}));
+	}
+
+	// Commit the results in a deterministic order
+	for(size_t i = 0; i < candidates.size(); i++)
 	{
-		IdType index = i->index;
-		if(index == vertex) continue;
 		try
 		{
-			mMapper->getGraph()->getEdge(vertex, index, mName);
-			continue;
-		}
-		catch(InvalidEdge &e){}
-		catch(InvalidVertex &e)
+			graph->replaceConstraint(candidates[i], vertex, results[i].get());
+		}catch(NoMatch &e)
 		{
-			mLogger->message(ERROR, e.what());
-			return;
+			mLogger->message(WARNING, (boost::format("Failed to link vertex %1% and %2%, because %3%.") % candidates[i] % vertex % e.what()).str());
+		}catch(std::exception &e)
+		{
+			mLogger->message(ERROR, (boost::format("Failed to link vertex %1% and %2%: %3%") % candidates[i] % vertex % e.what()).str());
 		}
-
-		float dist = mMapper->getGraph()->calculateGraphDistance(index, vertex);
-		mLogger->message(DEBUG, (boost::format("Distance(%2%,%3%) in Graph is: %1%") % dist % index % vertex).str());
-		if(dist <= mPatchBuildingRange * 2 || dist < mMinLoopLength)
-			continue;
-		count++;
-		link(index, vertex);
 	}
 }
 
@@ -189,20 +699,124 @@ void ScanSensor::linkLastToNeighbors(bool mt)
 	if(mMaxNeighorLinks < 1)
 		return;
 
-	if(mt)
-		boost::thread linkThread(&ScanSensor::linkToNeighbors, this, mLastVertex);
-	else
-		linkToNeighbors(mLastVertex);
+	if(!mt)
+	{
+		linkWithinBudget(mLastVertex, mMeasurementReceived);
+		return;
+	}
+
+	IdType vertex = mLastVertex;
+	std::chrono::steady_clock::time_point received = mMeasurementReceived;
+	boost::shared_ptr<WorkerPool> worker;
+	{
+		std::lock_guard<std::mutex> guard(mLinkWorkerMutex);
+		if(!mQueuedLinks.insert(vertex).second)
+		{
+			mLogger->message(DEBUG, (boost::format("Vertex %1% is already queued for linking.") % vertex).str());
+			mMapper->countIngestionEvent(LINKING_COALESCED);
+			return;
+		}
+		if(!mLinkWorker)
+			mLinkWorker.reset(new WorkerPool(1, mLinkQueueSize));
+		worker = mLinkWorker;
+	}
+
+	// Blocks while the queue is full
+	worker->post([this, vertex, received]()
+	{
+		{
+			std::lock_guard<std::mutex> guard(mLinkWorkerMutex);
+			mQueuedLinks.erase(vertex);
+		}
+		try
+		{
+			linkWithinBudget(vertex, received);
+		}catch(std::exception &e)
+		{
+			mLogger->message(ERROR, (boost::format("Failed to link vertex %1%: %2%") % vertex % e.what()).str());
+		}
+	});
+}
+
+void ScanSensor::linkWithinBudget(IdType vertex, const std::chrono::steady_clock::time_point& received)
+{
+	double budget = mMapper->getIngestionPolicy().latency_budget;
+	if(budget > 0)
+	{
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - received).count();
+		std::lock_guard<std::mutex> guard(mLinkDurationMutex);
+		if(elapsed + mLinkDuration > budget)
+		{
+			mLogger->message(DEBUG, (boost::format("Skipped linking of vertex %1%, %2%s elapsed and %3%s expected for linking.")
+				% vertex % elapsed % mLinkDuration).str());
+			mMapper->countIngestionEvent(LINKING_SKIPPED);
+
+			// Lower the estimate, so that a single slow linking does not disable it
+			mLinkDuration *= 0.5;
+			return;
+		}
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	linkToNeighbors(vertex);
+	double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::lock_guard<std::mutex> guard(mLinkDurationMutex);
+	mLinkDuration = mLinkDuration > 0 ? 0.8 * mLinkDuration + 0.2 * duration : duration;
+}
+
+void ScanSensor::waitForLinking()
+{
+	boost::shared_ptr<WorkerPool> worker;
+	{
+		std::lock_guard<std::mutex> guard(mLinkWorkerMutex);
+		worker = mLinkWorker;
+	}
+	// Jobs are processed in order by a single thread
+	if(worker)
+		worker->post([](){}).wait();
+}
+
+void ScanSensor::setLinkQueueSize(unsigned n)
+{
+	mLogger->message(INFO, (boost::format("link_queue_size:        %1%") % n).str());
+	boost::shared_ptr<WorkerPool> worker;
+	{
+		std::lock_guard<std::mutex> guard(mLinkWorkerMutex);
+		mLinkQueueSize = n > 0 ? n : 1;
+		worker.swap(mLinkWorker);
+	}
+	// Queued vertices are linked before the old worker is destroyed,
+	// a new one with the changed size is created on the next request.
+	worker.reset();
 }
 
 Measurement::Ptr ScanSensor::buildPatch(IdType source)
 {
+	ScopedTimer timer(mProfiler, "patch_building");
 	if(mPatchBuildingRange == 0)
 	{
 		return mMapper->getGraph()->getVertex(source).measurement;
 	}
 
+	// Check the cache before traversing the graph, as long as no edge has
+	// changed the traversal would yield the same vertices and edges.
+	unsigned long structure = mMapper->getGraph()->getStructureVersion();
+	unsigned long version = mMapper->getGraph()->getPoseVersion();
+	Measurement::Ptr cached = findPatch(source, structure, version);
+	if(cached)
+	{
+		mLogger->message(DEBUG, (boost::format("Using cached patch around vertex %1%.") % source).str());
+		return cached;
+	}
+
 	VertexObjectList v_objects = mMapper->getGraph()->getVerticesInRange(source, mPatchBuildingRange);
+	EdgeObjectList e_objects;
+	if(mPatchSolver)
+	{
+		e_objects = mMapper->getGraph()->getEdges(v_objects);
+	}
+	VertexObjectList original = v_objects;
 	mLogger->message(DEBUG, (boost::format("Building pointcloud patch from %1% nodes.") % v_objects.size()).str());
 	
 	if(mPatchSolver)
@@ -214,7 +828,6 @@ Measurement::Ptr ScanSensor::buildPatch(IdType source)
 			mPatchSolver->addVertex(v->index, v->corrected_pose);
 		}
 		
-		EdgeObjectList e_objects = mMapper->getGraph()->getEdges(v_objects);
 		for(EdgeObjectList::iterator e = e_objects.begin(); e < e_objects.end(); e++)
 		{
 			if(e->constraint->getType() != SE3)
@@ -249,7 +862,60 @@ Measurement::Ptr ScanSensor::buildPatch(IdType source)
 			}
 		}
 	}
-	return createCombinedMeasurement(v_objects, mMapper->getGraph()->getVertex(source).corrected_pose);
+	Measurement::Ptr patch = createCombinedMeasurement(v_objects, mMapper->getGraph()->getVertex(source).corrected_pose);
+	storePatch(source, structure, version, original, patch);
+	return patch;
+}
+
+Measurement::Ptr ScanSensor::findPatch(IdType source, unsigned long structure, unsigned long version)
+{
+	std::lock_guard<std::mutex> guard(mPatchCacheMutex);
+	PatchCache::iterator it = mPatchCache.find(std::make_pair(source, mPatchBuildingRange));
+	if(it == mPatchCache.end())
+		return Measurement::Ptr();
+
+	PatchCacheEntry& entry = it->second;
+	if(entry.structure_version != structure)
+		return Measurement::Ptr();
+
+	// Poses might have changed without affecting this patch
+	if(entry.pose_version != version)
+	{
+		for(size_t i = 0; i < entry.vertices.size(); i++)
+		{
+			const Transform& pose = mMapper->getGraph()->getVertex(entry.vertices[i]).corrected_pose;
+			if(entry.poses[i].matrix() != pose.matrix())
+				return Measurement::Ptr();
+		}
+		entry.pose_version = version;
+	}
+	entry.last_used = ++mPatchCacheClock;
+	return entry.patch;
+}
+
+void ScanSensor::storePatch(IdType source, unsigned long structure, unsigned long version,
+                            const VertexObjectList& vertices, const Measurement::Ptr& patch)
+{
+	std::lock_guard<std::mutex> guard(mPatchCacheMutex);
+	if(mPatchCacheSize == 0)
+		return;
+
+	std::pair<IdType, unsigned> key(source, mPatchBuildingRange);
+	if(mPatchCache.find(key) == mPatchCache.end())
+		trimPatchCache(mPatchCacheSize - 1);
+
+	PatchCacheEntry& entry = mPatchCache[key];
+	entry.structure_version = structure;
+	entry.pose_version = version;
+	entry.vertices.clear();
+	entry.poses.clear();
+	for(VertexObjectList::const_iterator v = vertices.begin(); v < vertices.end(); v++)
+	{
+		entry.vertices.push_back(v->index);
+		entry.poses.push_back(v->corrected_pose);
+	}
+	entry.last_used = ++mPatchCacheClock;
+	entry.patch = patch;
 }
 
 void ScanSensor::setNeighborRadius(float r, unsigned l)
@@ -272,13 +938,73 @@ void ScanSensor::setLinkPrevious(bool l)
 	mLinkPrevious = l;
 }
 
+void ScanSensor::setLocalMapSize(unsigned n)
+{
+	mLogger->message(INFO, (boost::format("local_map_size:         %1%") % n).str());
+	mLocalMapSize = n;
+	while(mLocalMapKeyframes.size() > mLocalMapSize)
+		mLocalMapKeyframes.pop_front();
+	if(mLocalMapSize == 0)
+		mLocalMap.reset();
+	mLocalMapChanged = true;
+}
+
+void ScanSensor::setLinkingThreads(unsigned n)
+{
+	mLogger->message(INFO, (boost::format("linking_threads:        %1%") % n).str());
+	if(n > 1)
+		mLinkPool.reset(new WorkerPool(n));
+	else
+		mLinkPool.reset();
+}
+
 void ScanSensor::setPatchBuildingRange(unsigned r)
 {
 	mLogger->message(INFO, (boost::format("patch_building_range:   %1%") % r).str());
 	mPatchBuildingRange = r;
 }
 
+void ScanSensor::trimPatchCache(size_t n)
+{
+	// Remove the least recently used patches
+	while(mPatchCache.size() > n)
+	{
+		PatchCache::iterator oldest = mPatchCache.begin();
+		for(PatchCache::iterator it = mPatchCache.begin(); it != mPatchCache.end(); ++it)
+		{
+			if(it->second.last_used < oldest->second.last_used)
+				oldest = it;
+		}
+		mPatchCache.erase(oldest);
+	}
+}
+
+void ScanSensor::setPatchCacheSize(unsigned n)
+{
+	mLogger->message(INFO, (boost::format("patch_cache_size:       %1%") % n).str());
+	std::lock_guard<std::mutex> guard(mPatchCacheMutex);
+	mPatchCacheSize = n;
+	trimPatchCache(mPatchCacheSize);
+}
+
 Transform ScanSensor::getCurrentPose() const
 {
-	return mMapper->getCurrentPose() * mLastTransform;
+	std::lock_guard<std::mutex> guard(mPoseMutex);
+	if(!mPipelineRunning || mPoseVertex == 0)
+		return mMapper->getCurrentPose() * mLastTransform;
+
+	// Add the motion of the scans that have been registered but not mapped yet
+	Transform pose = mMapper->getGraph()->getVertex(mPoseVertex).corrected_pose * mLastTransform;
+	for(std::deque<Transform>::const_iterator t = mPendingTransforms.begin(); t != mPendingTransforms.end(); ++t)
+	{
+		pose = pose * *t;
+	}
+	return pose * mRegisteredTransform;
+}
+
+void ScanSensor::setLastTransform(const Transform& tf)
+{
+	std::lock_guard<std::mutex> guard(mPoseMutex);
+	mLastTransform = tf;
+	mPoseVertex = mLastVertex;
 }
\ No newline at end of file
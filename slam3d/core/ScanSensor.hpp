@@ -28,8 +28,16 @@
 
 #include "Sensor.hpp"
 #include "Solver.hpp"
+#include "WorkerPool.hpp"
+#include "Pipeline.hpp"
+#include "Profiler.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <mutex>
+#include <set>
 
 namespace slam3d
 {
@@ -48,6 +56,14 @@ namespace slam3d
 		 */
 		void setPatchSolver(Solver* solver) { mPatchSolver = solver; }
 
+		/**
+		 * @brief Record the duration of the processing stages.
+		 * @details The stages are preprocessing, registration, loop_registration,
+		 * patch_building and neighbor_search.
+		 * @param profiler must outlive this sensor, NULL to disable
+		 */
+		void setProfiler(Profiler* profiler) { mProfiler = profiler; }
+
 		/**
 		 * @brief Set how far to continue with a breadth-first-search through
 		 * the pose graph when building local map patches to match new
@@ -57,6 +73,21 @@ namespace slam3d
 		 */
 		void setPatchBuildingRange(unsigned r);
 
+		/**
+		 * @brief Get the range used to build local map patches.
+		 */
+		unsigned getPatchBuildingRange() const { return mPatchBuildingRange; }
+
+		/**
+		 * @brief Set how many local map patches are kept for reuse.
+		 * @details A cached patch is reused as long as no edge of the graph has
+		 * been added, removed or replaced and its vertices keep their poses. The
+		 * least recently used patch is
+		 * discarded when the cache is full.
+		 * @param n maximum number of cached patches, 0 to disable the cache
+		 */
+		void setPatchCacheSize(unsigned n);
+
 		/**
 		 * @brief Sets neighbor radius for scan matching
 		 * @details New nodes are matched against nodes of the same sensor
@@ -78,6 +109,29 @@ namespace slam3d
 		 */
 		void setLinkPrevious(bool l);
 
+		/**
+		 * @brief Sets the number of threads used to verify loop closures.
+		 * @details With more than one thread, linkToNeighbors() builds the
+		 * patches and runs createConstraint() for all candidates concurrently
+		 * and adds the resulting constraints in the order of the candidates.
+		 * This requires createConstraint() to be reentrant. Unlike sequential
+		 * linking, all candidates are checked by isLoopCandidate() before the
+		 * first one is linked, so a loop closure does not exclude candidates
+		 * that it brings close in the graph.
+		 * @param n number of threads, 0 or 1 to link sequentially
+		 */
+		void setLinkingThreads(unsigned n);
+
+		/**
+		 * @brief Sets the number of keyframes in the local map for odometry.
+		 * @details If set, addMeasurement(scan) registers each scan against a
+		 * local map of the last n vertices instead of only the last one. The
+		 * local map is maintained by the derived sensor (see updateLocalMap),
+		 * sensors that do not support it fall back to scan-to-scan matching.
+		 * @param n number of keyframes, 0 to disable
+		 */
+		void setLocalMapSize(unsigned n);
+
 		/**
 		 * @brief Add a new measurement from this sensor.
 		 * @param scan
@@ -91,6 +145,71 @@ namespace slam3d
 		 */
 		bool addMeasurement(const Measurement::Ptr& scan, const Transform& odom);
 
+		/**
+		 * @brief Add a sequence of measurements, e.g. from a logged dataset.
+		 * @details All scans are first prepared in parallel with
+		 * preprocessMeasurement(). With odometry, the scans to be added only
+		 * depend on the odometry, so consecutive scans are registered in
+		 * parallel. Then all vertices and all constraints are each inserted
+		 * into the graph as one batch and vertexAdded() is called for the new
+		 * vertices in order. Without odometry, whether a scan is added depends
+		 * on the registration of the scan before, so they are registered and
+		 * inserted one after another. The resulting graph is the same as when
+		 * calling addMeasurement() for each scan.
+		 * This requires createConstraint() to be reentrant.
+		 * @param scans measurements in the order they were recorded
+		 * @param odometry one odometry pose per scan, or empty
+		 * @param threads number of threads, 0 uses the number of cores
+		 * @return number of added vertices
+		 */
+		unsigned addMeasurements(const std::vector<Measurement::Ptr>& scans,
+		                         const std::vector<Transform>& odometry = std::vector<Transform>(),
+		                         unsigned threads = 0);
+
+		/**
+		 * @brief Start processing measurements asynchronously.
+		 * @details Measurements given to queueMeasurement() pass three stages,
+		 * each on its own worker thread: preprocessMeasurement(), registration
+		 * against the previous scan, and the mapping stage that inserts the
+		 * vertex into the graph, links it to its neighbors and calls the
+		 * optimize callback. While one scan is registered, the previous one
+		 * is processed by the mapping stage. The mapping steps share a single
+		 * stage, because each of them depends on the graph left by the one
+		 * before, so the resulting graph is the same as when calling
+		 * addMeasurement(), linkLastToNeighbors() and optimize in sequence.
+		 * With a local map (see setLocalMapSize), registration depends on the
+		 * graph and therefore also takes place in the mapping stage.
+		 *
+		 * addMeasurement() must not be called while the pipeline is running.
+		 * If the mapper's IngestionPolicy drops stale frames, a measurement is
+		 * skipped by the preprocessing and registration stages when a newer
+		 * one is already waiting in front of the same stage. The newest
+		 * measurement is never skipped.
+		 * @param capacity maximum number of measurements waiting in front of each stage
+		 * @param link whether to link each new vertex to its neighbors
+		 * @param optimize called with each new vertex, may be empty
+		 */
+		void startPipeline(unsigned capacity, bool link,
+		                   const std::function<void(IdType)>& optimize = std::function<void(IdType)>());
+
+		/**
+		 * @brief Process all queued measurements and stop the pipeline.
+		 */
+		void stopPipeline();
+
+		/**
+		 * @brief Wait until all queued measurements have been processed.
+		 */
+		void flushPipeline();
+
+		/**
+		 * @brief Add a measurement to the pipeline.
+		 * @param scan
+		 * @param block whether to wait if the pipeline is full
+		 * @return false if the pipeline is not running or full
+		 */
+		bool queueMeasurement(const Measurement::Ptr& scan, bool block = true);
+
 		/**
 		 * @brief Create a virtual measurement by accumulating scans from given vertices.
 		 * @param vertices list of vertices that should contain a Measurement of this sensor
@@ -109,7 +228,9 @@ namespace slam3d
 		 * @brief Create a constraint between two measurements.
 		 * @details The odometry transformation and the resulting constraint are
 		 * with regards to the robot coordinate system. Make sure that sensor_pose
-		 * is properly set within the measurements.
+		 * is properly set within the measurements. Implementations must be
+		 * reentrant, as this is called concurrently when linking with multiple
+		 * threads (see setLinkingThreads).
 		 * @param source
 		 * @param target
 		 * @param odometry
@@ -143,27 +264,263 @@ namespace slam3d
 		
 		/**
 		 * @brief Create connecting edges for last added vertex.
+		 * @details In a separate thread, the vertex is queued for a single
+		 * worker owned by this sensor. If the queue is full, the call blocks
+		 * until the worker has taken the next vertex. A vertex that is still
+		 * waiting in the queue is not queued again. Linking is skipped when it
+		 * would exceed the latency budget of the mapper's IngestionPolicy,
+		 * counted from the start of the last call to addMeasurement().
 		 * @param mt whether to run in a separate thread
 		 */
 		void linkLastToNeighbors(bool mt = false);
 
+		/**
+		 * @brief Set how many vertices can wait for linking in a separate thread.
+		 * @param n maximum number of waiting vertices, at least 1
+		 */
+		void setLinkQueueSize(unsigned n);
+
+		/**
+		 * @brief Wait until all vertices queued by linkLastToNeighbors(true) are linked.
+		 */
+		void waitForLinking();
+
 		/**
 		 * @brief Returns the current pose from sequential scan matching.
+		 * @details While the pipeline is running, this includes the scans
+		 * that have been registered but not yet added to the graph.
 		 */
 		Transform getCurrentPose() const;
 
+	protected:
+		/**
+		 * @brief Called after a measurement of this sensor has been added to the graph.
+		 * @details Derived sensors can use this to process the stored measurement,
+		 * e.g. to convert it into a more compact representation.
+		 * @param vertex id of the new vertex
+		 */
+		virtual void vertexAdded(IdType /*vertex*/) {}
+
+		/**
+		 * @brief Finish all asynchronous work of this sensor.
+		 * @details Stops the pipeline and the linking worker after they have
+		 * processed all queued measurements. As they call virtual methods,
+		 * derived sensors have to call this in their destructor.
+		 */
+		void shutdown();
+
+		/**
+		 * @brief Prepare a measurement for registration in the pipeline.
+		 * @details Called by the first stage of the pipeline before the
+		 * measurement is registered, e.g. to compute and cache registration
+		 * data. It must not access the graph.
+		 * @param scan
+		 */
+		virtual void preprocessMeasurement(const Measurement::Ptr& /*scan*/) {}
+
+		/**
+		 * @brief Rank the candidates for loop closures of a new vertex.
+		 * @details Called by linkToNeighbors() with the vertices found within
+		 * the neighbor radius, most recent first. Derived sensors can reorder
+		 * them, remove unlikely ones or add candidates found otherwise, e.g. by
+		 * place recognition. Candidates are then checked by isLoopCandidate()
+		 * in the given order until the maximum number of links is reached.
+		 * @param vertex the new vertex
+		 * @param candidates
+		 */
+		virtual void rankLoopCandidates(IdType /*vertex*/, std::vector<IdType>& /*candidates*/) {}
+
+		/**
+		 * @brief Get the initial guess for registering a loop candidate.
+		 * @details The default is the current relative pose in the graph.
+		 * Derived sensors override this for candidates that they added in
+		 * rankLoopCandidates(), as the graph may have drifted between them.
+		 * @param candidate the vertex that is linked to the new vertex
+		 * @param vertex the new vertex
+		 */
+		virtual Transform getLoopGuess(IdType candidate, IdType vertex);
+
+		/**
+		 * @brief Find the vertices a new vertex might be linked to.
+		 * @details Searches the neighbor radius and ranks the results with
+		 * rankLoopCandidates(). The candidates still have to pass
+		 * isLoopCandidate() before they are linked.
+		 * @param vertex
+		 */
+		std::vector<IdType> findLoopCandidates(IdType vertex);
+
+		/**
+		 * @brief Check whether a loop closure between the vertices should be attempted.
+		 * @details This is false if they are already linked or their distance
+		 * in the graph is shorter than the minimum loop length.
+		 * @param vertex
+		 * @param candidate
+		 * @throw InvalidVertex
+		 */
+		bool isLoopCandidate(IdType vertex, IdType candidate);
+
+		/**
+		 * @brief Update the local map for odometry from the given keyframes.
+		 * @details Called when the keyframes or their poses have changed. The
+		 * returned measurement has to be in the map frame (with identity sensor
+		 * pose), it is used as source in createConstraint() for all following
+		 * scans until the next update. Implementations should update their map
+		 * incrementally and keep registration data with the measurement.
+		 * @param keyframes vertices of the local map, oldest first
+		 * @return local map or an empty pointer if not supported
+		 */
+		virtual Measurement::Ptr updateLocalMap(const VertexObjectList& /*keyframes*/) { return Measurement::Ptr(); }
+
+		/**
+		 * @brief Get the current local map, updating it if necessary.
+		 * @return local map or an empty pointer if not used
+		 */
+		Measurement::Ptr getLocalMap();
+
+		/**
+		 * @brief Register a scan against the local map and add it if the robot moved far enough.
+		 * @param scan
+		 * @param local_map
+		 */
+		bool addMeasurementToLocalMap(const Measurement::Ptr& scan, const Measurement::Ptr& local_map);
+
+		/**
+		 * @brief Call createConstraint() and record its duration.
+		 */
+		Constraint::Ptr match(const Measurement::Ptr& source, const Measurement::Ptr& target,
+		                      const Transform& odometry, bool loop);
+
+		/**
+		 * @brief Add a measurement that has been registered against the last vertex.
+		 * @param scan
+		 * @param constraint from the last vertex to the scan
+		 * @return id of the new vertex
+		 */
+		IdType addRegisteredMeasurement(const Measurement::Ptr& scan, const Constraint::Ptr& constraint);
+
+		/**
+		 * @brief Add a vertex to the keyframes of the local map.
+		 * @param vertex
+		 */
+		void addKeyframe(IdType vertex);
+
+		/**
+		 * @brief Link the vertex to all candidates in parallel.
+		 * @details The constraints are added to the graph in the given order.
+		 * @param vertex
+		 * @param candidates
+		 */
+		void linkParallel(IdType vertex, const std::vector<IdType>& candidates);
+
+		/**
+		 * @brief Get a patch from the cache if it is still valid.
+		 * @details The patch is valid if no edge has changed since it was built
+		 * and its vertices still have the same poses.
+		 * @param source vertex the patch was built around
+		 * @param structure current structure version of the graph
+		 * @param version current pose version of the graph
+		 * @return the cached patch or an empty pointer
+		 */
+		Measurement::Ptr findPatch(IdType source, unsigned long structure, unsigned long version);
+
+		/**
+		 * @brief Store a patch in the cache.
+		 */
+		void storePatch(IdType source, unsigned long structure, unsigned long version,
+		                const VertexObjectList& vertices, const Measurement::Ptr& patch);
+
+		/**
+		 * @brief Remove the least recently used patches until at most n are left.
+		 * @details The patch cache mutex must be held by the caller.
+		 */
+		void trimPatchCache(size_t n);
+
 	private:
 		Solver* mPatchSolver;
 		std::mutex mPatchSolverMutex;
+		Profiler* mProfiler;
 
 		unsigned mPatchBuildingRange;
 		unsigned mMaxNeighorLinks;
 		float mNeighborRadius;
 		unsigned mMinLoopLength;
 		bool mLinkPrevious;
+		boost::shared_ptr<WorkerPool> mLinkPool;
+
+		// Separate from mLinkPool, whose jobs are awaited by the linking jobs
+		boost::shared_ptr<WorkerPool> mLinkWorker;
+		std::set<IdType> mQueuedLinks;
+		std::mutex mLinkWorkerMutex;
+		unsigned mLinkQueueSize;
+
+		struct PatchCacheEntry
+		{
+			unsigned long structure_version;
+			unsigned long pose_version;
+			std::vector<IdType> vertices;
+			std::vector<Transform> poses;
+			unsigned long last_used;
+			Measurement::Ptr patch;
+		};
+		typedef std::map<std::pair<IdType, unsigned>, PatchCacheEntry> PatchCache;
+		PatchCache mPatchCache;
+		std::mutex mPatchCacheMutex;
+		unsigned mPatchCacheSize;
+		unsigned long mPatchCacheClock;
+
+		unsigned mLocalMapSize;
+		std::deque<IdType> mLocalMapKeyframes;
+		Measurement::Ptr mLocalMap;
+		unsigned long mLocalMapVersion;
+		bool mLocalMapChanged;
 
 		Transform mLastOdometry;
+
+		// Written only by the thread adding measurements, which may read it
+		// without locking, all writes go through setLastTransform()
+		void setLastTransform(const Transform& tf);
 		Transform mLastTransform;
+
+		// While the pipeline runs, the current pose is the pose of mPoseVertex
+		// followed by mLastTransform, the transforms of the scans registered
+		// but not yet mapped and the motion since the last registered scan.
+		IdType mPoseVertex;
+		std::deque<Transform> mPendingTransforms;
+		Transform mRegisteredTransform;
+		bool mPipelineRunning;
+		mutable std::mutex mPoseMutex;
+
+		// Links the vertex unless this would exceed the latency budget
+		// for a measurement received at the given time
+		void linkWithinBudget(IdType vertex, const std::chrono::steady_clock::time_point& received);
+
+		std::chrono::steady_clock::time_point mMeasurementReceived;
+		double mLinkDuration;
+		std::mutex mLinkDurationMutex;
+
+		// Measurement passed between the pipeline stages
+		struct PipelineItem
+		{
+			Measurement::Ptr measurement;
+			Constraint::Ptr constraint;
+			unsigned long sequence;
+			std::chrono::steady_clock::time_point received;
+		};
+		bool registerPipelineItem(PipelineItem& item);
+		bool isStale(const PipelineItem& item, unsigned long newest);
+		bool mapPipelineItem(PipelineItem& item);
+
+		boost::shared_ptr<Pipeline<PipelineItem> > mPipeline;
+		std::mutex mPipelineMutex;
+		Measurement::Ptr mPipelineSource;
+		Transform mPipelineTransform;
+		bool mPipelineLink;
+		std::function<void(IdType)> mPipelineOptimize;
+
+		// Sequence numbers of the newest measurements in front of the first two stages
+		std::atomic<unsigned long> mPipelineSequence;
+		std::atomic<unsigned long> mNewestQueued;
+		std::atomic<unsigned long> mNewestPreprocessed;
 	};
 }
 
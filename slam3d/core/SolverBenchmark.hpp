@@ -0,0 +1,374 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_SOLVER_BENCHMARK_HPP
+#define SLAM_SOLVER_BENCHMARK_HPP
+
+#include "Solver.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+
+namespace slam3d
+{
+	/**
+	 * @struct PoseGraphData
+	 * @brief Vertices and SE(3) edges of a pose graph, independent of any Solver.
+	 */
+	struct PoseGraphData
+	{
+		struct Edge
+		{
+			IdType source;
+			IdType target;
+			TransformWithCovariance twc;
+		};
+
+		std::string name;
+		IdPoseVector vertices;
+		std::vector<Edge> edges;
+	};
+
+	/**
+	 * @brief Create a covariance from an upper triangular information matrix as stored in g2o/TORO files.
+	 * @param values upper triangular part of the information matrix in row-major order
+	 * @param dim dimension of the information matrix (3 for 2D, 6 for 3D files)
+	 */
+	inline Covariance<6> covarianceFromInformation(const std::vector<ScalarType>& values, unsigned dim)
+	{
+		Information<6> info = Information<6>::Zero();
+		if(dim == 3)
+		{
+			// Embed (x, y, yaw) in 3D, g2o uses the quaternion's vector part for the
+			// rotation, so the variance of qz is a quarter of the yaw variance.
+			const unsigned map[3] = {0, 1, 5};
+			const ScalarType scale[3] = {1, 1, 4};
+			unsigned k = 0;
+			for(unsigned i = 0; i < 3; i++)
+				for(unsigned j = i; j < 3; j++, k++)
+					info(map[i], map[j]) = info(map[j], map[i]) = values[k] * std::sqrt(scale[i] * scale[j]);
+			info(2,2) = info(3,3) = info(4,4) = 1e4;
+		}else
+		{
+			unsigned k = 0;
+			for(unsigned i = 0; i < 6; i++)
+				for(unsigned j = i; j < 6; j++, k++)
+					info(i,j) = info(j,i) = values[k];
+		}
+		return info.inverse();
+	}
+
+	/**
+	 * @brief Load a pose graph from a file in g2o or TORO format.
+	 * @details Supported are the SE(3) types VERTEX_SE3:QUAT, EDGE_SE3:QUAT,
+	 * VERTEX3 and EDGE3 as well as the planar types VERTEX_SE2, EDGE_SE2,
+	 * VERTEX2 and EDGE2, which are embedded in the xy-plane. TORO's 3D
+	 * information matrices are used as if they were given in g2o's rotation
+	 * parameterization. All other lines are ignored.
+	 * @param filename path to the graph file
+	 * @param data structure to be filled
+	 * @return false if the file could not be read or an edge references a
+	 * vertex that is not in the file
+	 */
+	inline bool loadPoseGraph(const std::string& filename, PoseGraphData& data)
+	{
+		std::ifstream file(filename.c_str());
+		if(!file.good())
+			return false;
+
+		data.name = filename.substr(filename.find_last_of('/') + 1);
+		data.vertices.clear();
+		data.edges.clear();
+
+		std::string line;
+		while(std::getline(file, line))
+		{
+			std::istringstream in(line);
+			std::string tag;
+			in >> tag;
+			Transform tf = Transform::Identity();
+			if(tag == "VERTEX_SE3:QUAT" || tag == "VERTEX3")
+			{
+				IdType id;
+				ScalarType x, y, z, a, b, c, d;
+				in >> id >> x >> y >> z >> a >> b >> c;
+				tf.translation() = Position(x, y, z);
+				if(tag == "VERTEX3")
+				{
+					tf.linear() = (Eigen::AngleAxis<ScalarType>(c, Direction::UnitZ())
+					             * Eigen::AngleAxis<ScalarType>(b, Direction::UnitY())
+					             * Eigen::AngleAxis<ScalarType>(a, Direction::UnitX())).toRotationMatrix();
+				}else
+				{
+					in >> d;
+					tf.linear() = Eigen::Quaternion<ScalarType>(d, a, b, c).normalized().toRotationMatrix();
+				}
+				data.vertices.push_back(IdPose(id, tf));
+			}else if(tag == "VERTEX_SE2" || tag == "VERTEX2" || tag == "VERTEX")
+			{
+				IdType id;
+				ScalarType x, y, yaw;
+				in >> id >> x >> y >> yaw;
+				tf.translation() = Position(x, y, 0);
+				tf.linear() = Eigen::AngleAxis<ScalarType>(yaw, Direction::UnitZ()).toRotationMatrix();
+				data.vertices.push_back(IdPose(id, tf));
+			}else if(tag == "EDGE_SE3:QUAT" || tag == "EDGE3")
+			{
+				PoseGraphData::Edge e;
+				ScalarType x, y, z, a, b, c, d;
+				in >> e.source >> e.target >> x >> y >> z >> a >> b >> c;
+				tf.translation() = Position(x, y, z);
+				if(tag == "EDGE3")
+				{
+					tf.linear() = (Eigen::AngleAxis<ScalarType>(c, Direction::UnitZ())
+					             * Eigen::AngleAxis<ScalarType>(b, Direction::UnitY())
+					             * Eigen::AngleAxis<ScalarType>(a, Direction::UnitX())).toRotationMatrix();
+				}else
+				{
+					in >> d;
+					tf.linear() = Eigen::Quaternion<ScalarType>(d, a, b, c).normalized().toRotationMatrix();
+				}
+				std::vector<ScalarType> info(21);
+				for(unsigned i = 0; i < 21; i++)
+					in >> info[i];
+				e.twc = TransformWithCovariance(tf, covarianceFromInformation(info, 6));
+				data.edges.push_back(e);
+			}else if(tag == "EDGE_SE2" || tag == "EDGE2" || tag == "EDGE")
+			{
+				PoseGraphData::Edge e;
+				ScalarType x, y, yaw;
+				in >> e.source >> e.target >> x >> y >> yaw;
+				tf.translation() = Position(x, y, 0);
+				tf.linear() = Eigen::AngleAxis<ScalarType>(yaw, Direction::UnitZ()).toRotationMatrix();
+				std::vector<ScalarType> info(6);
+				for(unsigned i = 0; i < 6; i++)
+					in >> info[i];
+				if(tag != "EDGE_SE2")
+				{
+					// TORO stores (xx, xy, yy, tt, xt, yt)
+					std::vector<ScalarType> toro(info);
+					info[0] = toro[0]; info[1] = toro[1]; info[2] = toro[4];
+					info[3] = toro[2]; info[4] = toro[5]; info[5] = toro[3];
+				}
+				e.twc = TransformWithCovariance(tf, covarianceFromInformation(info, 3));
+				data.edges.push_back(e);
+			}
+		}
+
+		std::set<IdType> ids;
+		for(const IdPose& v : data.vertices)
+			ids.insert(v.first);
+		for(const PoseGraphData::Edge& e : data.edges)
+		{
+			if(ids.find(e.source) == ids.end() || ids.find(e.target) == ids.end())
+				return false;
+		}
+		return !data.vertices.empty();
+	}
+
+	/**
+	 * @brief Create a synthetic planar pose graph similar to the Manhattan datasets.
+	 * @details The robot drives on a grid, odometry edges and initial poses are
+	 * disturbed by gaussian noise and loop closures are added to previously visited
+	 * poses within the given radius. The result only depends on the given seed.
+	 * @param size number of vertices
+	 * @param loop_radius maximum distance of loop closing edges
+	 * @param seed seed for the random number generator
+	 */
+	inline PoseGraphData createSyntheticGraph(unsigned size, ScalarType loop_radius = 1.5, unsigned seed = 42)
+	{
+		PoseGraphData data;
+		data.name = (boost::format("synthetic_%1%") % size).str();
+
+		std::mt19937 rng(seed);
+		std::normal_distribution<ScalarType> trans_noise(0, 0.05);
+		std::normal_distribution<ScalarType> rot_noise(0, 0.01);
+		std::uniform_real_distribution<ScalarType> uniform(0, 1);
+
+		Covariance<6> cov = Covariance<6>::Identity() * 0.05 * 0.05;
+		cov.bottomRightCorner<3,3>() = Covariance<3>::Identity() * 0.005 * 0.005;
+
+		int extent = std::max(3, (int)std::sqrt((double)size) / 2);
+		std::vector<Transform> truth;
+		Transform pose = Transform::Identity();
+		Transform guess = Transform::Identity();
+		std::multimap<std::pair<int,int>, IdType> visited;
+		for(IdType id = 0; id < size; id++)
+		{
+			if(id > 0)
+			{
+				// Drive one meter and turn left or right on some occasions
+				Transform step = Transform::Identity();
+				step.translation() = Position(1, 0, 0);
+				ScalarType r = uniform(rng);
+				Position ahead = (pose * step).translation();
+				if(r < 0.15 || std::abs(ahead.x()) > extent || std::abs(ahead.y()) > extent)
+					step.linear() = Eigen::AngleAxis<ScalarType>(M_PI / 2, Direction::UnitZ()).toRotationMatrix();
+				else if(r < 0.3)
+					step.linear() = Eigen::AngleAxis<ScalarType>(-M_PI / 2, Direction::UnitZ()).toRotationMatrix();
+				pose = pose * step;
+
+				Transform noisy = step;
+				noisy.translation() += Position(trans_noise(rng), trans_noise(rng), trans_noise(rng));
+				noisy.linear() = noisy.linear() * Eigen::AngleAxis<ScalarType>(rot_noise(rng), Direction::UnitZ()).toRotationMatrix();
+				guess = guess * noisy;
+
+				PoseGraphData::Edge odom = {id - 1, id, TransformWithCovariance(noisy, cov)};
+				data.edges.push_back(odom);
+			}
+			truth.push_back(pose);
+			data.vertices.push_back(IdPose(id, guess));
+
+			// Close a loop to the oldest previously visited pose nearby
+			std::pair<int,int> cell((int)std::floor(pose.translation().x()), (int)std::floor(pose.translation().y()));
+			bool linked = false;
+			for(int dx = -1; dx <= 1 && !linked; dx++)
+			{
+				for(int dy = -1; dy <= 1 && !linked; dy++)
+				{
+					auto range = visited.equal_range(std::make_pair(cell.first + dx, cell.second + dy));
+					for(auto it = range.first; it != range.second && !linked; ++it)
+					{
+						if(id - it->second < 10)
+							continue;
+						Transform rel = truth[it->second].inverse() * pose;
+						if(rel.translation().norm() > loop_radius)
+							continue;
+						rel.translation() += Position(trans_noise(rng), trans_noise(rng), trans_noise(rng));
+						PoseGraphData::Edge loop = {it->second, id, TransformWithCovariance(rel, cov)};
+						data.edges.push_back(loop);
+						linked = true;
+					}
+				}
+			}
+			visited.insert(std::make_pair(cell, id));
+		}
+		return data;
+	}
+
+	/**
+	 * @brief Run a benchmark of a Solver implementation on the given pose graph.
+	 * @details The graph is first added incrementally in batches of the given
+	 * number of vertices, calling compute() after each batch. Afterwards the
+	 * solver is cleared and the whole graph is added and optimized at once.
+	 * Timings for addVertex, addEdge and compute are written as a table.
+	 * @param solver the solver to be tested, it will be cleared before
+	 * @param data pose graph to be optimized
+	 * @param step number of vertices added before each incremental update
+	 * @param iterations maximum number of iterations per compute()
+	 * @param out stream to write the results to
+	 */
+	inline void benchmark_solver(Solver* solver, const PoseGraphData& data, unsigned step, unsigned iterations, std::ostream& out)
+	{
+		typedef std::chrono::steady_clock BenchmarkClock;
+		if(data.vertices.empty())
+			return;
+
+		// Sort edges by the time they could have been added in an online setting,
+		// which is the position of their later vertex
+		std::map<IdType, size_t> order;
+		for(size_t i = 0; i < data.vertices.size(); i++)
+			order[data.vertices[i].first] = i;
+		std::vector<std::pair<size_t, PoseGraphData::Edge> > edges;
+		for(const PoseGraphData::Edge& e : data.edges)
+		{
+			std::map<IdType, size_t>::const_iterator source = order.find(e.source);
+			std::map<IdType, size_t>::const_iterator target = order.find(e.target);
+			if(source == order.end() || target == order.end())
+			{
+				out << "# " << data.name << ": edge " << e.source << " -> " << e.target
+				    << " references an unknown vertex, skipping graph" << std::endl;
+				return;
+			}
+			edges.push_back(std::make_pair(std::max(source->second, target->second), e));
+		}
+		std::stable_sort(edges.begin(), edges.end(),
+			[](const std::pair<size_t, PoseGraphData::Edge>& a, const std::pair<size_t, PoseGraphData::Edge>& b)
+		{
+			return a.first < b.first;
+		});
+		std::vector<SE3Constraint::Ptr> constraints;
+		for(const std::pair<size_t, PoseGraphData::Edge>& e : edges)
+			constraints.push_back(SE3Constraint::Ptr(new SE3Constraint("Benchmark", e.second.twc)));
+
+		out << "# " << data.name << ": " << data.vertices.size() << " vertices, " << edges.size() << " edges" << std::endl;
+		out << std::setw(10) << "vertices" << std::setw(10) << "edges"
+		    << std::setw(16) << "addVertex[us]" << std::setw(16) << "addEdge[us]"
+		    << std::setw(16) << "compute[ms]" << std::setw(8) << "ok" << std::endl;
+
+		step = std::max(1u, step);
+		for(unsigned pass = 0; pass < 2; pass++)
+		{
+			bool incremental = (pass == 0);
+			solver->clear();
+			size_t next_vertex = 0;
+			size_t next_edge = 0;
+			while(next_vertex < data.vertices.size())
+			{
+				size_t last_vertex = incremental ? std::min(data.vertices.size(), next_vertex + step) : data.vertices.size();
+				size_t num_vertices = last_vertex - next_vertex;
+
+				BenchmarkClock::time_point start = BenchmarkClock::now();
+				for(; next_vertex < last_vertex; next_vertex++)
+				{
+					solver->addVertex(data.vertices[next_vertex].first, data.vertices[next_vertex].second);
+					if(next_vertex == 0)
+						solver->setFixed(data.vertices[0].first);
+				}
+				BenchmarkClock::time_point vertices_done = BenchmarkClock::now();
+
+				size_t num_edges = 0;
+				for(; next_edge < edges.size(); next_edge++, num_edges++)
+				{
+					if(edges[next_edge].first >= last_vertex)
+						break;
+					const PoseGraphData::Edge& e = edges[next_edge].second;
+					solver->addEdge(e.source, e.target, constraints[next_edge]);
+				}
+				BenchmarkClock::time_point edges_done = BenchmarkClock::now();
+
+				bool ok = solver->compute(iterations);
+				BenchmarkClock::time_point compute_done = BenchmarkClock::now();
+
+				out << std::setw(10) << next_vertex << std::setw(10) << next_edge
+				    << std::setw(16) << std::chrono::duration<double, std::micro>(vertices_done - start).count() / num_vertices
+				    << std::setw(16) << (num_edges ? std::chrono::duration<double, std::micro>(edges_done - vertices_done).count() / num_edges : 0.0)
+				    << std::setw(16) << std::chrono::duration<double, std::milli>(compute_done - edges_done).count()
+				    << std::setw(8) << (ok ? "yes" : "no") << (incremental ? "" : "  (batch)") << std::endl;
+			}
+		}
+		solver->clear();
+	}
+}
+
+#endif
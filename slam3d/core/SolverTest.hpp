@@ -47,3 +47,13 @@ void test_optimization(Solver* solver)
 
 	BOOST_CHECK_NO_THROW(solver->saveGraph("graph_optimized.g2o"));
 }
+
+void test_constraint_information()
+{
+	Transform tf(Eigen::Translation<double, 3>(1,0,0));
+	Covariance<6> cov = Covariance<6>::Identity() * 0.25;
+	cov(0,1) = cov(1,0) = 0.1;
+	SE3Constraint::Ptr c_info(new SE3Constraint("DummySensor", TransformWithCovariance(tf, cov)));
+	BOOST_CHECK(c_info->getInformation().isApprox(cov.inverse()));
+	BOOST_CHECK((c_info->getSqrtInformation().transpose() * c_info->getSqrtInformation()).isApprox(c_info->getInformation()));
+}
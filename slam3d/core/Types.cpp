@@ -1,4 +1,5 @@
 #include "Types.hpp"
+#include "MeasurementStore.hpp"
 
 #include <boost/uuid/uuid_generators.hpp>
 
@@ -7,6 +8,7 @@ using namespace slam3d;
 Measurement::Measurement(const std::string& r, const std::string& s,
                          const Transform& p, const boost::uuids::uuid id)
 {
+	mStore = NULL;
 	mRobotName = r;
 	mSensorName = s;
 	mSensorPose = p;
@@ -16,3 +18,15 @@ Measurement::Measurement(const std::string& r, const std::string& s,
 	else
 		mUniqueId = id;
 }
+
+void Measurement::accessPayload() const
+{
+	if(mStore)
+		mStore->access(this);
+}
+
+void Measurement::payloadChanged() const
+{
+	if(mStore)
+		mStore->modified(this);
+}
@@ -30,6 +30,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/uuid/nil_generator.hpp>
 #include <Eigen/Geometry>
+#include <Eigen/Cholesky>
 
 #include <string>
 #include <vector>
@@ -43,6 +44,7 @@ namespace slam3d
 	typedef Eigen::Matrix<ScalarType,3,1> Direction;
 	typedef Eigen::Transform<ScalarType,3,Eigen::Isometry> Transform;
 	template <unsigned N> using Covariance = Eigen::Matrix<ScalarType,N,N>;
+	template <unsigned N> using Information = Eigen::Matrix<ScalarType,N,N>;
 	
 	/**
 	 * @class TransformWithCovariance
@@ -78,6 +80,8 @@ namespace slam3d
 		IdType mNextID;
 	};
 	
+	class MeasurementStore;
+
 	/**
 	 * @class Measurement
 	 * @brief Base class for a single reading from a sensor.
@@ -102,7 +106,56 @@ namespace slam3d
 		Transform getSensorPose() const { return mSensorPose; }
 		Transform getInverseSensorPose() const { return mInverseSensorPose; }
 		
+		/**
+		 * @brief Serialize the payload (the actual sensor data) for paging.
+		 * @details Measurements that support being paged out by a
+		 * MeasurementStore implement this together with readPayload()
+		 * and releasePayload(). The default does not support paging.
+		 * @param buffer receives the serialized payload
+		 * @return false if the payload cannot be paged out
+		 */
+		virtual bool writePayload(std::vector<char>& /*buffer*/) const { return false; }
+		
+		/**
+		 * @brief Restore the payload from data written by writePayload().
+		 * @param data
+		 * @param size
+		 */
+		virtual void readPayload(const char* /*data*/, size_t /*size*/) {}
+		
+		/**
+		 * @brief Free the memory held by the payload after it has been paged out.
+		 */
+		virtual void releasePayload() {}
+		
+		/**
+		 * @brief Get the approximate memory used by the payload in bytes.
+		 */
+		virtual size_t getPayloadSize() const { return 0; }
+		
+		/**
+		 * @brief Set the store that manages the payload of this measurement.
+		 * @param store
+		 */
+		void setStore(MeasurementStore* store) { mStore = store; }
+		
+	protected:
+		/**
+		 * @brief Make sure that the payload is in memory.
+		 * @details Derived classes that support paging call this before
+		 * accessing their payload. The payload may be paged out again by
+		 * another thread at any time, so it should be copied (e.g. the
+		 * shared pointer to it) under the measurement's own lock.
+		 */
+		void accessPayload() const;
+		
+		/**
+		 * @brief Notify the store that the payload has been changed.
+		 */
+		void payloadChanged() const;
+		
 	protected:
+		MeasurementStore* mStore;
 		timeval mStamp;
 		std::string mRobotName;
 		std::string mSensorName;
@@ -142,6 +195,10 @@ namespace slam3d
 	/**
 	 * @class SE3Constraint
 	 * @brief 
+	 * @details The information matrix (inverse covariance) and its upper
+	 * triangular square root are computed once on construction, so that
+	 * solvers do not have to invert the covariance whenever the constraint
+	 * is added to them.
 	 */
 	class SE3Constraint : public Constraint
 	{
@@ -149,16 +206,23 @@ namespace slam3d
 		typedef boost::shared_ptr<SE3Constraint> Ptr;
 		
 		SE3Constraint(const std::string& s, const TransformWithCovariance& twc)
-		: Constraint(s), mRelativePose(twc) {}
+		: Constraint(s), mRelativePose(twc)
+		{
+			mInformation = twc.covariance.inverse();
+			mSqrtInformation = mInformation.llt().matrixU();
+		}
 
 		ConstraintType getType() { return SE3; }
 		const char* getTypeName() { return "SE(3)"; }
 		
 		const TransformWithCovariance& getRelativePose() const { return mRelativePose; }
+		const Information<6>& getInformation() const { return mInformation; }
+		const Information<6>& getSqrtInformation() const { return mSqrtInformation; }
 		
 	protected:
 		TransformWithCovariance mRelativePose;
-		
+		Information<6> mInformation;
+		Information<6> mSqrtInformation;
 	};
 	
 	/**
@@ -171,7 +235,11 @@ namespace slam3d
 		typedef boost::shared_ptr<GravityConstraint> Ptr;
 		
 		GravityConstraint(const std::string& s, const Direction& d, const Direction& r, const Covariance<2>& c)
-		: Constraint(s), mDirection(d), mReference(r), mCovariance(c) {}
+		: Constraint(s), mDirection(d), mReference(r), mCovariance(c)
+		{
+			mInformation = c.inverse();
+			mSqrtInformation = mInformation.llt().matrixU();
+		}
 		
 		ConstraintType getType() { return GRAVITY; }
 		const char* getTypeName() { return "Gravity"; }
@@ -179,11 +247,15 @@ namespace slam3d
 		const Direction& getDirection() const { return mDirection; }
 		const Direction& getReference() const { return mReference; }
 		const Covariance<2>& getCovariance() const { return mCovariance; }
+		const Information<2>& getInformation() const { return mInformation; }
+		const Information<2>& getSqrtInformation() const { return mSqrtInformation; }
 		
 	protected:
 		Direction mDirection;
 		Direction mReference;
 		Covariance<2> mCovariance;
+		Information<2> mInformation;
+		Information<2> mSqrtInformation;
 	};
 	
 	/**
@@ -199,18 +271,26 @@ namespace slam3d
 		                   const Position& p,
 		                   const Covariance<3>& c,
 		                   const Transform& t)
-		: Constraint(s), mPosition(p), mCovariance(c), mSensorPose(t) {}
+		: Constraint(s), mPosition(p), mCovariance(c), mSensorPose(t)
+		{
+			mInformation = c.inverse();
+			mSqrtInformation = mInformation.llt().matrixU();
+		}
 		
 		ConstraintType getType() { return POSITION; }
 		const char* getTypeName() { return "Position"; }
 		
 		const Position& getPosition() const { return mPosition; }
 		const Covariance<3>& getCovariance() const { return mCovariance; }
+		const Information<3>& getInformation() const { return mInformation; }
+		const Information<3>& getSqrtInformation() const { return mSqrtInformation; }
 		const Transform& getSensorPose() const { return mSensorPose; }
 
 	protected:
 		Position mPosition;
 		Covariance<3> mCovariance;
+		Information<3> mInformation;
+		Information<3> mSqrtInformation;
 		Transform mSensorPose;
 	};
 	
@@ -224,17 +304,25 @@ namespace slam3d
 		typedef boost::shared_ptr<DistanceConstraint> Ptr;
 		
 		DistanceConstraint(const std::string& s, ScalarType d, const Covariance<1>& c)
-		: Constraint(s), mDistance(d), mCovariance(c) {}
+		: Constraint(s), mDistance(d), mCovariance(c)
+		{
+			mInformation = c.inverse();
+			mSqrtInformation = mInformation.llt().matrixU();
+		}
 		
 		ConstraintType getType() { return DISTANCE; }
 		const char* getTypeName() { return "Distance"; }
 		
 		ScalarType getDistance() const { return mDistance; }
 		const Covariance<1>& getCovariance() const { return mCovariance; }
+		const Information<1>& getInformation() const { return mInformation; }
+		const Information<1>& getSqrtInformation() const { return mSqrtInformation; }
 
 	protected:
 		ScalarType mDistance;
 		Covariance<1> mCovariance;
+		Information<1> mInformation;
+		Information<1> mSqrtInformation;
 	};
 	
 /**
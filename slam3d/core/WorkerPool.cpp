@@ -0,0 +1,171 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "WorkerPool.hpp"
+
+#include <atomic>
+#include <exception>
+#include <vector>
+
+using namespace slam3d;
+
+WorkerPool::WorkerPool(unsigned threads, unsigned capacity)
+ : mCapacity(capacity), mShutdown(false)
+{
+	if(threads == 0)
+		threads = boost::thread::hardware_concurrency();
+	if(threads == 0)
+		threads = 1;
+	mNumberOfThreads = threads;
+	for(unsigned i = 0; i < mNumberOfThreads; i++)
+	{
+		mThreads.create_thread(boost::bind(&WorkerPool::run, this));
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(mQueueMutex);
+		mShutdown = true;
+	}
+	mJobAvailable.notify_all();
+	mSpaceAvailable.notify_all();
+	mThreads.join_all();
+}
+
+void WorkerPool::enqueue(const std::function<void()>& job)
+{
+	std::unique_lock<std::mutex> lock(mQueueMutex);
+	if(mCapacity > 0)
+	{
+		mSpaceAvailable.wait(lock, [this](){ return mShutdown || mQueue.size() < mCapacity; });
+	}
+	mQueue.push_back(job);
+	lock.unlock();
+	mJobAvailable.notify_one();
+}
+
+void WorkerPool::run()
+{
+	while(true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mQueueMutex);
+			mJobAvailable.wait(lock, [this](){ return mShutdown || !mQueue.empty(); });
+			if(mQueue.empty())
+				return;
+			job = mQueue.front();
+			mQueue.pop_front();
+		}
+		mSpaceAvailable.notify_one();
+		job();
+	}
+}
+
+unsigned slam3d::getNumberOfChunks(size_t n, unsigned threads)
+{
+	if(threads == 0)
+		threads = boost::thread::hardware_concurrency();
+	if(threads > n)
+		threads = n;
+	return threads > 0 ? threads : 1;
+}
+
+namespace
+{
+	// State of one parallelFor() call, jobs that start after
+	// all chunks have been taken only read the chunk counter.
+	struct ParallelRange
+	{
+		ParallelRange(size_t n, unsigned chunks, const std::function<void(size_t, size_t, unsigned)>& body)
+		 : n(n), chunks(chunks), body(body), next(0), done(0), errors(chunks) {}
+
+		// Process chunks until all of them have been taken
+		void work()
+		{
+			unsigned c;
+			while((c = next++) < chunks)
+			{
+				try
+				{
+					body(n * c / chunks, n * (c + 1) / chunks, c);
+				}catch(...)
+				{
+					errors[c] = std::current_exception();
+				}
+				std::lock_guard<std::mutex> guard(mutex);
+				if(++done == chunks)
+					finished.notify_all();
+			}
+		}
+
+		size_t n;
+		unsigned chunks;
+		const std::function<void(size_t, size_t, unsigned)>& body;
+		std::atomic<unsigned> next;
+		unsigned done;
+		std::vector<std::exception_ptr> errors;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+}
+
+WorkerPool& slam3d::getSharedWorkerPool()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+void slam3d::parallelFor(size_t n, unsigned threads, const std::function<void(size_t, size_t, unsigned)>& body)
+{
+	unsigned chunks = getNumberOfChunks(n, threads);
+	if(chunks == 1)
+	{
+		body(0, n, 0);
+		return;
+	}
+
+	std::shared_ptr<ParallelRange> range(new ParallelRange(n, chunks, body));
+	WorkerPool& pool = getSharedWorkerPool();
+	for(unsigned c = 1; c < chunks && c <= pool.getNumberOfThreads(); c++)
+	{
+		pool.post([range](){ range->work(); });
+	}
+	range->work();
+
+	// Wait for the chunks taken by the pool
+	{
+		std::unique_lock<std::mutex> lock(range->mutex);
+		range->finished.wait(lock, [&range](){ return range->done == range->chunks; });
+	}
+
+	for(std::vector<std::exception_ptr>::iterator e = range->errors.begin(); e != range->errors.end(); e++)
+	{
+		if(*e)
+			std::rethrow_exception(*e);
+	}
+}
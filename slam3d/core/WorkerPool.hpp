@@ -0,0 +1,122 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_WORKERPOOL_HPP
+#define SLAM3D_WORKERPOOL_HPP
+
+#include <boost/thread.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+
+namespace slam3d
+{
+	/**
+	 * @class WorkerPool
+	 * @brief A fixed number of threads that execute posted jobs in FIFO order.
+	 * @details The queue can be bounded, in which case post() blocks until
+	 * there is space for the new job. The destructor finishes all queued
+	 * jobs before joining the threads.
+	 */
+	class WorkerPool
+	{
+	public:
+		/**
+		 * @brief Start the worker threads.
+		 * @param threads number of threads, 0 uses the number of cores
+		 * @param capacity maximum number of waiting jobs, 0 for unbounded
+		 */
+		WorkerPool(unsigned threads = 0, unsigned capacity = 0);
+		~WorkerPool();
+
+		/**
+		 * @brief Queue a job for execution.
+		 * @details Exceptions thrown by the job are stored in the returned future.
+		 * @param job callable without arguments
+		 * @return future that receives the job's result
+		 */
+		template <typename F>
+		std::future<decltype(std::declval<F>()())> post(F job)
+		{
+			typedef decltype(std::declval<F>()()) Result;
+			std::shared_ptr<std::packaged_task<Result()> > task(new std::packaged_task<Result()>(job));
+			std::future<Result> result = task->get_future();
+			enqueue([task](){ (*task)(); });
+			return result;
+		}
+
+		/**
+		 * @brief Get the number of worker threads.
+		 */
+		unsigned getNumberOfThreads() const { return mNumberOfThreads; }
+
+	private:
+		void enqueue(const std::function<void()>& job);
+		void run();
+
+		boost::thread_group mThreads;
+		unsigned mNumberOfThreads;
+		unsigned mCapacity;
+		bool mShutdown;
+
+		std::deque<std::function<void()> > mQueue;
+		std::mutex mQueueMutex;
+		std::condition_variable mJobAvailable;
+		std::condition_variable mSpaceAvailable;
+	};
+
+	/**
+	 * @brief Get the pool that runs the chunks of parallelFor().
+	 * @details The pool is created on first use with one thread per core.
+	 */
+	WorkerPool& getSharedWorkerPool();
+
+	/**
+	 * @brief Get the number of chunks parallelFor() splits a range into.
+	 * @param n size of the range
+	 * @param threads requested number of threads, 0 uses the number of cores
+	 * @return number of chunks, at least 1 and at most n
+	 */
+	unsigned getNumberOfChunks(size_t n, unsigned threads);
+
+	/**
+	 * @brief Process the range [0, n) in contiguous chunks on multiple threads.
+	 * @details The chunks are processed by the threads of the shared
+	 * WorkerPool and by the calling thread, which returns when all chunks
+	 * are done. The calling thread takes chunks until none are left before
+	 * it waits, so parallelFor() can be called from within a chunk. An
+	 * exception from any chunk is rethrown after all chunks have finished.
+	 * @param n size of the range
+	 * @param threads requested number of threads, 0 uses the number of cores
+	 * @param body called as body(begin, end, chunk) for each chunk
+	 */
+	void parallelFor(size_t n, unsigned threads, const std::function<void(size_t, size_t, unsigned)>& body);
+}
+
+#endif
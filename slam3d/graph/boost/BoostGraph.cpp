@@ -53,7 +53,20 @@ bool BoostGraph::optimize(unsigned iterations)
 void BoostGraph::addVertex(const VertexObject& v)
 {
 	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
-	
+	insertVertex(v);
+}
+
+void BoostGraph::addVertices(const VertexObjectList& v)
+{
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	for(VertexObjectList::const_iterator it = v.begin(); it < v.end(); ++it)
+	{
+		insertVertex(*it);
+	}
+}
+
+void BoostGraph::insertVertex(const VertexObject& v)
+{
 	// Add vertex to the graph
 	Vertex newVertex = boost::add_vertex(mPoseGraph);
 	mPoseGraph[newVertex] = v;
@@ -65,6 +78,20 @@ void BoostGraph::addVertex(const VertexObject& v)
 void BoostGraph::addEdge(const EdgeObject& e)
 {
 	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	insertEdge(e);
+}
+
+void BoostGraph::addEdges(const EdgeObjectList& e)
+{
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	for(EdgeObjectList::const_iterator it = e.begin(); it < e.end(); ++it)
+	{
+		insertEdge(*it);
+	}
+}
+
+void BoostGraph::insertEdge(const EdgeObject& e)
+{
 	Edge forward_edge, inverse_edge;
 	bool inserted_forward, inserted_inverse;
 	
@@ -119,12 +119,27 @@ namespace slam3d
 		 * @param v
 		 */
 		void addVertex(const VertexObject& v);
+
+		/**
+		 * @brief Add the given VertexObjects to the internal graph.
+		 * @details The graph is locked only once for all vertices.
+		 * @param v
+		 */
+		virtual void addVertices(const VertexObjectList& v);
 		
 		/**
 		 * @brief Add the given EdgeObject to the internal graph.
 		 * @param e
 		 */
 		virtual void addEdge(const EdgeObject& e);
+
+		/**
+		 * @brief Add the given EdgeObjects to the internal graph.
+		 * @details The graph is locked only once for all edges.
+		 * @param e
+		 * @throw InvalidEdge
+		 */
+		virtual void addEdges(const EdgeObjectList& e);
 		
 		/**
 		 * @brief 
@@ -156,6 +171,19 @@ namespace slam3d
 		 */
 		OutEdgeIterator getEdgeIterator(IdType source, IdType target, const std::string& sensor) const;
 
+		/**
+		 * @brief Add a vertex to the internal graph, the caller has to lock it.
+		 * @param v
+		 */
+		void insertVertex(const VertexObject& v);
+
+		/**
+		 * @brief Add an edge to the internal graph, the caller has to lock it.
+		 * @param e
+		 * @throw InvalidEdge
+		 */
+		void insertEdge(const EdgeObject& e);
+
 	private:
 		// The boost graph object
 		AdjacencyGraph mPoseGraph;
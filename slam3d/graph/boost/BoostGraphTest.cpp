@@ -16,3 +16,39 @@ BOOST_AUTO_TEST_CASE(boost_graph_construction)
 	test_graph_construction(graph);
 	delete graph;
 }
+
+BOOST_AUTO_TEST_CASE(boost_graph_patch_cache)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph.log");
+	Graph* graph = new BoostGraph(&logger);
+	test_patch_cache(graph, &logger);
+	delete graph;
+}
+
+BOOST_AUTO_TEST_CASE(boost_graph_link_queue)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph.log");
+	Graph* graph = new BoostGraph(&logger);
+	test_link_queue(graph, &logger);
+	delete graph;
+}
+
+BOOST_AUTO_TEST_CASE(boost_graph_pipeline_pose)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph.log");
+	Graph* graph = new BoostGraph(&logger);
+	test_pipeline_pose(graph, &logger);
+	delete graph;
+}
+
+BOOST_AUTO_TEST_CASE(boost_graph_batch_insertion)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph.log");
+	Graph* graph = new BoostGraph(&logger);
+	test_batch_insertion(graph, &logger);
+	delete graph;
+}
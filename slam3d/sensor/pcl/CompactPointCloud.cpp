@@ -0,0 +1,226 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "CompactPointCloud.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using namespace slam3d;
+
+namespace
+{
+	template <typename T>
+	void append(std::vector<char>& buffer, const T* data, size_t count = 1)
+	{
+		const char* bytes = (const char*)data;
+		buffer.insert(buffer.end(), bytes, bytes + count * sizeof(T));
+	}
+
+	template <typename T>
+	void extract(const char*& data, const char* end, T* value, size_t count = 1)
+	{
+		if((size_t)(end - data) < count * sizeof(T))
+			throw std::length_error("CompactPointCloud: truncated data");
+		memcpy((void*)value, data, count * sizeof(T));
+		data += count * sizeof(T);
+	}
+}
+
+CompactPointCloud::CompactPointCloud(const PointCloud& cloud)
+ : mHeader(cloud.header), mSensorOrigin(cloud.sensor_origin_), mSensorOrientation(cloud.sensor_orientation_)
+{
+	// Bounding box of all finite points
+	Eigen::Array3f min = Eigen::Array3f::Constant(std::numeric_limits<float>::max());
+	Eigen::Array3f max = Eigen::Array3f::Constant(-std::numeric_limits<float>::max());
+	size_t finite = 0;
+	for(PointCloud::const_iterator p = cloud.begin(); p != cloud.end(); ++p)
+	{
+		if(!std::isfinite(p->x) || !std::isfinite(p->y) || !std::isfinite(p->z))
+			continue;
+		Eigen::Array3f a(p->x, p->y, p->z);
+		min = min.min(a);
+		max = max.max(a);
+		finite++;
+	}
+	if(finite == 0)
+	{
+		mOffset.setZero();
+		mScale.setOnes();
+		return;
+	}
+
+	mOffset = min;
+	mScale = ((max - min) / 65535.0f).max(std::numeric_limits<float>::min());
+	const Eigen::Array3f inverse = mScale.inverse();
+
+	mData.resize(finite * 3);
+	uint16_t* q = mData.data();
+	for(PointCloud::const_iterator p = cloud.begin(); p != cloud.end(); ++p)
+	{
+		if(!std::isfinite(p->x) || !std::isfinite(p->y) || !std::isfinite(p->z))
+			continue;
+		Eigen::Array3f steps = ((Eigen::Array3f(p->x, p->y, p->z) - mOffset) * inverse).round().min(65535.0f).max(0.0f);
+		q[0] = (uint16_t)steps[0];
+		q[1] = (uint16_t)steps[1];
+		q[2] = (uint16_t)steps[2];
+		q += 3;
+	}
+}
+
+PointCloud::Ptr CompactPointCloud::decode() const
+{
+	PointCloud::Ptr cloud(new PointCloud);
+	decode(*cloud);
+	return cloud;
+}
+
+void CompactPointCloud::decode(PointCloud& cloud) const
+{
+	size_t n = size();
+	cloud.header = mHeader;
+	cloud.sensor_origin_ = mSensorOrigin;
+	cloud.sensor_orientation_ = mSensorOrientation;
+	cloud.points.resize(n);
+	const uint16_t* q = mData.data();
+	for(size_t i = 0; i < n; i++, q += 3)
+	{
+		Eigen::Array3f p = mOffset + Eigen::Array3f(q[0], q[1], q[2]) * mScale;
+		cloud.points[i] = PointType(p[0], p[1], p[2]);
+	}
+	cloud.width = n;
+	cloud.height = 1;
+	cloud.is_dense = true;
+}
+
+void CompactPointCloud::decode(const Eigen::Matrix4f& tf, PointType* out) const
+{
+	// Fold the dequantization into the transformation
+	Eigen::Matrix4f dequantize = Eigen::Matrix4f::Identity();
+	dequantize.diagonal().head<3>() = mScale.matrix();
+	dequantize.block<3,1>(0,3) = mOffset.matrix();
+	const Eigen::Matrix4f m = tf * dequantize;
+
+	size_t n = size();
+	const uint16_t* q = mData.data();
+	for(size_t i = 0; i < n; i++, q += 3)
+	{
+		out[i].getVector4fMap() = m * Eigen::Vector4f(q[0], q[1], q[2], 1.0f);
+	}
+}
+
+CompactPointCloud::CompactPointCloud(const char* data, size_t size)
+{
+	const char* end = data + size;
+	uint64_t stamp;
+	uint32_t seq, frame_length;
+	extract(data, end, &stamp);
+	extract(data, end, &seq);
+	extract(data, end, &frame_length);
+	mHeader.stamp = stamp;
+	mHeader.seq = seq;
+	mHeader.frame_id.resize(frame_length);
+	extract(data, end, &mHeader.frame_id[0], frame_length);
+	extract(data, end, mSensorOrigin.data(), 4);
+	extract(data, end, mSensorOrientation.coeffs().data(), 4);
+	extract(data, end, mOffset.data(), 3);
+	extract(data, end, mScale.data(), 3);
+	uint64_t count;
+	extract(data, end, &count);
+	mData.resize(count);
+	extract(data, end, mData.data(), count);
+}
+
+void CompactPointCloud::serialize(std::vector<char>& buffer) const
+{
+	uint64_t stamp = mHeader.stamp;
+	uint32_t seq = mHeader.seq;
+	uint32_t frame_length = mHeader.frame_id.size();
+	uint64_t count = mData.size();
+	buffer.reserve(buffer.size() + 64 + frame_length + count * sizeof(uint16_t));
+	append(buffer, &stamp);
+	append(buffer, &seq);
+	append(buffer, &frame_length);
+	append(buffer, mHeader.frame_id.data(), frame_length);
+	append(buffer, mSensorOrigin.data(), 4);
+	append(buffer, mSensorOrientation.coeffs().data(), 4);
+	append(buffer, mOffset.data(), 3);
+	append(buffer, mScale.data(), 3);
+	append(buffer, &count);
+	append(buffer, mData.data(), count);
+}
+
+void slam3d::serializePointCloud(const PointCloud& cloud, std::vector<char>& buffer)
+{
+	uint64_t stamp = cloud.header.stamp;
+	uint32_t seq = cloud.header.seq;
+	uint32_t frame_length = cloud.header.frame_id.size();
+	uint32_t width = cloud.width;
+	uint32_t height = cloud.height;
+	uint8_t dense = cloud.is_dense;
+	uint64_t count = cloud.points.size();
+	buffer.reserve(buffer.size() + 64 + frame_length + count * sizeof(PointType));
+	append(buffer, &stamp);
+	append(buffer, &seq);
+	append(buffer, &frame_length);
+	append(buffer, cloud.header.frame_id.data(), frame_length);
+	append(buffer, cloud.sensor_origin_.data(), 4);
+	append(buffer, cloud.sensor_orientation_.coeffs().data(), 4);
+	append(buffer, &width);
+	append(buffer, &height);
+	append(buffer, &dense);
+	append(buffer, &count);
+	append(buffer, cloud.points.data(), count);
+}
+
+PointCloud::Ptr slam3d::deserializePointCloud(const char* data, size_t size)
+{
+	const char* end = data + size;
+	PointCloud::Ptr cloud(new PointCloud);
+	uint64_t stamp, count;
+	uint32_t seq, frame_length, width, height;
+	uint8_t dense;
+	extract(data, end, &stamp);
+	extract(data, end, &seq);
+	extract(data, end, &frame_length);
+	cloud->header.stamp = stamp;
+	cloud->header.seq = seq;
+	cloud->header.frame_id.resize(frame_length);
+	extract(data, end, &cloud->header.frame_id[0], frame_length);
+	extract(data, end, cloud->sensor_origin_.data(), 4);
+	extract(data, end, cloud->sensor_orientation_.coeffs().data(), 4);
+	extract(data, end, &width);
+	extract(data, end, &height);
+	extract(data, end, &dense);
+	extract(data, end, &count);
+	cloud->points.resize(count);
+	extract(data, end, cloud->points.data(), count);
+	cloud->width = width;
+	cloud->height = height;
+	cloud->is_dense = dense;
+	return cloud;
+}
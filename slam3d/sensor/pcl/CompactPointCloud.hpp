@@ -0,0 +1,128 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_PCL_COMPACTPOINTCLOUD_HPP
+#define SLAM3D_PCL_COMPACTPOINTCLOUD_HPP
+
+#include <slam3d/sensor/pcl/Filters.hpp>
+
+#include <boost/shared_ptr.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace slam3d
+{
+	/**
+	 * @class CompactPointCloud
+	 * @brief Point cloud with coordinates quantized to 16 bit.
+	 * @details Each coordinate is stored relative to the bounding box of the
+	 * cloud with 65536 steps per axis, so a point takes 6 instead of 16 bytes.
+	 * The quantization error is at most half a step, e.g. 0.6mm for a cloud
+	 * that extends 80m along an axis. Non-finite points are not stored.
+	 */
+	class CompactPointCloud
+	{
+	public:
+		typedef boost::shared_ptr<CompactPointCloud> Ptr;
+		typedef boost::shared_ptr<const CompactPointCloud> ConstPtr;
+
+		/**
+		 * @brief Encode the given cloud.
+		 * @param cloud
+		 */
+		CompactPointCloud(const PointCloud& cloud);
+
+		/**
+		 * @brief Restore a cloud from data written by serialize().
+		 * @param data
+		 * @param size
+		 */
+		CompactPointCloud(const char* data, size_t size);
+
+		/**
+		 * @brief Append a binary representation to the buffer.
+		 * @param buffer
+		 */
+		void serialize(std::vector<char>& buffer) const;
+
+		/**
+		 * @brief Decode into a new point cloud.
+		 */
+		PointCloud::Ptr decode() const;
+
+		/**
+		 * @brief Decode into the given point cloud, replacing its content.
+		 * @param cloud
+		 */
+		void decode(PointCloud& cloud) const;
+
+		/**
+		 * @brief Decode the points transformed by tf into the given array.
+		 * @param tf transformation applied to each point
+		 * @param out array with space for size() points
+		 */
+		void decode(const Eigen::Matrix4f& tf, PointType* out) const;
+
+		/**
+		 * @brief Get the number of stored points.
+		 */
+		size_t size() const { return mData.size() / 3; }
+
+		/**
+		 * @brief Get the quantization step along each axis.
+		 */
+		Eigen::Vector3f getResolution() const { return mScale.matrix(); }
+
+		/**
+		 * @brief Get the approximate memory used by this cloud in bytes.
+		 */
+		size_t getMemoryUsage() const { return sizeof(*this) + mData.size() * sizeof(uint16_t); }
+
+	private:
+		pcl::PCLHeader mHeader;
+		Eigen::Vector4f mSensorOrigin;
+		Eigen::Quaternionf mSensorOrientation;
+		Eigen::Array3f mOffset;
+		Eigen::Array3f mScale;
+		std::vector<uint16_t> mData;
+	};
+
+	/**
+	 * @brief Append a lossless binary representation of a point cloud to the buffer.
+	 * @param cloud
+	 * @param buffer
+	 */
+	void serializePointCloud(const PointCloud& cloud, std::vector<char>& buffer);
+
+	/**
+	 * @brief Restore a point cloud from data written by serializePointCloud().
+	 * @param data
+	 * @param size
+	 */
+	PointCloud::Ptr deserializePointCloud(const char* data, size_t size);
+}
+
+#endif
@@ -0,0 +1,160 @@
+#include "Filters.hpp"
+
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/filters/radius_outlier_removal.h>
+
+#include <boost/format.hpp>
+#include <boost/thread.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+using namespace slam3d;
+
+#ifndef SLAM3D_TEST_DATA
+#define SLAM3D_TEST_DATA "test"
+#endif
+
+// Read raw pcl::PointXYZ records as stored in test/cloud*.bin
+PointCloud::Ptr loadCloud(const std::string& file)
+{
+	PointCloud::Ptr cloud(new PointCloud);
+	std::ifstream in(file.c_str(), std::ios::binary);
+	PointType p;
+	while(in.read((char*)p.data, sizeof(p.data)))
+	{
+		cloud->push_back(p);
+	}
+	return cloud;
+}
+
+template <typename F>
+double measure(F filter, unsigned iterations, size_t& points)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned i = 0; i < iterations; i++)
+	{
+		points = filter()->size();
+	}
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+// Usage: pcl_downsample_benchmark [-i iterations] [-t threads] [-l leaf_size]... [-r radius]... [cloud.bin]...
+// Without any files, the sample clouds from the test directory are used.
+// The radius outlier removal is run with 3 neighbors for each radius.
+int main(int argc, char** argv)
+{
+	unsigned iterations = 20;
+	unsigned threads = boost::thread::hardware_concurrency();
+	std::vector<float> leaf_sizes;
+	std::vector<float> radii;
+	std::vector<std::string> files;
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+			leaf_sizes.push_back(atof(argv[++i]));
+		else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			radii.push_back(atof(argv[++i]));
+		else
+			files.push_back(argv[i]);
+	}
+	if(files.empty())
+	{
+		for(int i = 1; i <= 4; i++)
+			files.push_back(std::string(SLAM3D_TEST_DATA) + "/cloud" + std::to_string(i) + ".bin");
+	}
+	if(leaf_sizes.empty())
+	{
+		leaf_sizes.push_back(0.05);
+		leaf_sizes.push_back(0.2);
+		leaf_sizes.push_back(0.5);
+	}
+	if(radii.empty())
+	{
+		radii.push_back(0.2);
+		radii.push_back(0.5);
+	}
+	if(iterations == 0)
+		iterations = 1;
+
+	std::cout << std::setw(24) << "cloud" << std::setw(10) << "points" << std::setw(8) << "leaf"
+	          << std::setw(10) << "voxels" << std::setw(14) << "pcl[ms]" << std::setw(14) << "hash[ms]"
+	          << std::setw(14) << (boost::format("hash/%1%t[ms]") % threads).str() << std::endl;
+
+	for(std::vector<std::string>::iterator f = files.begin(); f != files.end(); ++f)
+	{
+		PointCloud::Ptr cloud = loadCloud(*f);
+		if(cloud->empty())
+		{
+			std::cerr << "Could not load point cloud from " << *f << std::endl;
+			continue;
+		}
+
+		for(std::vector<float>::iterator leaf = leaf_sizes.begin(); leaf != leaf_sizes.end(); ++leaf)
+		{
+			size_t pcl_points = 0, hash_points = 0, mt_points = 0;
+			double pcl_time = measure([&]()
+			{
+				PointCloud::Ptr out(new PointCloud);
+				pcl::VoxelGrid<PointType> grid;
+				grid.setLeafSize(*leaf, *leaf, *leaf);
+				grid.setInputCloud(cloud);
+				grid.filter(*out);
+				return out;
+			}, iterations, pcl_points);
+			double hash_time = measure([&](){ return voxelGridFilter(*cloud, *leaf, 1); }, iterations, hash_points);
+			double mt_time = measure([&](){ return voxelGridFilter(*cloud, *leaf, threads); }, iterations, mt_points);
+
+			std::cout << std::setw(24) << f->substr(f->find_last_of('/') + 1) << std::setw(10) << cloud->size()
+			          << std::setw(8) << *leaf << std::setw(10) << hash_points
+			          << std::setw(14) << pcl_time << std::setw(14) << hash_time << std::setw(14) << mt_time;
+			if(pcl_points != hash_points || mt_points != hash_points)
+				std::cout << "  (pcl: " << pcl_points << " voxels)";
+			std::cout << std::endl;
+		}
+	}
+
+	std::cout << std::endl << std::setw(24) << "cloud" << std::setw(10) << "points" << std::setw(8) << "radius"
+	          << std::setw(10) << "inliers" << std::setw(14) << "pcl[ms]" << std::setw(14) << "grid[ms]"
+	          << std::setw(14) << (boost::format("grid/%1%t[ms]") % threads).str() << std::endl;
+
+	for(std::vector<std::string>::iterator f = files.begin(); f != files.end(); ++f)
+	{
+		PointCloud::Ptr cloud = loadCloud(*f);
+		if(cloud->empty())
+			continue;
+
+		for(std::vector<float>::iterator radius = radii.begin(); radius != radii.end(); ++radius)
+		{
+			size_t pcl_points = 0, grid_points = 0, mt_points = 0;
+			double pcl_time = measure([&]()
+			{
+				PointCloud::Ptr out(new PointCloud);
+				pcl::RadiusOutlierRemoval<PointType> removal;
+				removal.setInputCloud(cloud);
+				removal.setRadiusSearch(*radius);
+				removal.setMinNeighborsInRadius(3);
+				removal.filter(*out);
+				return out;
+			}, iterations, pcl_points);
+			double grid_time = measure([&](){ return radiusOutlierFilter(*cloud, *radius, 3, 1); }, iterations, grid_points);
+			double mt_time = measure([&](){ return radiusOutlierFilter(*cloud, *radius, 3, threads); }, iterations, mt_points);
+
+			std::cout << std::setw(24) << f->substr(f->find_last_of('/') + 1) << std::setw(10) << cloud->size()
+			          << std::setw(8) << *radius << std::setw(10) << grid_points
+			          << std::setw(14) << pcl_time << std::setw(14) << grid_time << std::setw(14) << mt_time;
+			if(pcl_points != grid_points || mt_points != grid_points)
+				std::cout << "  (pcl: " << pcl_points << " inliers)";
+			std::cout << std::endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,204 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "Filters.hpp"
+
+#include <slam3d/core/WorkerPool.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace slam3d;
+
+namespace
+{
+	// Sum of (x, y, z, 1) per voxel, so the last coefficient counts the points
+	typedef std::unordered_map<VoxelKey, Eigen::Vector4f, VoxelKeyHash, std::equal_to<VoxelKey>,
+		Eigen::aligned_allocator<std::pair<const VoxelKey, Eigen::Vector4f> > > VoxelMap;
+}
+
+PointCloud::Ptr slam3d::voxelGridFilter(const PointCloud& in, float leaf_size, unsigned threads)
+{
+	const float inverse_leaf = 1.0f / leaf_size;
+	const Eigen::Array4f inverse(inverse_leaf, inverse_leaf, inverse_leaf, 0.0f);
+
+	// Each thread accumulates its part of the cloud into its own map
+	std::vector<VoxelMap> voxels(getNumberOfChunks(in.size(), threads));
+	parallelFor(in.size(), voxels.size(), [&](size_t begin, size_t end, unsigned chunk)
+	{
+		VoxelMap& map = voxels[chunk];
+		map.reserve((end - begin) / 8 + 1);
+		for(size_t i = begin; i < end; i++)
+		{
+			const PointType& p = in.points[i];
+			VoxelKey key;
+			if(!getVoxelKey(p.x, p.y, p.z, inverse, key))
+				continue;
+			std::pair<VoxelMap::iterator, bool> entry = map.insert(std::make_pair(key, Eigen::Vector4f(p.x, p.y, p.z, 1.0f)));
+			if(!entry.second)
+				entry.first->second += Eigen::Vector4f(p.x, p.y, p.z, 1.0f);
+		}
+	});
+
+	// Merge the partial results
+	VoxelMap& merged = voxels[0];
+	for(size_t m = 1; m < voxels.size(); m++)
+	{
+		for(VoxelMap::const_iterator v = voxels[m].begin(); v != voxels[m].end(); ++v)
+		{
+			std::pair<VoxelMap::iterator, bool> entry = merged.insert(*v);
+			if(!entry.second)
+				entry.first->second += v->second;
+		}
+		VoxelMap().swap(voxels[m]);
+	}
+
+	PointCloud::Ptr out(new PointCloud);
+	out->header = in.header;
+	out->points.resize(merged.size());
+	size_t i = 0;
+	for(VoxelMap::const_iterator v = merged.begin(); v != merged.end(); ++v, ++i)
+	{
+		Eigen::Vector3f centroid = v->second.head<3>() / v->second[3];
+		out->points[i] = PointType(centroid[0], centroid[1], centroid[2]);
+	}
+	out->width = out->points.size();
+	out->height = 1;
+	out->is_dense = true;
+	return out;
+}
+
+PointCloud::Ptr slam3d::radiusOutlierFilter(const PointCloud& in, float radius, unsigned min_neighbors, unsigned threads)
+{
+	const float inverse_cell = 1.0f / radius;
+	const Eigen::Array4f inverse(inverse_cell, inverse_cell, inverse_cell, 0.0f);
+	const float radius_sq = radius * radius;
+	const uint32_t invalid = UINT32_MAX;
+	const size_t n = in.size();
+
+	// Assign each point to a cell
+	std::unordered_map<VoxelKey, uint32_t, VoxelKeyHash> cell_index;
+	std::vector<VoxelKey> cell_keys;
+	std::vector<uint32_t> point_cell(n, invalid);
+	cell_index.reserve(n / 8 + 1);
+	for(size_t i = 0; i < n; i++)
+	{
+		const PointType& p = in.points[i];
+		VoxelKey key;
+		if(!getVoxelKey(p.x, p.y, p.z, inverse, key))
+			continue;
+		std::pair<std::unordered_map<VoxelKey, uint32_t, VoxelKeyHash>::iterator, bool> entry =
+			cell_index.insert(std::make_pair(key, (uint32_t)cell_keys.size()));
+		if(entry.second)
+			cell_keys.push_back(key);
+		point_cell[i] = entry.first->second;
+	}
+
+	// Sort the points by cell, so that each cell is a contiguous range
+	const size_t cells = cell_keys.size();
+	std::vector<uint32_t> cell_start(cells + 1, 0);
+	for(size_t i = 0; i < n; i++)
+	{
+		if(point_cell[i] != invalid)
+			cell_start[point_cell[i] + 1]++;
+	}
+	for(size_t c = 0; c < cells; c++)
+		cell_start[c + 1] += cell_start[c];
+
+	std::vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f> > sorted(cell_start[cells]);
+	std::vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+	for(size_t i = 0; i < n; i++)
+	{
+		if(point_cell[i] == invalid)
+			continue;
+		const PointType& p = in.points[i];
+		sorted[fill[point_cell[i]]++] = Eigen::Vector4f(p.x, p.y, p.z, 0.0f);
+	}
+
+	// Find the (up to 27) occupied cells around each cell
+	std::vector<uint32_t> neighbor_cells(cells * 27);
+	std::vector<uint8_t> neighbor_count(cells, 0);
+	parallelFor(cells, threads, [&](size_t begin, size_t end, unsigned chunk)
+	{
+		for(size_t c = begin; c < end; c++)
+		{
+			const VoxelKey& key = cell_keys[c];
+			uint32_t* list = &neighbor_cells[c * 27];
+			for(int dx = -1; dx <= 1; dx++)
+			for(int dy = -1; dy <= 1; dy++)
+			for(int dz = -1; dz <= 1; dz++)
+			{
+				VoxelKey other = {key.x + dx, key.y + dy, key.z + dz};
+				std::unordered_map<VoxelKey, uint32_t, VoxelKeyHash>::const_iterator it = cell_index.find(other);
+				if(it != cell_index.end())
+					list[neighbor_count[c]++] = it->second;
+			}
+		}
+	});
+
+	// Count the neighbors of each point until there are enough
+	std::vector<uint8_t> keep(n, 0);
+	parallelFor(n, threads, [&](size_t begin, size_t end, unsigned chunk)
+	{
+		for(size_t i = begin; i < end; i++)
+		{
+			uint32_t cell = point_cell[i];
+			if(cell == invalid)
+				continue;
+			const PointType& p = in.points[i];
+			const Eigen::Vector4f query(p.x, p.y, p.z, 0.0f);
+
+			// The point itself is found as well
+			unsigned found = 0;
+			const unsigned required = min_neighbors + 1;
+			const uint32_t* list = &neighbor_cells[cell * 27];
+			for(unsigned k = 0; k < neighbor_count[cell] && found < required; k++)
+			{
+				for(uint32_t j = cell_start[list[k]]; j < cell_start[list[k] + 1]; j++)
+				{
+					if((sorted[j] - query).squaredNorm() <= radius_sq && ++found >= required)
+						break;
+				}
+			}
+			keep[i] = (found >= required);
+		}
+	});
+
+	PointCloud::Ptr out(new PointCloud);
+	out->header = in.header;
+	out->sensor_origin_ = in.sensor_origin_;
+	out->sensor_orientation_ = in.sensor_orientation_;
+	out->points.reserve(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		if(keep[i])
+			out->points.push_back(in.points[i]);
+	}
+	out->width = out->points.size();
+	out->height = 1;
+	out->is_dense = true;
+	return out;
+}
@@ -0,0 +1,111 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_PCL_FILTERS_HPP
+#define SLAM3D_PCL_FILTERS_HPP
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace slam3d
+{
+	typedef pcl::PointXYZ PointType;
+	typedef pcl::PointCloud<PointType> PointCloud;
+
+	/**
+	 * @struct VoxelKey
+	 * @brief Integer coordinates of a voxel in a regular grid.
+	 */
+	struct VoxelKey
+	{
+		int x, y, z;
+
+		bool operator==(const VoxelKey& other) const
+		{
+			return x == other.x && y == other.y && z == other.z;
+		}
+	};
+
+	struct VoxelKeyHash
+	{
+		size_t operator()(const VoxelKey& k) const
+		{
+			return ((size_t)k.x * 73856093) ^ ((size_t)k.y * 19349663) ^ ((size_t)k.z * 83492791);
+		}
+	};
+
+	/**
+	 * @brief Get the voxel that contains the given point.
+	 * @param x,y,z coordinates of the point
+	 * @param inverse inverse leaf size in the first three coefficients, 0 in the last
+	 * @param key the resulting voxel
+	 * @return false if the point is not finite or too far from the origin
+	 */
+	inline bool getVoxelKey(float x, float y, float z, const Eigen::Array4f& inverse, VoxelKey& key)
+	{
+		// Largest float below 2^31, larger voxel indices do not fit into an int
+		const float max_index = 2147483520.0f;
+		Eigen::Array4f scaled = (Eigen::Array4f(x, y, z, 0.0f) * inverse).floor();
+
+		// This also fails for NaN and infinite coordinates
+		if(!(scaled.abs() < max_index).all())
+			return false;
+
+		Eigen::Array4i index = scaled.cast<int>();
+		key.x = index[0];
+		key.y = index[1];
+		key.z = index[2];
+		return true;
+	}
+
+	/**
+	 * @brief Replace all points within each voxel of a regular grid by their centroid.
+	 * @details This gives the same points as pcl::VoxelGrid, but a hash map
+	 * is used instead of sorting the points by voxel index. It runs in a single
+	 * pass over the cloud and the number of voxels is not limited. Non-finite
+	 * points are skipped. The order of the resulting points is unspecified.
+	 * @param in input cloud
+	 * @param leaf_size edge length of the voxels
+	 * @param threads number of threads, 0 uses the number of cores
+	 * @return downsampled cloud
+	 */
+	PointCloud::Ptr voxelGridFilter(const PointCloud& in, float leaf_size, unsigned threads = 1);
+
+	/**
+	 * @brief Remove all points that have less than min_neighbors other points within radius.
+	 * @details Instead of a kd-tree like pcl::RadiusOutlierRemoval, the
+	 * points are sorted into a grid with cells of the size of the radius, so
+	 * that only the 27 surrounding cells have to be searched. The search for a point stops as soon as enough neighbors are
+	 * found. Non-finite points are removed, the order of the others is kept.
+	 * @param in input cloud
+	 * @param radius search radius
+	 * @param min_neighbors minimum number of neighbors (not counting the point itself)
+	 * @param threads number of threads, 0 uses the number of cores
+	 * @return filtered cloud
+	 */
+	PointCloud::Ptr radiusOutlierFilter(const PointCloud& in, float radius, unsigned min_neighbors, unsigned threads = 1);
+}
+
+#endif
@@ -0,0 +1,194 @@
+#define BOOST_TEST_MODULE "FiltersTest"
+
+#include "Filters.hpp"
+#include "IncrementalMap.hpp"
+
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/filters/radius_outlier_removal.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <unordered_map>
+
+using namespace slam3d;
+
+#ifndef SLAM3D_TEST_DATA
+#define SLAM3D_TEST_DATA "test"
+#endif
+
+typedef std::unordered_map<VoxelKey, PointType, VoxelKeyHash> VoxelPoints;
+
+// Read the finite points of a test cloud, stored as raw pcl::PointXYZ records
+PointCloud::Ptr loadCloud(unsigned i)
+{
+	PointCloud::Ptr cloud(new PointCloud);
+	std::ifstream in(std::string(SLAM3D_TEST_DATA) + "/cloud" + std::to_string(i) + ".bin", std::ios::binary);
+	PointType p;
+	while(in.read((char*)p.data, sizeof(p.data)))
+	{
+		if(std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+			cloud->push_back(p);
+	}
+	BOOST_REQUIRE(!cloud->empty());
+	return cloud;
+}
+
+// Index the points of a downsampled cloud by the voxel containing them
+VoxelPoints getVoxelPoints(const PointCloud& cloud, float leaf_size)
+{
+	const Eigen::Array4f inverse(1.0f / leaf_size, 1.0f / leaf_size, 1.0f / leaf_size, 0.0f);
+	VoxelPoints voxels;
+	for(PointCloud::const_iterator p = cloud.begin(); p != cloud.end(); ++p)
+	{
+		VoxelKey key;
+		BOOST_REQUIRE(getVoxelKey(p->x, p->y, p->z, inverse, key));
+		BOOST_CHECK(voxels.insert(std::make_pair(key, *p)).second);
+	}
+	return voxels;
+}
+
+// Both clouds must have the same point within each voxel
+void checkSameVoxels(const PointCloud& expected, const PointCloud& actual, float leaf_size)
+{
+	BOOST_REQUIRE_EQUAL(expected.size(), actual.size());
+	VoxelPoints voxels = getVoxelPoints(actual, leaf_size);
+	const Eigen::Array4f inverse(1.0f / leaf_size, 1.0f / leaf_size, 1.0f / leaf_size, 0.0f);
+	unsigned mismatches = 0;
+	for(PointCloud::const_iterator p = expected.begin(); p != expected.end(); ++p)
+	{
+		VoxelKey key;
+		BOOST_REQUIRE(getVoxelKey(p->x, p->y, p->z, inverse, key));
+		VoxelPoints::const_iterator v = voxels.find(key);
+		if(v == voxels.end() || (v->second.getVector3fMap() - p->getVector3fMap()).norm() > 1e-4)
+			mismatches++;
+	}
+	BOOST_CHECK_EQUAL(mismatches, 0);
+}
+
+// Coordinates of all points in lexicographic order
+std::vector<std::array<float, 3> > getSortedPoints(const PointCloud& cloud)
+{
+	std::vector<std::array<float, 3> > points;
+	for(PointCloud::const_iterator p = cloud.begin(); p != cloud.end(); ++p)
+	{
+		std::array<float, 3> point = {{p->x, p->y, p->z}};
+		points.push_back(point);
+	}
+	std::sort(points.begin(), points.end());
+	return points;
+}
+
+// The filtered cloud must be a subsequence of the input cloud
+bool isSubsequence(const PointCloud& filtered, const PointCloud& input)
+{
+	PointCloud::const_iterator in = input.begin();
+	for(PointCloud::const_iterator p = filtered.begin(); p != filtered.end(); ++p, ++in)
+	{
+		while(in != input.end() && in->getVector3fMap() != p->getVector3fMap())
+			++in;
+		if(in == input.end())
+			return false;
+	}
+	return true;
+}
+
+BOOST_AUTO_TEST_CASE(voxel_grid_filter)
+{
+	for(unsigned i = 1; i <= 4; i++)
+	{
+		PointCloud::Ptr cloud = loadCloud(i);
+		for(float leaf_size : {0.2f, 0.5f})
+		{
+			pcl::VoxelGrid<PointType> grid;
+			grid.setLeafSize(leaf_size, leaf_size, leaf_size);
+			grid.setInputCloud(cloud);
+			PointCloud expected;
+			grid.filter(expected);
+
+			checkSameVoxels(expected, *voxelGridFilter(*cloud, leaf_size, 1), leaf_size);
+			checkSameVoxels(expected, *voxelGridFilter(*cloud, leaf_size, 4), leaf_size);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(radius_outlier_filter)
+{
+	for(unsigned i = 1; i <= 4; i++)
+	{
+		PointCloud::Ptr cloud = loadCloud(i);
+		for(float radius : {0.2f, 0.5f})
+		{
+			pcl::RadiusOutlierRemoval<PointType> ror;
+			ror.setRadiusSearch(radius);
+			ror.setMinNeighborsInRadius(3);
+			ror.setInputCloud(cloud);
+			PointCloud expected;
+			ror.filter(expected);
+
+			// The kept points are compared regardless of their order,
+			// radiusOutlierFilter() itself has to keep the input order.
+			for(unsigned threads : {1u, 4u})
+			{
+				PointCloud::Ptr actual = radiusOutlierFilter(*cloud, radius, 3, threads);
+				BOOST_REQUIRE_EQUAL(expected.size(), actual->size());
+				BOOST_CHECK(getSortedPoints(expected) == getSortedPoints(*actual));
+				BOOST_CHECK(isSubsequence(*actual, *cloud));
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(incremental_map)
+{
+	const float resolution = 0.2;
+	std::vector<PointCloud::Ptr> clouds;
+	std::vector<Transform> poses;
+	for(unsigned i = 1; i <= 4; i++)
+	{
+		clouds.push_back(loadCloud(i));
+		poses.push_back(Eigen::Translation<ScalarType, 3>(i * 1.5, i * -0.7, 0.1) *
+		                Eigen::AngleAxis<ScalarType>(i * 0.3, Eigen::Vector3d::UnitZ()));
+	}
+
+	// The map adds the points with the precision of its compact copies
+	// and transforms them with a float matrix.
+	auto accumulate = [&](const std::vector<unsigned>& contributions)
+	{
+		PointCloud accu;
+		for(unsigned c : contributions)
+		{
+			PointCloud::Ptr decoded = CompactPointCloud(*clouds[c]).decode();
+			Eigen::Matrix4f tf = poses[c].matrix().cast<float>();
+			for(PointCloud::const_iterator p = decoded->begin(); p != decoded->end(); ++p)
+			{
+				Eigen::Vector4f t = tf * Eigen::Vector4f(p->x, p->y, p->z, 1.0f);
+				accu.push_back(PointType(t[0], t[1], t[2]));
+			}
+		}
+		return voxelGridFilter(accu, resolution);
+	};
+
+	IncrementalMap map(resolution);
+	for(unsigned c = 0; c < clouds.size(); c++)
+	{
+		map.setContribution(c, *clouds[c], poses[c]);
+	}
+	checkSameVoxels(*accumulate({0, 1, 2, 3}), *map.getCloud(), resolution);
+
+	// Re-pose one contribution and remove another one
+	poses[1] = Eigen::Translation<ScalarType, 3>(0.4, 0.3, -0.2) * poses[1];
+	BOOST_CHECK(map.setPose(1, poses[1]));
+	BOOST_CHECK(!map.setPose(1, poses[1]));
+	map.removeContribution(2);
+	checkSameVoxels(*accumulate({0, 1, 3}), *map.getCloud(), resolution);
+	BOOST_CHECK_EQUAL(map.getNumberOfVoxels(), map.getCloud()->size());
+
+	map.removeContribution(0);
+	map.removeContribution(1);
+	map.removeContribution(3);
+	BOOST_CHECK_EQUAL(map.getNumberOfVoxels(), 0);
+}
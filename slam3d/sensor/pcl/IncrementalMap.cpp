@@ -0,0 +1,288 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "IncrementalMap.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace slam3d;
+
+IncrementalMap::IncrementalMap(double resolution, double tile_size)
+ : mNumberOfVoxels(0), mResolution(resolution), mTileVoxels(0),
+   mTranslationTolerance(0.001), mRotationTolerance(0.001)
+{
+	if(tile_size > 0)
+		mTileVoxels = std::max(1, (int)std::lround(tile_size / resolution));
+}
+
+void IncrementalMap::setPoseTolerance(double translation, double rotation)
+{
+	mTranslationTolerance = translation;
+	mRotationTolerance = rotation;
+}
+
+TileKey IncrementalMap::getTileKey(const VoxelKey& voxel) const
+{
+	TileKey key = {0, 0, 0};
+	if(mTileVoxels > 0)
+	{
+		// Integer division rounding towards negative infinity
+		const int n = mTileVoxels;
+		key.x = voxel.x >= 0 ? voxel.x / n : -((-voxel.x - 1) / n) - 1;
+		key.y = voxel.y >= 0 ? voxel.y / n : -((-voxel.y - 1) / n) - 1;
+		key.z = voxel.z >= 0 ? voxel.z / n : -((-voxel.z - 1) / n) - 1;
+	}
+	return key;
+}
+
+void IncrementalMap::accumulate(IdType id, const PointCloud& cloud, const Transform& pose, int sign)
+{
+	const float inverse_leaf = 1.0f / mResolution;
+	const Eigen::Array4f inverse(inverse_leaf, inverse_leaf, inverse_leaf, 0.0f);
+	const Eigen::Matrix4f tf = pose.matrix().cast<float>();
+
+	// Consecutive points mostly fall into the same tile,
+	// so the tile lookup is skipped in that case.
+	std::unordered_map<TileKey, unsigned, VoxelKeyHash> touched;
+	Tile* tile = NULL;
+	unsigned* count = NULL;
+	TileKey tile_key;
+	for(PointCloud::const_iterator p = cloud.begin(); p != cloud.end(); ++p)
+	{
+		Eigen::Vector4f t = tf * Eigen::Vector4f(p->x, p->y, p->z, 1.0f);
+		VoxelKey key;
+		if(!getVoxelKey(t[0], t[1], t[2], inverse, key))
+			continue;
+
+		TileKey current = getTileKey(key);
+		if(!tile || !(current == tile_key))
+		{
+			tile_key = current;
+			if(sign > 0)
+			{
+				tile = &mTiles[tile_key];
+			}else
+			{
+				TileMap::iterator it = mTiles.find(tile_key);
+				tile = (it == mTiles.end()) ? NULL : &it->second;
+			}
+			count = &touched[tile_key];
+		}
+		if(!tile)
+			continue;
+
+		Eigen::Vector4d point(t[0], t[1], t[2], 1.0);
+		if(sign > 0)
+		{
+			std::pair<VoxelMap::iterator, bool> entry = tile->voxels.insert(std::make_pair(key, point));
+			if(entry.second)
+				mNumberOfVoxels++;
+			else
+				entry.first->second += point;
+		}else
+		{
+			// The points are transformed exactly as when they were added,
+			// so they are always found in the same voxel again.
+			VoxelMap::iterator voxel = tile->voxels.find(key);
+			if(voxel == tile->voxels.end())
+				continue;
+			voxel->second -= point;
+			if(voxel->second[3] < 0.5)
+			{
+				tile->voxels.erase(voxel);
+				mNumberOfVoxels--;
+			}
+		}
+		(*count)++;
+	}
+
+	// Update the contributors and drop tiles that became empty
+	for(std::unordered_map<TileKey, unsigned, VoxelKeyHash>::iterator t = touched.begin(); t != touched.end(); ++t)
+	{
+		if(t->second == 0)
+			continue;
+		mChangedTiles.insert(t->first);
+		TileMap::iterator it = mTiles.find(t->first);
+		if(sign > 0)
+		{
+			it->second.contributors[id] += t->second;
+			continue;
+		}
+		std::map<IdType, unsigned>::iterator c = it->second.contributors.find(id);
+		if(c != it->second.contributors.end() && c->second <= t->second)
+			it->second.contributors.erase(c);
+		else if(c != it->second.contributors.end())
+			c->second -= t->second;
+		if(it->second.voxels.empty())
+			mTiles.erase(it);
+	}
+}
+
+void IncrementalMap::accumulate(IdType id, const Contribution& contribution, int sign)
+{
+	accumulate(id, *contribution.cloud->decode(), contribution.pose, sign);
+}
+
+void IncrementalMap::setContribution(IdType id, const PointCloud& cloud, const Transform& pose)
+{
+	setContribution(id, CompactPointCloud::ConstPtr(new CompactPointCloud(cloud)), pose);
+}
+
+void IncrementalMap::setContribution(IdType id, const CompactPointCloud::ConstPtr& cloud, const Transform& pose)
+{
+	removeContribution(id);
+	Contribution& contribution = mContributions[id];
+	contribution.cloud = cloud;
+	contribution.pose = pose;
+	accumulate(id, contribution, 1);
+}
+
+bool IncrementalMap::setPose(IdType id, const Transform& pose)
+{
+	std::map<IdType, Contribution>::iterator c = mContributions.find(id);
+	if(c == mContributions.end())
+		return false;
+
+	Transform delta = c->second.pose.inverse() * pose;
+	if(delta.translation().norm() < mTranslationTolerance &&
+	   Eigen::AngleAxis<ScalarType>(delta.rotation()).angle() < mRotationTolerance)
+		return false;
+
+	// Decode once for removing and adding the points
+	PointCloud::Ptr cloud = c->second.cloud->decode();
+	accumulate(id, *cloud, c->second.pose, -1);
+	c->second.pose = pose;
+	accumulate(id, *cloud, pose, 1);
+	return true;
+}
+
+void IncrementalMap::removeContribution(IdType id)
+{
+	std::map<IdType, Contribution>::iterator c = mContributions.find(id);
+	if(c == mContributions.end())
+		return;
+	accumulate(id, c->second, -1);
+	mContributions.erase(c);
+}
+
+std::vector<IdType> IncrementalMap::getContributors() const
+{
+	std::vector<IdType> ids;
+	ids.reserve(mContributions.size());
+	for(std::map<IdType, Contribution>::const_iterator c = mContributions.begin(); c != mContributions.end(); ++c)
+	{
+		ids.push_back(c->first);
+	}
+	return ids;
+}
+
+void IncrementalMap::appendCentroids(const TileKey& key, unsigned min_points, PointCloud& cloud) const
+{
+	TileMap::const_iterator tile = mTiles.find(key);
+	if(tile == mTiles.end())
+		return;
+	const VoxelMap& voxels = tile->second.voxels;
+	for(VoxelMap::const_iterator v = voxels.begin(); v != voxels.end(); ++v)
+	{
+		if(v->second[3] < min_points)
+			continue;
+		Eigen::Vector3d centroid = v->second.head<3>() / v->second[3];
+		cloud.points.push_back(PointType(centroid[0], centroid[1], centroid[2]));
+	}
+}
+
+PointCloud::Ptr IncrementalMap::getCloud(unsigned min_points) const
+{
+	PointCloud::Ptr cloud(new PointCloud);
+	cloud->points.reserve(mNumberOfVoxels);
+	for(TileMap::const_iterator t = mTiles.begin(); t != mTiles.end(); ++t)
+	{
+		appendCentroids(t->first, min_points, *cloud);
+	}
+	cloud->width = cloud->points.size();
+	cloud->height = 1;
+	cloud->is_dense = true;
+	return cloud;
+}
+
+std::vector<TileKey> IncrementalMap::getTiles() const
+{
+	std::vector<TileKey> keys;
+	keys.reserve(mTiles.size());
+	for(TileMap::const_iterator t = mTiles.begin(); t != mTiles.end(); ++t)
+	{
+		keys.push_back(t->first);
+	}
+	return keys;
+}
+
+PointCloud::Ptr IncrementalMap::getTile(const TileKey& key, unsigned min_points) const
+{
+	PointCloud::Ptr cloud(new PointCloud);
+	TileMap::const_iterator tile = mTiles.find(key);
+	if(tile != mTiles.end())
+	{
+		cloud->points.reserve(tile->second.voxels.size());
+		appendCentroids(key, min_points, *cloud);
+	}
+	cloud->width = cloud->points.size();
+	cloud->height = 1;
+	cloud->is_dense = true;
+	return cloud;
+}
+
+std::vector<IdType> IncrementalMap::getTileContributors(const TileKey& key) const
+{
+	std::vector<IdType> ids;
+	TileMap::const_iterator tile = mTiles.find(key);
+	if(tile == mTiles.end())
+		return ids;
+	ids.reserve(tile->second.contributors.size());
+	for(std::map<IdType, unsigned>::const_iterator c = tile->second.contributors.begin(); c != tile->second.contributors.end(); ++c)
+	{
+		ids.push_back(c->first);
+	}
+	return ids;
+}
+
+std::vector<TileKey> IncrementalMap::takeChangedTiles()
+{
+	std::vector<TileKey> keys(mChangedTiles.begin(), mChangedTiles.end());
+	mChangedTiles.clear();
+	return keys;
+}
+
+void IncrementalMap::clear()
+{
+	// Existing tiles are reported as removed
+	for(TileMap::const_iterator t = mTiles.begin(); t != mTiles.end(); ++t)
+	{
+		mChangedTiles.insert(t->first);
+	}
+	mTiles.clear();
+	mNumberOfVoxels = 0;
+	mContributions.clear();
+}
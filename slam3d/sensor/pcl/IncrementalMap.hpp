@@ -0,0 +1,226 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_PCL_INCREMENTALMAP_HPP
+#define SLAM3D_PCL_INCREMENTALMAP_HPP
+
+#include <slam3d/core/Types.hpp>
+#include <slam3d/sensor/pcl/Filters.hpp>
+#include <slam3d/sensor/pcl/CompactPointCloud.hpp>
+
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace slam3d
+{
+	/**
+	 * @brief Integer coordinates of a map tile.
+	 * @details The tile covers the voxels from key * n to (key + 1) * n - 1
+	 * in each dimension, with n being the number of voxels per tile edge.
+	 */
+	typedef VoxelKey TileKey;
+	typedef std::unordered_set<TileKey, VoxelKeyHash> TileKeySet;
+
+	/**
+	 * @struct MapTile
+	 * @brief Part of a tiled map together with the vertices that contributed to it.
+	 * @details An empty cloud means that the tile has been removed from the map.
+	 */
+	struct MapTile
+	{
+		TileKey key;
+		PointCloud::Ptr cloud;
+		std::vector<IdType> contributors;
+	};
+	typedef std::vector<MapTile> MapTileList;
+
+	/**
+	 * @class IncrementalMap
+	 * @brief Voxel map that is updated incrementally from single point clouds.
+	 * @details Each voxel stores the sum and number of the points within it,
+	 * so that the contribution of a single cloud can be removed again. When the
+	 * pose of a contributing cloud changes, only this cloud has to be re-posed.
+	 * The resulting cloud is the same as downsampling the accumulation of all
+	 * contributions with a voxel grid filter.
+	 * Each contribution is kept as a CompactPointCloud, so that the map does
+	 * not hold on to the clouds it was built from. The compact cloud is decoded
+	 * when the contribution is re-posed or removed.
+	 * Optionally the voxels are grouped into cubic tiles. Each tile knows
+	 * which contributions have points within it, and tiles that were changed
+	 * are recorded until they are taken with takeChangedTiles(), so that
+	 * only those have to be rebuilt after an update.
+	 */
+	class IncrementalMap
+	{
+	public:
+		/**
+		 * @brief Constructor
+		 * @param resolution edge length of the voxels
+		 * @param tile_size edge length of the tiles, it is rounded to a multiple
+		 * of the resolution, 0 puts the whole map into a single tile
+		 */
+		IncrementalMap(double resolution, double tile_size = 0);
+
+		/**
+		 * @brief Set the minimum pose change that causes a contribution to be re-posed.
+		 * @param translation in meters
+		 * @param rotation in radians
+		 */
+		void setPoseTolerance(double translation, double rotation);
+
+		/**
+		 * @brief Add a cloud to the map or replace an existing contribution.
+		 * @details The map stores a compact copy of the cloud, the points are
+		 * added with the precision of the compact copy.
+		 * @param id unique identifier of the contribution, e.g. the vertex id
+		 * @param cloud points in the local frame
+		 * @param pose transformation from the local to the map frame
+		 */
+		void setContribution(IdType id, const PointCloud& cloud, const Transform& pose);
+
+		/**
+		 * @brief Add a compact cloud to the map or replace an existing contribution.
+		 * @param id unique identifier of the contribution, e.g. the vertex id
+		 * @param cloud points in the local frame
+		 * @param pose transformation from the local to the map frame
+		 */
+		void setContribution(IdType id, const CompactPointCloud::ConstPtr& cloud, const Transform& pose);
+
+		/**
+		 * @brief Move an existing contribution to a new pose.
+		 * @details Nothing is changed if the pose is within the pose tolerance.
+		 * @param id
+		 * @param pose transformation from the local to the map frame
+		 * @return true if the map was changed
+		 */
+		bool setPose(IdType id, const Transform& pose);
+
+		/**
+		 * @brief Whether a cloud with the given id has been added to the map.
+		 * @param id
+		 */
+		bool hasContribution(IdType id) const { return mContributions.find(id) != mContributions.end(); }
+
+		/**
+		 * @brief Remove a cloud from the map.
+		 * @param id
+		 */
+		void removeContribution(IdType id);
+
+		/**
+		 * @brief Get the ids of all contributions in the map.
+		 */
+		std::vector<IdType> getContributors() const;
+
+		/**
+		 * @brief Get the centroids of all voxels as a point cloud.
+		 * @param min_points only use voxels with at least this many points
+		 */
+		PointCloud::Ptr getCloud(unsigned min_points = 1) const;
+
+		/**
+		 * @brief Get the number of occupied voxels.
+		 */
+		size_t getNumberOfVoxels() const { return mNumberOfVoxels; }
+
+		/**
+		 * @brief Get the edge length of the voxels.
+		 */
+		double getResolution() const { return mResolution; }
+
+		/**
+		 * @brief Get the effective edge length of the tiles, 0 if not tiled.
+		 */
+		double getTileSize() const { return mTileVoxels * mResolution; }
+
+		/**
+		 * @brief Get the keys of all tiles that contain voxels.
+		 */
+		std::vector<TileKey> getTiles() const;
+
+		/**
+		 * @brief Get the centroids of all voxels within a tile.
+		 * @param key
+		 * @param min_points only use voxels with at least this many points
+		 * @return empty cloud if the tile does not exist
+		 */
+		PointCloud::Ptr getTile(const TileKey& key, unsigned min_points = 1) const;
+
+		/**
+		 * @brief Get the ids of all contributions with points in a tile.
+		 * @param key
+		 */
+		std::vector<IdType> getTileContributors(const TileKey& key) const;
+
+		/**
+		 * @brief Get all tiles changed since the last call and reset the change tracking.
+		 * @details This includes tiles that have been removed because their
+		 * last contribution was removed or moved away.
+		 */
+		std::vector<TileKey> takeChangedTiles();
+
+		/**
+		 * @brief Remove all contributions.
+		 */
+		void clear();
+
+	private:
+		struct Contribution
+		{
+			CompactPointCloud::ConstPtr cloud;
+			Transform pose;
+		};
+
+		void accumulate(IdType id, const Contribution& contribution, int sign);
+		void accumulate(IdType id, const PointCloud& cloud, const Transform& pose, int sign);
+		TileKey getTileKey(const VoxelKey& voxel) const;
+		void appendCentroids(const TileKey& key, unsigned min_points, PointCloud& cloud) const;
+
+		// Sum of (x, y, z) and number of points per voxel
+		typedef std::unordered_map<VoxelKey, Eigen::Vector4d, VoxelKeyHash, std::equal_to<VoxelKey>,
+			Eigen::aligned_allocator<std::pair<const VoxelKey, Eigen::Vector4d> > > VoxelMap;
+
+		// Voxels of a tile and number of points per contribution within it
+		struct Tile
+		{
+			VoxelMap voxels;
+			std::map<IdType, unsigned> contributors;
+		};
+		typedef std::unordered_map<TileKey, Tile, VoxelKeyHash> TileMap;
+
+		TileMap mTiles;
+		TileKeySet mChangedTiles;
+		size_t mNumberOfVoxels;
+		std::map<IdType, Contribution> mContributions;
+		double mResolution;
+		int mTileVoxels;
+		double mTranslationTolerance;
+		double mRotationTolerance;
+	};
+}
+
+#endif
@@ -0,0 +1,357 @@
+#include "PointCloudSensor.hpp"
+
+#include <slam3d/core/Logger.hpp>
+#include <slam3d/core/Mapper.hpp>
+#include <slam3d/core/PoseSensor.hpp>
+#include <slam3d/core/Profiler.hpp>
+#include <slam3d/graph/boost/BoostGraph.hpp>
+#include <slam3d/solver/g2o/G2oSolver.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace slam3d;
+
+// Read raw pcl::PointXYZ records as stored in test/cloud*.bin
+PointCloud::Ptr loadCloud(const std::string& file)
+{
+	PointCloud::Ptr cloud(new PointCloud);
+	std::ifstream in(file.c_str(), std::ios::binary);
+	PointType p;
+	while(in.read((char*)p.data, sizeof(p.data)))
+	{
+		cloud->push_back(p);
+	}
+	return cloud;
+}
+
+// Read comma separated rows, lines that do not start with a number are skipped
+std::vector<std::vector<std::string> > readCsv(const std::string& file)
+{
+	std::vector<std::vector<std::string> > rows;
+	std::ifstream in(file.c_str());
+	if(!in.good())
+	{
+		std::cerr << "Could not open " << file << std::endl;
+		return rows;
+	}
+	std::string line;
+	while(std::getline(in, line))
+	{
+		if(line.empty() || !(isdigit(line[0]) || line[0] == '-' || line[0] == '.'))
+			continue;
+		std::vector<std::string> row;
+		std::stringstream stream(line);
+		std::string cell;
+		while(std::getline(stream, cell, ','))
+			row.push_back(cell);
+		rows.push_back(row);
+	}
+	return rows;
+}
+
+struct Scan
+{
+	double time;
+	std::string file;
+};
+
+struct StampedPose
+{
+	double time;
+	Eigen::Vector3d position;
+	Eigen::Quaterniond orientation;
+};
+
+struct StampedPosition
+{
+	double time;
+	Position position;
+	double sigma;
+};
+
+// Odometry pose at the given time, interpolated between the samples
+Transform interpolate(const std::vector<StampedPose>& poses, double time)
+{
+	size_t i = 1;
+	while(i < poses.size() - 1 && poses[i].time < time)
+		i++;
+	const StampedPose& a = poses[i-1];
+	const StampedPose& b = poses[i];
+	double f = (b.time > a.time) ? (time - a.time) / (b.time - a.time) : 0;
+	f = std::max(0.0, std::min(1.0, f));
+	Transform pose = Transform::Identity();
+	pose.translation() = a.position + f * (b.position - a.position);
+	pose.linear() = a.orientation.slerp(f, b.orientation).toRotationMatrix();
+	return pose;
+}
+
+// Adds the latest GPS position to each new vertex
+class ReplayGpsSensor : public PoseSensor
+{
+public:
+	ReplayGpsSensor(const std::string& n, Graph* g, Logger* l) : PoseSensor(n, g, l), mHasNewData(false) {}
+
+	void handleNewVertex(IdType vertex)
+	{
+		if(!mHasNewData)
+			return;
+		Covariance<3> covariance = Covariance<3>::Identity() * mSigma * mSigma * mCovarianceScale;
+		PositionConstraint::Ptr position(new PositionConstraint(mName, mPosition, covariance, Transform::Identity()));
+		mGraph->addConstraint(vertex, 0, position);
+		mHasNewData = false;
+	}
+
+	Transform getPose(timeval stamp)
+	{
+		Transform pose = Transform::Identity();
+		pose.translation() = mPosition;
+		return pose;
+	}
+
+	void update(const Position& p, double sigma)
+	{
+		mPosition = p;
+		mSigma = sigma;
+		mHasNewData = true;
+	}
+
+private:
+	Position mPosition;
+	double mSigma;
+	bool mHasNewData;
+};
+
+// Usage: pcl_mapping_replay [-s scans.csv] [-o odometry.csv] [-g gps.csv] [-r radius] [-k links]
+//                           [-p optimize_every] [-d density] [-x min_distance] [-t threads] [-b budget]
+//                           [-m] [cloud.bin]...
+// scans.csv:    time,file (relative to the csv file)
+// odometry.csv: time,x,y,z,qx,qy,qz,qw
+// gps.csv:      time,x,y,z[,sigma] in map coordinates
+// Clouds given on the command line are replayed with 10 Hz. Without any input,
+// the sample clouds from the test directory are used. With a latency budget in seconds,
+// linking is skipped for scans that would take longer to map.
+int main(int argc, char** argv)
+{
+	std::string scan_file, odometry_file, gps_file;
+	float radius = 5.0;
+	unsigned links = 1;
+	unsigned optimize_every = 10;
+	double density = -1;
+	float min_distance = 0.5;
+	unsigned threads = 1;
+	double budget = 0;
+	bool build_map = false;
+	std::vector<Scan> scans;
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			scan_file = argv[++i];
+		else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			odometry_file = argv[++i];
+		else if(strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+			gps_file = argv[++i];
+		else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			radius = atof(argv[++i]);
+		else if(strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+			links = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			optimize_every = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			density = atof(argv[++i]);
+		else if(strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+			min_distance = atof(argv[++i]);
+		else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			budget = atof(argv[++i]);
+		else if(strcmp(argv[i], "-m") == 0)
+			build_map = true;
+		else
+		{
+			Scan s;
+			s.time = scans.size() * 0.1;
+			s.file = argv[i];
+			scans.push_back(s);
+		}
+	}
+
+	if(!scan_file.empty())
+	{
+		std::string dir;
+		size_t slash = scan_file.find_last_of('/');
+		if(slash != std::string::npos)
+			dir = scan_file.substr(0, slash + 1);
+		std::vector<std::vector<std::string> > rows = readCsv(scan_file);
+		for(std::vector<std::vector<std::string> >::iterator r = rows.begin(); r != rows.end(); ++r)
+		{
+			if(r->size() < 2)
+				continue;
+			Scan s;
+			s.time = atof((*r)[0].c_str());
+			s.file = ((*r)[1].size() > 0 && (*r)[1][0] == '/') ? (*r)[1] : dir + (*r)[1];
+			scans.push_back(s);
+		}
+	}
+	if(scans.empty())
+	{
+		for(int i = 1; i <= 4; i++)
+		{
+			Scan s;
+			s.time = (i - 1) * 0.1;
+			s.file = std::string(SLAM3D_TEST_DATA) + "/cloud" + std::to_string(i) + ".bin";
+			scans.push_back(s);
+		}
+	}
+
+	std::vector<StampedPose> odometry;
+	if(!odometry_file.empty())
+	{
+		std::vector<std::vector<std::string> > rows = readCsv(odometry_file);
+		for(std::vector<std::vector<std::string> >::iterator r = rows.begin(); r != rows.end(); ++r)
+		{
+			if(r->size() < 8)
+				continue;
+			StampedPose p;
+			p.time = atof((*r)[0].c_str());
+			p.position = Eigen::Vector3d(atof((*r)[1].c_str()), atof((*r)[2].c_str()), atof((*r)[3].c_str()));
+			p.orientation = Eigen::Quaterniond(atof((*r)[7].c_str()), atof((*r)[4].c_str()),
+			                                   atof((*r)[5].c_str()), atof((*r)[6].c_str())).normalized();
+			odometry.push_back(p);
+		}
+		if(odometry.size() < 2)
+		{
+			std::cerr << "At least two odometry poses are required." << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<StampedPosition> gps;
+	if(!gps_file.empty())
+	{
+		std::vector<std::vector<std::string> > rows = readCsv(gps_file);
+		for(std::vector<std::vector<std::string> >::iterator r = rows.begin(); r != rows.end(); ++r)
+		{
+			if(r->size() < 4)
+				continue;
+			StampedPosition p;
+			p.time = atof((*r)[0].c_str());
+			p.position = Position(atof((*r)[1].c_str()), atof((*r)[2].c_str()), atof((*r)[3].c_str()));
+			p.sigma = (r->size() > 4) ? atof((*r)[4].c_str()) : 1.0;
+			gps.push_back(p);
+		}
+	}
+
+	// Set up the same components as on the robot
+	Clock clock;
+	Logger logger(clock);
+	logger.setLogLevel(ERROR);
+	BoostGraph graph(&logger);
+	G2oSolver solver(&logger);
+	graph.setSolver(&solver);
+	Mapper mapper(&graph, &logger);
+	IngestionPolicy policy;
+	policy.latency_budget = budget;
+	mapper.setIngestionPolicy(policy);
+
+	Profiler profiler;
+	PointCloudSensor sensor("Replay", &logger);
+	sensor.setProfiler(&profiler);
+	sensor.setNeighborRadius(radius, links);
+	sensor.setMinPoseDistance(min_distance, 0.1);
+	sensor.setNumberOfThreads(threads);
+	sensor.setLinkingThreads(threads);
+	RegistrationParameters fine;
+	if(density >= 0)
+		fine.point_cloud_density = density;
+	fine.num_threads = threads;
+	RegistrationParameters coarse = fine;
+	coarse.point_cloud_density = fine.point_cloud_density * 2;
+	coarse.max_correspondence_distance = fine.max_correspondence_distance * 2;
+	coarse.max_fitness_score = fine.max_fitness_score * 4;
+	sensor.setRegistrationParameters(fine, false);
+	sensor.setRegistrationParameters(coarse, true);
+	mapper.registerSensor(&sensor);
+
+	ReplayGpsSensor gps_sensor("GPS", &graph, &logger);
+	if(!gps.empty())
+		mapper.registerPoseSensor(&gps_sensor);
+
+	// Replay as fast as possible
+	unsigned vertices = 0;
+	size_t next_gps = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(std::vector<Scan>::iterator s = scans.begin(); s != scans.end(); ++s)
+	{
+		PointCloud::Ptr cloud;
+		{
+			ScopedTimer timer(&profiler, "loading");
+			cloud = loadCloud(s->file);
+		}
+		if(cloud->empty())
+		{
+			std::cerr << "Could not load point cloud from " << s->file << std::endl;
+			continue;
+		}
+		cloud->header.stamp = (uint64_t)(s->time * 1000000);
+		PointCloudMeasurement::Ptr m(new PointCloudMeasurement(cloud, "Robot", sensor.getName(), Transform::Identity()));
+
+		// Use the latest GPS position that is not older than one second
+		while(next_gps < gps.size() && gps[next_gps].time <= s->time)
+			next_gps++;
+		if(next_gps > 0 && s->time - gps[next_gps-1].time < 1.0)
+			gps_sensor.update(gps[next_gps-1].position, gps[next_gps-1].sigma);
+
+		ScopedTimer frame_timer(&profiler, "frame");
+		bool added = false;
+		{
+			ScopedTimer timer(&profiler, "add_measurement");
+			if(odometry.empty())
+				added = sensor.addMeasurement(m);
+			else
+				added = sensor.addMeasurement(m, interpolate(odometry, s->time));
+		}
+		if(!added)
+			continue;
+		vertices++;
+
+		{
+			ScopedTimer timer(&profiler, "link_neighbors");
+			sensor.linkLastToNeighbors(false);
+		}
+		if(optimize_every > 0 && vertices % optimize_every == 0)
+		{
+			ScopedTimer timer(&profiler, "optimization");
+			graph.optimize();
+		}
+	}
+	if(vertices > 1 && (optimize_every == 0 || vertices % optimize_every != 0))
+	{
+		ScopedTimer timer(&profiler, "optimization");
+		graph.optimize();
+	}
+	if(build_map)
+	{
+		ScopedTimer timer(&profiler, "map_building");
+		sensor.buildMap(graph.getVerticesFromSensor(sensor.getName()));
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	profiler.print(std::cout);
+	double duration = scans.back().time - scans.front().time;
+	std::cout << std::endl << "Replayed " << scans.size() << " scans in " << wall << " s ("
+	          << scans.size() / wall << " scans/s), added " << vertices << " vertices." << std::endl;
+	if(duration > 0)
+		std::cout << "Real-time factor: " << duration / wall << std::endl;
+	if(budget > 0)
+		std::cout << "Linking skipped for " << mapper.getIngestionStatistics().skipped_links
+		          << " vertices to keep the latency budget." << std::endl;
+	return 0;
+}
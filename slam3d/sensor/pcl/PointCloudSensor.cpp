@@ -26,53 +26,110 @@
 #include "PointCloudSensor.hpp"
 
 #include <slam3d/core/Mapper.hpp>
+#include <slam3d/core/WorkerPool.hpp>
 
 #include <pcl/registration/gicp.h>
 #include <pcl/registration/ndt.h>
-#include <pcl/filters/voxel_grid.h>
-#include <pcl/filters/radius_outlier_removal.h>
+#include <pcl/search/kdtree.h>
 #include <pcl/pcl_config.h>
 #include <pcl/sample_consensus/ransac.h>
 #include <pcl/sample_consensus/sac_model_plane.h>
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+#include <unordered_set>
+
 #define PI 3.141592654
 
 using namespace slam3d;
 
+bool PointCloudMeasurement::writePayload(std::vector<char>& buffer) const
+{
+	std::lock_guard<std::mutex> guard(mCloudMutex);
+	char compact = mCompactCloud ? 1 : 0;
+	if(compact)
+	{
+		buffer.push_back(compact);
+		mCompactCloud->serialize(buffer);
+		return true;
+	}
+	if(mPointCloud)
+	{
+		buffer.push_back(compact);
+		serializePointCloud(*mPointCloud, buffer);
+		return true;
+	}
+	return false;
+}
+
+void PointCloudMeasurement::readPayload(const char* data, size_t size)
+{
+	std::lock_guard<std::mutex> guard(mCloudMutex);
+	if(size > 0 && data[0] == 1)
+		mCompactCloud.reset(new CompactPointCloud(data + 1, size - 1));
+	else if(size > 0)
+		mPointCloud = deserializePointCloud(data + 1, size - 1);
+}
+
+void PointCloudMeasurement::releasePayload()
+{
+	{
+		std::lock_guard<std::mutex> guard(mCloudMutex);
+		mPointCloud.reset();
+		mCompactCloud.reset();
+	}
+	// The registration data is derived from the cloud and recomputed after a page-in
+	clearPreprocessedClouds();
+}
+
+size_t PointCloudMeasurement::getPayloadSize() const
+{
+	std::lock_guard<std::mutex> guard(mCloudMutex);
+	if(mPointCloud)
+		return mPointCloud->points.size() * sizeof(PointType);
+	if(mCompactCloud)
+		return mCompactCloud->getMemoryUsage();
+	return 0;
+}
+
 PointCloudSensor::PointCloudSensor(const std::string& n, Logger* l)
  : ScanSensor(n, l)
 {
 	mMapResolution = 0.1;
 	mMapOutlierRadius = 0.2;
 	mMapOutlierNeighbors = 3;
+	mCacheRegistrationData = true;
+	mRegistrationCacheSize = 64;
+	mLastCachedVertex = 0;
+	mNumberOfThreads = 1;
+	mMapMinPoints = 1;
+	mMapTileSize = 20.0;
+	mCompactStorage = false;
+	mPlaceMaxDistance = 0.4;
+	mPlaceCandidates = 3;
+	mProposedVertex = 0;
+	mLastRegistrationResult.transform = Transform::Identity();
+	mLastRegistrationResult.fitness = 0;
+	mLastRegistrationResult.iterations = 0;
 }
 
 PointCloudSensor::~PointCloudSensor()
 {
-
+	shutdown();
 }
 
 PointCloud::Ptr PointCloudSensor::downsample(PointCloud::ConstPtr in, double leaf_size) const
 {
-	PointCloud::Ptr out(new PointCloud);
-	pcl::VoxelGrid<PointType> grid;
-	grid.setLeafSize (leaf_size, leaf_size, leaf_size);
-	grid.setInputCloud(in);
-	grid.filter(*out);
-	return out;
+	return voxelGridFilter(*in, leaf_size, mNumberOfThreads);
 }
 
 PointCloud::Ptr PointCloudSensor::removeOutliers(PointCloud::ConstPtr in, double radius, unsigned min_neighbors) const
 {
-	PointCloud::Ptr out(new PointCloud);
-	pcl::RadiusOutlierRemoval<PointType> out_removal;
-	out_removal.setInputCloud(in);
-	out_removal.setRadiusSearch(radius);
-	out_removal.setMinNeighborsInRadius(min_neighbors);
-	out_removal.filter(*out);
-	return out;
+	return radiusOutlierFilter(*in, radius, min_neighbors, mNumberOfThreads);
 }
 
 PointCloud::Ptr PointCloudSensor::transform(PointCloud::ConstPtr source, const Transform tf) const
@@ -82,9 +139,27 @@ PointCloud::Ptr PointCloudSensor::transform(PointCloud::ConstPtr source, const T
 	return transformedCloud;
 }
 
-PointCloud::Ptr PointCloudSensor::getAccumulatedCloud(const VertexObjectList& vertices) const
+namespace
 {
-	PointCloud::Ptr accu(new PointCloud);
+	struct AccumulationSource
+	{
+		PointCloud::ConstPtr cloud;
+		CompactPointCloud::ConstPtr compact;
+		Eigen::Matrix4f tf;
+		size_t offset;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	};
+}
+
+PointCloud::Ptr PointCloudSensor::getAccumulatedCloud(const VertexObjectList& vertices, const Transform& origin) const
+{
+	// Collect all clouds first, so that the output can be allocated at once
+	std::vector<AccumulationSource, Eigen::aligned_allocator<AccumulationSource> > sources;
+	sources.reserve(vertices.size());
+	Transform inverse_origin = origin.inverse();
+	size_t total = 0;
+	bool dense = true;
 	for(VertexObjectList::const_reverse_iterator it = vertices.rbegin(); it != vertices.rend(); it++)
 	{
 		PointCloudMeasurement::Ptr pcl = boost::dynamic_pointer_cast<PointCloudMeasurement>(it->measurement);
@@ -94,19 +169,52 @@ PointCloud::Ptr PointCloudSensor::getAccumulatedCloud(const VertexObjectList& ve
 			throw BadMeasurementType();
 		}
 		
-		PointCloud::Ptr tempCloud = transform(pcl->getPointCloud(), (it->corrected_pose * pcl->getSensorPose()));
-		*accu += *tempCloud;
+		AccumulationSource source;
+		source.compact = pcl->getCompactPointCloud();
+		if(!source.compact)
+		{
+			source.cloud = pcl->getPointCloud();
+			dense = dense && source.cloud->is_dense;
+		}
+		source.tf = (inverse_origin * it->corrected_pose * pcl->getSensorPose()).matrix().cast<float>();
+		source.offset = total;
+		total += source.compact ? source.compact->size() : source.cloud->size();
+		sources.push_back(source);
 	}
+
+	PointCloud::Ptr accu(new PointCloud);
+	accu->resize(total);
+	accu->is_dense = dense;
+	if(total == 0)
+		return accu;
+
+	// Write the transformed points directly into the output
+	PointType* out = &accu->points[0];
+	parallelFor(sources.size(), mNumberOfThreads, [&](size_t begin, size_t end, unsigned chunk)
+	{
+		for(size_t i = begin; i < end; i++)
+		{
+			const AccumulationSource& source = sources[i];
+			if(source.compact)
+			{
+				source.compact->decode(source.tf, out + source.offset);
+				continue;
+			}
+			PointType* target = out + source.offset;
+			for(PointCloud::const_iterator p = source.cloud->begin(); p != source.cloud->end(); ++p, ++target)
+			{
+				target->getVector4fMap() = source.tf * Eigen::Vector4f(p->x, p->y, p->z, 1.0f);
+			}
+		}
+	});
 	return accu;
 }
 
 Measurement::Ptr PointCloudSensor::createCombinedMeasurement(const VertexObjectList& vertices, Transform pose) const
 {
-	PointCloud::Ptr cloud = getAccumulatedCloud(vertices);
-	PointCloud::Ptr shifted(new PointCloud);
-	pcl::transformPointCloud(*cloud, *shifted, pose.inverse().matrix());
+	PointCloud::Ptr cloud = getAccumulatedCloud(vertices, pose);
 	mLogger->message(DEBUG, (boost::format("Patch pointcloud has %1% points.") % cloud->size()).str());
-	Measurement::Ptr m(new PointCloudMeasurement(shifted, "AccumulatedPointcloud", mName, Transform::Identity()));
+	Measurement::Ptr m(new PointCloudMeasurement(cloud, "AccumulatedPointcloud", mName, Transform::Identity()));
 	return m;
 }
 
@@ -128,13 +236,22 @@ Constraint::Ptr PointCloudSensor::createConstraint(const Measurement::Ptr& sourc
 	}
 	
 	// For large loops, refine guess by a coarse ICP
+	unsigned coarse_iterations = 0;
 	if(loop)
 	{
-		guess = align(sourceCloud, targetCloud, guess, mCoarseConfiguration);
+		RegistrationResult coarse = align(sourceCloud, targetCloud, guess, mCoarseConfiguration);
+		guess = coarse.transform;
+		coarse_iterations = coarse.iterations;
 	}
 	
 	// Calculate precise alignement with fine ICP
-	Transform icp_result = align(sourceCloud, targetCloud, guess, mFineConfiguration);
+	RegistrationResult fine = align(sourceCloud, targetCloud, guess, mFineConfiguration);
+	fine.iterations += coarse_iterations;
+	{
+		std::lock_guard<std::mutex> guard(mLastRegistrationMutex);
+		mLastRegistrationResult = fine;
+	}
+	Transform icp_result = fine.transform;
 	
 	// Transform back to robot frame
 	TransformWithCovariance twc;
@@ -144,40 +261,300 @@ Constraint::Ptr PointCloudSensor::createConstraint(const Measurement::Ptr& sourc
 	return Constraint::Ptr(new SE3Constraint(mName, twc));
 }
 
-Transform PointCloudSensor::align(PointCloudMeasurement::Ptr source,
-                                  PointCloudMeasurement::Ptr target,
-                                  const Transform& guess,
-                                  const RegistrationParameters& config)
+namespace slam3d
+{
+	// PCL does not expose the number of iterations performed by GICP
+	class GICPType : public pcl::GeneralizedIterativeClosestPoint<PointType, PointType>
+	{
+	public:
+		int getNumberOfIterations() const { return nr_iterations_; }
+	};
+
+	typedef pcl::NormalDistributionsTransform<PointType, PointType> NDTType;
+	typedef pcl::search::KdTree<PointType> SearchTree;
+
+	struct PreprocessedCloud
+	{
+		PointCloud::Ptr cloud;
+		SearchTree::Ptr tree;
+		GICPType::MatricesVectorPtr covariances;
+
+		// The NDT grid is built lazily when the cloud is first used as NDT target.
+		// The instance is not reentrant, so it is guarded by its own mutex.
+		boost::shared_ptr<NDTType> ndt;
+		std::mutex ndt_mutex;
+	};
+}
+
+// Same as pcl::GeneralizedIterativeClosestPoint::computeCovariances, but usable
+// without an instance, so that the result can be cached in the measurement.
+// The points are distributed over the given number of threads.
+static void computeCovariances(const PointCloud& cloud, const SearchTree& tree, int k, unsigned threads,
+                               GICPType::MatricesVector& covariances, double epsilon = 0.001)
+{
+	covariances.resize(cloud.size());
+	parallelFor(cloud.size(), threads, [&](size_t begin, size_t end, unsigned chunk)
+	{
+		std::vector<int> nn_indices(k);
+		std::vector<float> nn_dist_sq(k);
+		for(size_t i = begin; i < end; i++)
+		{
+			Eigen::Matrix3d& cov = covariances[i];
+			cov.setZero();
+			Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+			tree.nearestKSearch(cloud[i], k, nn_indices, nn_dist_sq);
+			for(int j = 0; j < k; j++)
+			{
+				Eigen::Vector3d pt = cloud[nn_indices[j]].getVector3fMap().cast<double>();
+				mean += pt;
+				cov += pt * pt.transpose();
+			}
+			mean /= static_cast<double>(k);
+			cov /= static_cast<double>(k);
+			cov -= mean * mean.transpose();
+
+			// Replace the singular values by (1, 1, epsilon), like PCL does
+			Eigen::JacobiSVD<Eigen::Matrix3d> svd(cov, Eigen::ComputeFullU);
+			Eigen::Matrix3d U = svd.matrixU();
+			cov = U * Eigen::Vector3d(1.0, 1.0, epsilon).asDiagonal() * U.transpose();
+		}
+	});
+}
+
+// Same as pcl::Registration::getFitnessScore, but the nearest neighbor
+// search is distributed over the given number of threads.
+static double computeFitnessScore(const PointCloud& cloud, const Eigen::Matrix4f& tf,
+                                  const SearchTree& tree, double max_range, unsigned threads)
+{
+	PointCloud transformed;
+	pcl::transformPointCloud(cloud, transformed, tf);
+
+	unsigned chunks = getNumberOfChunks(transformed.size(), threads);
+	std::vector<double> sums(chunks, 0.0);
+	std::vector<size_t> counts(chunks, 0);
+	parallelFor(transformed.size(), threads, [&](size_t begin, size_t end, unsigned chunk)
+	{
+		std::vector<int> nn_indices(1);
+		std::vector<float> nn_dist_sq(1);
+		for(size_t i = begin; i < end; i++)
+		{
+			// PCL compares the squared distance with max_range
+			tree.nearestKSearch(transformed[i], 1, nn_indices, nn_dist_sq);
+			if(nn_dist_sq[0] <= max_range)
+			{
+				sums[chunk] += nn_dist_sq[0];
+				counts[chunk]++;
+			}
+		}
+	});
+
+	double fitness = 0;
+	size_t count = 0;
+	for(unsigned c = 0; c < chunks; c++)
+	{
+		fitness += sums[c];
+		count += counts[c];
+	}
+	if(count > 0)
+		return fitness / count;
+	return std::numeric_limits<double>::max();
+}
+
+// Enable the internal multithreading of a PCL registration, if the
+// installed version provides it (e.g. GICP since PCL 1.14).
+template <typename Registration>
+static auto setRegistrationThreads(Registration& reg, unsigned threads, int)
+	-> decltype(reg.setNumberOfThreads(threads), void())
 {
-	// Downsample the scans
-	PointCloud::Ptr filtered_source = source->getPointCloud();
-	PointCloud::Ptr filtered_target = target->getPointCloud();
+	reg.setNumberOfThreads(threads);
+}
+
+template <typename Registration>
+static void setRegistrationThreads(Registration& reg, unsigned threads, long)
+{
+}
+
+boost::shared_ptr<PreprocessedCloud> PointCloudSensor::preprocess(const PointCloudMeasurement::Ptr& m,
+                                                                  const RegistrationParameters& config) const
+{
+	PreprocessingKey key;
+	key.algorithm = config.registration_algorithm;
+	key.density = config.point_cloud_density;
+	key.parameter = (config.registration_algorithm == GICP) ? config.correspondence_randomness : config.resolution;
+
+	if(mCacheRegistrationData)
+	{
+		boost::shared_ptr<PreprocessedCloud> cached = m->getPreprocessedCloud(key);
+		if(cached)
+		{
+			touchRegistrationCache(m);
+			return cached;
+		}
+	}
+
+	boost::shared_ptr<PreprocessedCloud> data(new PreprocessedCloud);
 	if(config.point_cloud_density > 0)
+		data->cloud = downsample(m->getPointCloud(), config.point_cloud_density);
+	else
+		data->cloud = m->getPointCloud();
+
+	data->tree.reset(new SearchTree);
+	data->tree->setInputCloud(data->cloud);
+
+	int k = config.correspondence_randomness;
+	if(config.registration_algorithm == GICP && k > 0 && data->cloud->size() >= (size_t)k)
 	{
-		PointCloud::Ptr filtered_source = downsample(source->getPointCloud(), config.point_cloud_density);
-		PointCloud::Ptr filtered_target = downsample(target->getPointCloud(), config.point_cloud_density);
+		data->covariances.reset(new GICPType::MatricesVector);
+		computeCovariances(*data->cloud, *data->tree, k, config.num_threads, *data->covariances);
 	}
+
+	if(mCacheRegistrationData)
+	{
+		data = m->addPreprocessedCloud(key, data);
+		touchRegistrationCache(m);
+	}
+	return data;
+}
+
+void PointCloudSensor::touchRegistrationCache(const PointCloudMeasurement::Ptr& m) const
+{
+	std::vector<PointCloudMeasurement::Ptr> evicted;
+	{
+		std::lock_guard<std::mutex> guard(mRegistrationCacheMutex);
+		std::map<const PointCloudMeasurement*, RegistrationCacheList::iterator>::iterator it = mRegistrationCacheIndex.find(m.get());
+		if(it != mRegistrationCacheIndex.end())
+		{
+			// The address may belong to a measurement that has been deleted
+			if(it->second->second.lock() == m)
+			{
+				mRegistrationCacheOrder.splice(mRegistrationCacheOrder.begin(), mRegistrationCacheOrder, it->second);
+				return;
+			}
+			mRegistrationCacheOrder.erase(it->second);
+			mRegistrationCacheIndex.erase(it);
+		}
+		mRegistrationCacheOrder.push_front(RegistrationCacheEntry(m.get(), m));
+		mRegistrationCacheIndex[m.get()] = mRegistrationCacheOrder.begin();
+
+		while(mRegistrationCacheSize > 0 && mRegistrationCacheOrder.size() > mRegistrationCacheSize)
+		{
+			PointCloudMeasurement::Ptr oldest = mRegistrationCacheOrder.back().second.lock();
+			mRegistrationCacheIndex.erase(mRegistrationCacheOrder.back().first);
+			mRegistrationCacheOrder.pop_back();
+			if(oldest)
+				evicted.push_back(oldest);
+		}
+	}
+
+	// Data that is currently used by a registration is kept alive by its shared pointer
+	for(std::vector<PointCloudMeasurement::Ptr>::iterator e = evicted.begin(); e != evicted.end(); ++e)
+		(*e)->clearPreprocessedClouds();
+}
+
+// Scale all distances with the voxel size of a pyramid level
+static RegistrationParameters scaleConfiguration(const RegistrationParameters& config, double scale)
+{
+	RegistrationParameters scaled = config;
+	scaled.point_cloud_density = config.point_cloud_density * scale;
+	scaled.max_correspondence_distance = config.max_correspondence_distance * scale;
+	scaled.max_fitness_score = config.max_fitness_score * scale * scale;
+	scaled.resolution = config.resolution * scale;
+	return scaled;
+}
+
+void PointCloudSensor::preprocessMeasurement(const Measurement::Ptr& scan)
+{
+	// Without the cache, the data would be created again during registration
+	PointCloudMeasurement::Ptr m = boost::dynamic_pointer_cast<PointCloudMeasurement>(scan);
+	if(!m || !mCacheRegistrationData)
+		return;
+
+	// Same pyramid levels as used by align() for sequential registration
+	const RegistrationParameters& config = mFineConfiguration;
+	unsigned levels = config.pyramid_levels;
+	if(levels < 2 || config.point_cloud_density <= 0)
+		levels = 1;
+	for(unsigned level = levels; level > 0; level--)
+	{
+		preprocess(m, scaleConfiguration(config, std::pow(config.pyramid_factor, level - 1)));
+	}
+}
+
+RegistrationResult PointCloudSensor::align(PointCloudMeasurement::Ptr source,
+                                           PointCloudMeasurement::Ptr target,
+                                           const Transform& guess,
+                                           const RegistrationParameters& config)
+{
+	// Without downsampling there is nothing to build a pyramid from
+	unsigned levels = config.pyramid_levels;
+	if(levels < 2 || config.point_cloud_density <= 0)
+		return alignLevel(source, target, guess, config);
+
+	Transform coarse_guess = guess;
+	double last_fitness = -1;
+	unsigned iterations = 0;
+	for(unsigned level = levels; level > 1; level--)
+	{
+		double scale = std::pow(config.pyramid_factor, level - 1);
+		RegistrationResult coarse;
+		try
+		{
+			coarse = alignLevel(source, target, coarse_guess, scaleConfiguration(config, scale));
+		}catch(NoMatch& e)
+		{
+			mLogger->message(DEBUG, (boost::format("Pyramid level %1% failed: %2%") % level % e.what()).str());
+			continue;
+		}
+		coarse_guess = coarse.transform;
+		iterations += coarse.iterations;
+		
+		// The fitness score grows with the squared point distance, so it
+		// has to be normalized to compare it between levels.
+		double fitness = coarse.fitness / (scale * scale);
+		if(last_fitness >= 0 && std::abs(last_fitness - fitness) <= config.pyramid_epsilon * last_fitness)
+		{
+			mLogger->message(DEBUG, (boost::format("Pyramid converged at level %1%, skipping to level 1.") % level).str());
+			break;
+		}
+		last_fitness = fitness;
+	}
+	
+	// The finest level is always processed, so that the result
+	// is checked against the unscaled fitness threshold.
+	RegistrationResult result = alignLevel(source, target, coarse_guess, config);
+	result.iterations += iterations;
+	return result;
+}
+
+RegistrationResult PointCloudSensor::alignLevel(PointCloudMeasurement::Ptr source,
+                                                PointCloudMeasurement::Ptr target,
+                                                const Transform& guess,
+                                                const RegistrationParameters& config)
+{
+	// Downsample the scans (or get them from the cache)
+	boost::shared_ptr<PreprocessedCloud> filtered_source = preprocess(source, config);
+	boost::shared_ptr<PreprocessedCloud> filtered_target = preprocess(target, config);
 	
 	// Make sure that there are enough points left (ICP will crash if not)
-	if(filtered_target->size() < 100 || filtered_source->size() < 100)
+	if(filtered_target->cloud->size() < 100 || filtered_source->cloud->size() < 100)
 		throw NoMatch("Too few points after filtering, you may have to decrease 'point_cloud_density'.");
 	
 	// Configure Generalized-ICP
 	if(config.registration_algorithm == GICP)
 	{
-		return doICP(filtered_source, filtered_target, guess, config);
+		return doICP(*filtered_source, *filtered_target, guess, config);
 	}else
 	{
-		return doNDT(filtered_source, filtered_target, guess, config);
+		return doNDT(*filtered_source, *filtered_target, guess, config);
 	}
 }
 
-Transform PointCloudSensor::doICP(PointCloud::Ptr source,
-                                  PointCloud::Ptr target,
-                                  const Transform& guess,
-                                  const RegistrationParameters& config)
+RegistrationResult PointCloudSensor::doICP(const PreprocessedCloud& source,
+                                           const PreprocessedCloud& target,
+                                           const Transform& guess,
+                                           const RegistrationParameters& config)
 {
-	pcl::GeneralizedIterativeClosestPoint<PointType, PointType> icp;
+	GICPType icp;
 	icp.setMaxCorrespondenceDistance(config.max_correspondence_distance);
 	icp.setMaximumIterations(config.maximum_iterations);
 	icp.setTransformationEpsilon(config.transformation_epsilon);
@@ -185,6 +562,7 @@ Transform PointCloudSensor::doICP(PointCloud::Ptr source,
 	icp.setCorrespondenceRandomness(config.correspondence_randomness);
 	icp.setMaximumOptimizerIterations(config.maximum_optimizer_iterations);
 	icp.setRotationEpsilon(config.rotation_epsilon);
+	setRegistrationThreads(icp, config.num_threads, 0);
 	
 	PointCloud result;
 
@@ -194,59 +572,82 @@ Transform PointCloudSensor::doICP(PointCloud::Ptr source,
 	// calling align on it.
 	// > https://github.com/PointCloudLibrary/pcl/pull/989
 	PointCloud::Ptr shifted_target(new PointCloud);
-	pcl::transformPointCloud(*target, *shifted_target, guess.matrix());
+	pcl::transformPointCloud(*target.cloud, *shifted_target, guess.matrix());
 	
 	// Source and target are switched at this point!
 	// In the pose graph, our edge (with transform) goes from source to target,
 	// but ICP calculates the transformation from target to source.
 	icp.setInputSource(shifted_target);
-	icp.setInputTarget(source);
+	icp.setInputTarget(source.cloud);
 	icp.align(result);
 #else
-	icp.setInputSource(target);
-	icp.setInputTarget(source);
+	icp.setInputSource(target.cloud);
+	icp.setInputTarget(source.cloud);
+
+	// Use the precomputed search trees and covariances,
+	// this has to happen after setting the input clouds.
+	icp.setSearchMethodSource(target.tree, true);
+	icp.setSearchMethodTarget(source.tree, true);
+	if(target.covariances)
+		icp.setSourceCovariances(target.covariances);
+	if(source.covariances)
+		icp.setTargetCovariances(source.covariances);
 	icp.align(result, guess.matrix().cast<float>());
 #endif
 
 	// Check if ICP was successful (kind of...)
-	double score = icp.getFitnessScore(config.max_correspondence_distance);
+	double score = computeFitnessScore(*icp.getInputSource(), icp.getFinalTransformation(), *source.tree,
+	                                   config.max_correspondence_distance, config.num_threads);
 	if(!icp.hasConverged() || score > config.max_fitness_score)
 	{
 		throw NoMatch((boost::format("ICP failed with Fitness-Score %1% > %2%") % score % config.max_fitness_score).str());
 	}
 	
 	// Get estimated transform
-	Transform icp_result(Eigen::Isometry3f(icp.getFinalTransformation()));
+	RegistrationResult icp_result;
+	icp_result.transform = Transform(Eigen::Isometry3f(icp.getFinalTransformation()));
 #if PCL_VERSION_COMPARE(<, 1, 8, 1)
-	icp_result = icp_result * guess;
+	icp_result.transform = icp_result.transform * guess;
 #endif
+	icp_result.fitness = score;
+	icp_result.iterations = icp.getNumberOfIterations();
 	return icp_result;
 }
 
-Transform PointCloudSensor::doNDT(PointCloud::Ptr source,
-                                  PointCloud::Ptr target,
-                                  const Transform& guess,
-                                  const RegistrationParameters& config)
+RegistrationResult PointCloudSensor::doNDT(PreprocessedCloud& source,
+                                           const PreprocessedCloud& target,
+                                           const Transform& guess,
+                                           const RegistrationParameters& config)
 {
-	pcl::NormalDistributionsTransform<PointType, PointType> ndt;
+	std::lock_guard<std::mutex> guard(source.ndt_mutex);
+	if(!source.ndt)
+	{
+		// Building the grid is the expensive part, so it is kept with the source.
+		source.ndt.reset(new NDTType);
+		source.ndt->setResolution(config.resolution);
+		source.ndt->setInputTarget(source.cloud);
+		source.ndt->setSearchMethodTarget(source.tree, true);
+	}
+	
+	NDTType& ndt = *source.ndt;
 	ndt.setMaxCorrespondenceDistance(config.max_correspondence_distance);
 	ndt.setMaximumIterations(config.maximum_iterations);
 	ndt.setTransformationEpsilon(config.transformation_epsilon);
 	ndt.setEuclideanFitnessEpsilon(config.euclidean_fitness_epsilon);
 	ndt.setOulierRatio(config.outlier_ratio);
 	ndt.setStepSize(config.step_size);
-	ndt.setResolution(config.resolution);
+	setRegistrationThreads(ndt, config.num_threads, 0);
 	
 	// Source and target are switched at this point!
 	// In the pose graph, our edge (with transform) goes from source to target,
 	// but ICP calculates the transformation from target to source.
-	ndt.setInputSource(target);
-	ndt.setInputTarget(source);
+	ndt.setInputSource(target.cloud);
 	PointCloud result;
 	ndt.align(result, guess.matrix().cast<float>());
 
 	// Check if NDT was successful (kind of...)
-	double score = ndt.getFitnessScore(config.max_correspondence_distance);
+	double score = computeFitnessScore(*target.cloud, ndt.getFinalTransformation(), *source.tree,
+	                                   config.max_correspondence_distance, config.num_threads);
 	mLogger->message(DEBUG, (boost::format("NDT: fitness(%1%) probability(%2%) iterations(%3%)")
 		%score % ndt.getTransformationProbability() % ndt.getFinalNumIteration()).str());
 	if(!ndt.hasConverged() || score > config.max_fitness_score)
@@ -255,17 +656,97 @@ Transform PointCloudSensor::doNDT(PointCloud::Ptr source,
 	}
 	
 	// Get estimated transform
-	Eigen::Isometry3f tf_matrix(ndt.getFinalTransformation());
-	return Transform(tf_matrix);
+	RegistrationResult ndt_result;
+	ndt_result.transform = Transform(Eigen::Isometry3f(ndt.getFinalTransformation()));
+	ndt_result.fitness = score;
+	ndt_result.iterations = ndt.getFinalNumIteration();
+	return ndt_result;
+}
+
+unsigned PointCloudSensor::updateVoxelMap(IncrementalMap& map, const VertexObjectList& vertices) const
+{
+	std::set<IdType> current;
+	unsigned changed = 0;
+	for(VertexObjectList::const_iterator v = vertices.begin(); v != vertices.end(); ++v)
+	{
+		PointCloudMeasurement::Ptr pcl = boost::dynamic_pointer_cast<PointCloudMeasurement>(v->measurement);
+		if(!pcl)
+		{
+			mLogger->message(ERROR, "Measurement in buildMap() is not a point cloud!");
+			throw BadMeasurementType();
+		}
+		Transform pose = v->corrected_pose * pcl->getSensorPose();
+		if(map.hasContribution(v->index))
+		{
+			// The map keeps its own copy, so the payload is not accessed
+			if(map.setPose(v->index, pose))
+				changed++;
+		}else
+		{
+			CompactPointCloud::ConstPtr compact = pcl->getCompactPointCloud();
+			if(compact)
+				map.setContribution(v->index, compact, pose);
+			else
+				map.setContribution(v->index, *pcl->getPointCloud(), pose);
+			changed++;
+		}
+		current.insert(v->index);
+	}
+	
+	std::vector<IdType> contributors = map.getContributors();
+	for(std::vector<IdType>::iterator c = contributors.begin(); c != contributors.end(); ++c)
+	{
+		if(current.find(*c) == current.end())
+			map.removeContribution(*c);
+	}
+	return changed;
 }
 
 PointCloud::Ptr PointCloudSensor::buildMap(const VertexObjectList& vertices) const
 {
+	std::unique_lock<std::mutex> guard(mIncrementalMapMutex);
+	if(mIncrementalMap)
+	{
+		unsigned changed = updateVoxelMap(*mIncrementalMap, vertices);
+		mLogger->message(DEBUG, (boost::format("Updated %1% of %2% vertices in incremental map.") % changed % vertices.size()).str());
+		return mIncrementalMap->getCloud(mMapMinPoints);
+	}
+	guard.unlock();
+	
 	PointCloud::Ptr accu = getAccumulatedCloud(vertices);
 	PointCloud::Ptr cleaned = removeOutliers(accu, mMapOutlierRadius, mMapOutlierNeighbors);
 	return downsample(cleaned, mMapResolution);
 }
 
+MapTileList PointCloudSensor::buildTiledMap(const VertexObjectList& vertices, bool changed_only) const
+{
+	std::lock_guard<std::mutex> guard(mIncrementalMapMutex);
+	if(!mTiledMap)
+		mTiledMap.reset(new IncrementalMap(mMapResolution, mMapTileSize));
+	
+	unsigned changed = updateVoxelMap(*mTiledMap, vertices);
+	std::vector<TileKey> keys = mTiledMap->takeChangedTiles();
+	if(!changed_only)
+		keys = mTiledMap->getTiles();
+	
+	MapTileList tiles(keys.size());
+	for(size_t i = 0; i < keys.size(); i++)
+	{
+		tiles[i].key = keys[i];
+		tiles[i].cloud = mTiledMap->getTile(keys[i], mMapMinPoints);
+		tiles[i].contributors = mTiledMap->getTileContributors(keys[i]);
+	}
+	mLogger->message(DEBUG, (boost::format("Updated %1% of %2% vertices in tiled map, %3% tiles returned.")
+		% changed % vertices.size() % tiles.size()).str());
+	return tiles;
+}
+
+RegistrationResult PointCloudSensor::getLastRegistrationResult() const
+{
+	std::lock_guard<std::mutex> guard(mLastRegistrationMutex);
+	return mLastRegistrationResult;
+}
+
 void PointCloudSensor::setRegistrationParameters(const RegistrationParameters& conf, bool coarse)
 {
 	if(coarse)
@@ -283,7 +764,11 @@ void PointCloudSensor::setRegistrationParameters(const RegistrationParameters& c
 	mLogger->message(INFO, (boost::format("max_fitness_score:            %1%") % conf.max_fitness_score).str());
 	mLogger->message(INFO, (boost::format("maximum_iterations:           %1%") % conf.maximum_iterations).str());
 	mLogger->message(INFO, (boost::format("maximum_optimizer_iterations: %1%") % conf.maximum_optimizer_iterations).str());
+	mLogger->message(INFO, (boost::format("num_threads:                  %1%") % conf.num_threads).str());
 	mLogger->message(INFO, (boost::format("point_cloud_density:          %1%") % conf.point_cloud_density).str());
+	mLogger->message(INFO, (boost::format("pyramid_levels:               %1%") % conf.pyramid_levels).str());
+	mLogger->message(INFO, (boost::format("pyramid_factor:               %1%") % conf.pyramid_factor).str());
+	mLogger->message(INFO, (boost::format("pyramid_epsilon:              %1%") % conf.pyramid_epsilon).str());
 	mLogger->message(INFO, (boost::format("rotation_epsilon:             %1%") % conf.rotation_epsilon).str());
 	mLogger->message(INFO, (boost::format("transformation_epsilon:       %1%") % conf.transformation_epsilon).str());
 }
@@ -292,6 +777,11 @@ void PointCloudSensor::setMapResolution(double r)
 {
 	mLogger->message(INFO, (boost::format("map_resolution:         %1%") % r).str());
 	mMapResolution = r;
+	
+	std::lock_guard<std::mutex> guard(mIncrementalMapMutex);
+	if(mIncrementalMap)
+		mIncrementalMap.reset(new IncrementalMap(mMapResolution));
+	mTiledMap.reset();
 }
 
 void PointCloudSensor::setMapOutlierRemoval(double r, unsigned n)
@@ -302,7 +792,239 @@ void PointCloudSensor::setMapOutlierRemoval(double r, unsigned n)
 	mMapOutlierNeighbors = n;
 }
 
-void PointCloudSensor::fillGroundPlane(PointCloud::Ptr cloud, ScalarType radius)
+void PointCloudSensor::setCacheRegistrationData(bool c)
+{
+	mLogger->message(INFO, (boost::format("cache_registration_data: %1%") % c).str());
+	mCacheRegistrationData = c;
+}
+
+void PointCloudSensor::setRegistrationCacheSize(unsigned n)
+{
+	mLogger->message(INFO, (boost::format("registration_cache_size: %1%") % n).str());
+	std::lock_guard<std::mutex> guard(mRegistrationCacheMutex);
+	mRegistrationCacheSize = n;
+}
+
+void PointCloudSensor::setNumberOfThreads(unsigned n)
+{
+	mLogger->message(INFO, (boost::format("number_of_threads:      %1%") % n).str());
+	mNumberOfThreads = n;
+}
+
+void PointCloudSensor::setCompactStorage(bool c)
+{
+	mLogger->message(INFO, (boost::format("compact_storage:        %1%") % c).str());
+	mCompactStorage = c;
+}
+
+void PointCloudSensor::setPlaceRecognition(bool enable, float max_distance, unsigned candidates)
+{
+	mLogger->message(INFO, (boost::format("place_recognition:      %1%") % enable).str());
+	mLogger->message(INFO, (boost::format("place_max_distance:     %1%") % max_distance).str());
+	mLogger->message(INFO, (boost::format("place_candidates:       %1%") % candidates).str());
+	if(enable && !mPlaceDatabase)
+		mPlaceDatabase.reset(new ScanContextDatabase);
+	else if(!enable)
+		mPlaceDatabase.reset();
+	mPlaceMaxDistance = max_distance;
+	mPlaceCandidates = candidates;
+}
+
+ScanContext::ConstPtr PointCloudSensor::createDescriptor(const PointCloudMeasurement::Ptr& m) const
+{
+	PointCloud::Ptr cloud = transform(m->getPointCloud(), m->getSensorPose());
+	return ScanContext::ConstPtr(new ScanContext(*cloud));
+}
+
+void PointCloudSensor::vertexAdded(IdType vertex)
+{
+	Graph* graph = mMapper->getGraph();
+	PointCloudMeasurement::Ptr m = boost::dynamic_pointer_cast<PointCloudMeasurement>(graph->getVertex(vertex).measurement);
+	if(!m)
+		return;
+
+	// With patches, the previous vertex is not registered directly anymore
+	if(mLastCachedVertex && getPatchBuildingRange() > 0)
+	{
+		PointCloudMeasurement::Ptr previous = boost::dynamic_pointer_cast<PointCloudMeasurement>(graph->getVertex(mLastCachedVertex).measurement);
+		if(previous)
+			previous->clearPreprocessedClouds();
+	}
+	mLastCachedVertex = vertex;
+
+	if(mPlaceDatabase)
+		mPlaceDatabase->add(vertex, createDescriptor(m));
+	if(mCompactStorage)
+		m->compact();
+}
+
+void PointCloudSensor::rankLoopCandidates(IdType vertex, std::vector<IdType>& candidates)
+{
+	if(!mPlaceDatabase)
+		return;
+	ScanContext::ConstPtr descriptor = mPlaceDatabase->get(vertex);
+	if(!descriptor)
+		return;
+
+	// Drop candidates that do not look like the same place
+	std::vector< std::pair<float, IdType> > ranked;
+	for(std::vector<IdType>::iterator c = candidates.begin(); c != candidates.end(); ++c)
+	{
+		ScanContext::ConstPtr other = mPlaceDatabase->get(*c);
+		float distance = other ? other->distance(*descriptor) : mPlaceMaxDistance;
+		if(distance > mPlaceMaxDistance)
+		{
+			mLogger->message(DEBUG, (boost::format("Rejected loop candidate %1% with descriptor distance %2%.") % *c % distance).str());
+			continue;
+		}
+		ranked.push_back(std::make_pair(distance, *c));
+	}
+
+	// Propose similar places that were not found by the neighbor search
+	std::vector<PlaceMatch> matches = mPlaceDatabase->query(*descriptor, mPlaceMaxDistance);
+	std::map<IdType, ScalarType> yaws;
+	for(std::vector<PlaceMatch>::iterator m = matches.begin(); m != matches.end() && yaws.size() < mPlaceCandidates; ++m)
+	{
+		if(std::find(candidates.begin(), candidates.end(), m->id) != candidates.end())
+			continue;
+		try
+		{
+			if(!isLoopCandidate(vertex, m->id))
+				continue;
+		}catch(InvalidVertex &e)
+		{
+			mLogger->message(ERROR, e.what());
+			continue;
+		}
+		ranked.push_back(std::make_pair(m->distance, m->id));
+		yaws[m->id] = m->yaw;
+	}
+	{
+		std::lock_guard<std::mutex> guard(mProposedMutex);
+		mProposedVertex = vertex;
+		mProposedYaws.swap(yaws);
+	}
+
+	std::stable_sort(ranked.begin(), ranked.end(),
+		[](const std::pair<float, IdType>& a, const std::pair<float, IdType>& b){ return a.first < b.first; });
+	candidates.clear();
+	for(std::vector< std::pair<float, IdType> >::iterator r = ranked.begin(); r != ranked.end(); ++r)
+		candidates.push_back(r->second);
+}
+
+Transform PointCloudSensor::getLoopGuess(IdType candidate, IdType vertex)
+{
+	{
+		std::lock_guard<std::mutex> guard(mProposedMutex);
+		std::map<IdType, ScalarType>::iterator yaw = mProposedYaws.find(candidate);
+		if(vertex == mProposedVertex && yaw != mProposedYaws.end())
+			return Transform(Eigen::AngleAxis<ScalarType>(yaw->second, Eigen::Vector3d::UnitZ()));
+	}
+	return ScanSensor::getLoopGuess(candidate, vertex);
+}
+
+Transform PointCloudSensor::relocalize(const PointCloudMeasurement::Ptr& m, IdType& vertex)
+{
+	if(!mPlaceDatabase)
+		throw NoMatch("Place recognition is not enabled.");
+
+	std::vector<PlaceMatch> matches = mPlaceDatabase->query(*createDescriptor(m), mPlaceMaxDistance);
+	unsigned attempts = 0;
+	for(std::vector<PlaceMatch>::iterator match = matches.begin(); match != matches.end() && attempts < mPlaceCandidates; ++match, ++attempts)
+	{
+		Transform guess(Eigen::AngleAxis<ScalarType>(match->yaw, Eigen::Vector3d::UnitZ()));
+		try
+		{
+			Constraint::Ptr c = createConstraint(buildPatch(match->id), m, guess, true);
+			SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<SE3Constraint>(c);
+			vertex = match->id;
+			return mMapper->getGraph()->getVertex(vertex).corrected_pose * se3->getRelativePose().transform;
+		}catch(NoMatch &e)
+		{
+			mLogger->message(DEBUG, (boost::format("Relocalization at vertex %1% failed: %2%") % match->id % e.what()).str());
+		}
+	}
+	throw NoMatch((boost::format("Relocalization failed, tried %1% of %2% similar places.") % attempts % matches.size()).str());
+}
+
+Measurement::Ptr PointCloudSensor::updateLocalMap(const VertexObjectList& keyframes)
+{
+	double resolution = mFineConfiguration.point_cloud_density;
+	if(resolution <= 0)
+		resolution = mMapResolution;
+	if(!mLocalVoxelMap || mLocalVoxelMap->getResolution() != resolution)
+	{
+		mLocalVoxelMap.reset(new IncrementalMap(resolution));
+		mLocalMapCloud.reset();
+	}
+
+	std::set<IdType> current;
+	bool changed = false;
+	for(VertexObjectList::const_iterator k = keyframes.begin(); k != keyframes.end(); ++k)
+	{
+		PointCloudMeasurement::Ptr pcl = boost::dynamic_pointer_cast<PointCloudMeasurement>(k->measurement);
+		if(!pcl)
+		{
+			mLogger->message(ERROR, "Measurement in updateLocalMap() is not a point cloud!");
+			throw BadMeasurementType();
+		}
+		Transform pose = k->corrected_pose * pcl->getSensorPose();
+		if(mLocalVoxelMap->hasContribution(k->index))
+		{
+			if(mLocalVoxelMap->setPose(k->index, pose))
+				changed = true;
+		}else
+		{
+			CompactPointCloud::ConstPtr compact = pcl->getCompactPointCloud();
+			if(compact)
+				mLocalVoxelMap->setContribution(k->index, compact, pose);
+			else
+				mLocalVoxelMap->setContribution(k->index, *pcl->getPointCloud(), pose);
+			changed = true;
+		}
+		current.insert(k->index);
+	}
+
+	std::vector<IdType> contributors = mLocalVoxelMap->getContributors();
+	for(std::vector<IdType>::iterator c = contributors.begin(); c != contributors.end(); ++c)
+	{
+		if(current.find(*c) == current.end())
+		{
+			mLocalVoxelMap->removeContribution(*c);
+			changed = true;
+		}
+	}
+
+	if(changed || !mLocalMapCloud)
+	{
+		mLocalMapCloud.reset(new PointCloudMeasurement(mLocalVoxelMap->getCloud(), "LocalMap", mName, Transform::Identity()));
+		mLogger->message(DEBUG, (boost::format("Local map has %1% points from %2% keyframes.")
+			% mLocalVoxelMap->getNumberOfVoxels() % keyframes.size()).str());
+	}
+	return mLocalMapCloud;
+}
+
+void PointCloudSensor::setIncrementalMapping(bool enable, unsigned min_points)
+{
+	mLogger->message(INFO, (boost::format("incremental_mapping:    %1%") % enable).str());
+	mLogger->message(INFO, (boost::format("map_min_points:         %1%") % min_points).str());
+	std::lock_guard<std::mutex> guard(mIncrementalMapMutex);
+	if(enable && !mIncrementalMap)
+		mIncrementalMap.reset(new IncrementalMap(mMapResolution));
+	else if(!enable)
+		mIncrementalMap.reset();
+	mMapMinPoints = min_points;
+}
+
+void PointCloudSensor::setMapTileSize(double size)
+{
+	mLogger->message(INFO, (boost::format("map_tile_size:          %1%") % size).str());
+	std::lock_guard<std::mutex> guard(mIncrementalMapMutex);
+	mMapTileSize = size;
+	mTiledMap.reset();
+}
+
+void PointCloudSensor::fillGroundPlane(PointCloud::Ptr cloud, ScalarType radius, bool skip_covered)
 {
 	pcl::SampleConsensusModelPlane<PointType>::Ptr
 		model(new pcl::SampleConsensusModelPlane<PointType>(cloud));
@@ -312,20 +1034,60 @@ void PointCloudSensor::fillGroundPlane(PointCloud::Ptr cloud, ScalarType radius)
 
 	Eigen::VectorXf c;
 	ransac.getModelCoefficients(c);
-	Direction normal(c[0], c[1], c[2]);
+	Direction normal = Direction(c[0], c[1], c[2]).normalized();
 	Eigen::Hyperplane<ScalarType, 3> plane(normal, c[3]);
+
+	// The same angles are used on every ring
 	double angle_inc = mMapResolution / radius;
+	std::vector<float> cos_table, sin_table;
+	for(ScalarType angle = 0; angle < 2*PI; angle += angle_inc)
+	{
+		cos_table.push_back(std::cos(angle));
+		sin_table.push_back(std::sin(angle));
+	}
+
+	// Voxels that already contain points of the cloud
+	const float inverse_res = 1.0f / mMapResolution;
+	const Eigen::Array4f inverse(inverse_res, inverse_res, inverse_res, 0.0f);
+	std::unordered_set<VoxelKey, VoxelKeyHash> covered;
+	if(skip_covered)
+	{
+		covered.reserve(cloud->size());
+		for(PointCloud::const_iterator p = cloud->begin(); p != cloud->end(); ++p)
+		{
+			VoxelKey key;
+			if(getVoxelKey(p->x, p->y, p->z, inverse, key))
+				covered.insert(key);
+		}
+	}
+
+	unsigned rings = 0;
+	for(ScalarType r = mMapResolution; r <= radius; r += mMapResolution)
+		rings++;
+	cloud->points.reserve(cloud->size() + rings * cos_table.size());
+
 	for(ScalarType r = mMapResolution; r <= radius; r += mMapResolution)
 	{
+		// Rotating the sample about the normal (Rodrigues' formula) gives
+		// center + cos(angle) * radial + sin(angle) * tangential
 		Position sample = plane.projection(Position(r,0,0));
-		for(ScalarType angle = 0; angle < 2*PI; angle += angle_inc)
+		Position center = normal * normal.dot(sample);
+		Eigen::Vector4f origin(center[0], center[1], center[2], 1.0f);
+		Eigen::Vector4f radial;
+		radial << (sample - center).cast<float>(), 0.0f;
+		Eigen::Vector4f tangential;
+		tangential << normal.cross(sample).cast<float>(), 0.0f;
+
+		for(size_t a = 0; a < cos_table.size(); a++)
 		{
-			Position rot = Eigen::AngleAxis<ScalarType>(angle, normal).toRotationMatrix() * sample;
 			PointType p;
-			p.x = rot[0];
-			p.y = rot[1];
-			p.z = rot[2];
-			cloud->push_back(p);
+			p.getVector4fMap() = origin + cos_table[a] * radial + sin_table[a] * tangential;
+			VoxelKey key;
+			if(skip_covered && getVoxelKey(p.x, p.y, p.z, inverse, key) && covered.count(key))
+				continue;
+			cloud->points.push_back(p);
 		}
 	}
+	cloud->width = cloud->points.size();
+	cloud->height = 1;
 }
@@ -27,22 +27,65 @@
 #define SLAM_POINTCLOUDSENSOR_HPP
 
 #include <slam3d/sensor/pcl/RegistrationParameters.hpp>
+#include <slam3d/sensor/pcl/Filters.hpp>
+#include <slam3d/sensor/pcl/CompactPointCloud.hpp>
+#include <slam3d/sensor/pcl/IncrementalMap.hpp>
+#include <slam3d/sensor/pcl/ScanContext.hpp>
 
 #include <slam3d/core/Graph.hpp>
 #include <slam3d/core/ScanSensor.hpp>
 #include <slam3d/core/PoseSensor.hpp>
 
-#include <pcl/point_types.h>
-#include <pcl/point_cloud.h>
+#include <boost/weak_ptr.hpp>
+
+#include <list>
+#include <map>
+#include <mutex>
 
 namespace slam3d
 {
-	typedef pcl::PointXYZ PointType;
-	typedef pcl::PointCloud<PointType> PointCloud;
-	
+	/**
+	 * @struct PreprocessingKey
+	 * @brief Identifies the preprocessing applied to a point cloud before registration.
+	 */
+	struct PreprocessingKey
+	{
+		RegistrationAlgorithm algorithm;
+		double density;   // point_cloud_density
+		double parameter; // correspondence_randomness (GICP) or resolution (NDT)
+
+		bool operator<(const PreprocessingKey& other) const
+		{
+			if(algorithm != other.algorithm) return algorithm < other.algorithm;
+			if(density != other.density) return density < other.density;
+			return parameter < other.parameter;
+		}
+	};
+
+	/**
+	 * @struct RegistrationResult
+	 * @brief Outcome of a successful point cloud registration.
+	 */
+	struct RegistrationResult
+	{
+		Transform transform; // estimated transform in sensor frame
+		double fitness;      // mean squared distance of corresponding points
+		unsigned iterations; // iterations of the registration algorithm
+	};
+
+	/**
+	 * @struct PreprocessedCloud
+	 * @brief Registration data derived from a point cloud (downsampled cloud, search tree etc.).
+	 * @details The content is only known to the PointCloudSensor.
+	 */
+	struct PreprocessedCloud;
+
 	/**
 	 * @class PointCloudMeasurement
 	 * @brief Specific Measurement of the PointCloudSensor. 
+	 * @details Besides the point cloud, each measurement holds a cache for the
+	 * data that is derived from it during registration, so that it does not
+	 * have to be recomputed each time the measurement is registered again.
 	 */
 	class PointCloudMeasurement : public Measurement
 	{
@@ -72,12 +115,121 @@ namespace slam3d
 		
 		/**
 		 * @brief Gets the point cloud contained within this measurement.
+		 * @details If the measurement has been compacted, a new cloud is
+		 * decoded on each call.
 		 * @return Constant shared pointer to the point cloud
 		 */
-		const PointCloud::Ptr getPointCloud() const {return mPointCloud;}
+		const PointCloud::Ptr getPointCloud() const
+		{
+			std::unique_lock<std::mutex> guard = lockPayload();
+			if(mPointCloud)
+				return mPointCloud;
+			return mCompactCloud->decode();
+		}
+		
+		/**
+		 * @brief Replace the point cloud by a quantized copy to save memory.
+		 * @details See CompactPointCloud for the loss of precision.
+		 */
+		void compact()
+		{
+			{
+				std::unique_lock<std::mutex> guard = lockPayload();
+				if(!mPointCloud)
+					return;
+				mCompactCloud.reset(new CompactPointCloud(*mPointCloud));
+				mPointCloud.reset();
+			}
+			payloadChanged();
+		}
+		
+		/**
+		 * @brief Whether the point cloud is stored in compact form.
+		 */
+		bool isCompact() const
+		{
+			std::unique_lock<std::mutex> guard = lockPayload();
+			return !mPointCloud;
+		}
+		
+		/**
+		 * @brief Gets the compact point cloud if the measurement has been compacted.
+		 * @return shared pointer to the compact cloud or an empty pointer
+		 */
+		CompactPointCloud::ConstPtr getCompactPointCloud() const
+		{
+			std::unique_lock<std::mutex> guard = lockPayload();
+			return mCompactCloud;
+		}
+		
+		bool writePayload(std::vector<char>& buffer) const;
+		void readPayload(const char* data, size_t size);
+		void releasePayload();
+		size_t getPayloadSize() const;
+		
+		/**
+		 * @brief Get registration data that has been cached for the given key.
+		 * @param key identifies the applied preprocessing
+		 * @return cached data or an empty pointer
+		 */
+		boost::shared_ptr<PreprocessedCloud> getPreprocessedCloud(const PreprocessingKey& key) const
+		{
+			std::lock_guard<std::mutex> guard(mCacheMutex);
+			std::map<PreprocessingKey, boost::shared_ptr<PreprocessedCloud> >::const_iterator it = mCache.find(key);
+			if(it == mCache.end())
+				return boost::shared_ptr<PreprocessedCloud>();
+			return it->second;
+		}
+		
+		/**
+		 * @brief Add registration data to the cache.
+		 * @details If data for this key has been added in the meantime, e.g. by
+		 * another thread, the given data is discarded.
+		 * @param key identifies the applied preprocessing
+		 * @param data registration data to be cached
+		 * @return data that is stored in the cache for the given key
+		 */
+		boost::shared_ptr<PreprocessedCloud> addPreprocessedCloud(const PreprocessingKey& key,
+		                                                          const boost::shared_ptr<PreprocessedCloud>& data) const
+		{
+			std::lock_guard<std::mutex> guard(mCacheMutex);
+			return mCache.insert(std::make_pair(key, data)).first->second;
+		}
+		
+		/**
+		 * @brief Remove all cached registration data to free memory.
+		 */
+		void clearPreprocessedClouds() const
+		{
+			std::lock_guard<std::mutex> guard(mCacheMutex);
+			mCache.clear();
+		}
+		
+	protected:
+		/**
+		 * @brief Lock the cloud mutex while the payload is in memory.
+		 */
+		std::unique_lock<std::mutex> lockPayload() const
+		{
+			accessPayload();
+			std::unique_lock<std::mutex> guard(mCloudMutex);
+			while(mStore && !mPointCloud && !mCompactCloud)
+			{
+				// Paged out again by another thread
+				guard.unlock();
+				accessPayload();
+				guard.lock();
+			}
+			return guard;
+		}
 		
 	protected:
 		PointCloud::Ptr mPointCloud;
+		CompactPointCloud::ConstPtr mCompactCloud;
+		mutable std::mutex mCloudMutex;
+		
+		mutable std::mutex mCacheMutex;
+		mutable std::map<PreprocessingKey, boost::shared_ptr<PreprocessedCloud> > mCache;
 	};
 
 	/**
@@ -142,6 +294,89 @@ namespace slam3d
 		 */
 		void setMapOutlierRemoval(double r, unsigned n);
 		
+		/**
+		 * @brief Set whether to keep registration data within the measurements.
+		 * @details If enabled (default), the downsampled clouds, search trees,
+		 * GICP covariances and NDT grids are kept in each PointCloudMeasurement,
+		 * so that preprocessing is done only once per measurement and parameter set.
+		 * This trades memory for processing time. See setRegistrationCacheSize()
+		 * for how much data is kept.
+		 * @param c
+		 */
+		void setCacheRegistrationData(bool c);
+		
+		/**
+		 * @brief Set the number of measurements that keep their registration data.
+		 * @details When a measurement is registered and the limit is exceeded,
+		 * the data of the least recently registered measurement is released.
+		 * Independent of this limit, a vertex releases its data when it is
+		 * replaced as the source of sequential registration and loop closures
+		 * are registered against patches (see setPatchBuildingRange).
+		 * @param n maximum number of measurements, 0 for no limit
+		 */
+		void setRegistrationCacheSize(unsigned n);
+		
+		/**
+		 * @brief Set the number of threads used for filtering and accumulating point clouds.
+		 * @param n number of threads, 0 uses the number of cores
+		 */
+		void setNumberOfThreads(unsigned n);
+		
+		/**
+		 * @brief Set whether to maintain the map incrementally in buildMap().
+		 * @details If enabled, buildMap() keeps a persistent voxel map, adds
+		 * new vertices to it and re-poses only those vertices whose pose has
+		 * changed since the last call. The radius outlier removal is not applied
+		 * in this mode, instead voxels with less than min_points points are omitted.
+		 * @param enable
+		 * @param min_points
+		 */
+		void setIncrementalMapping(bool enable, unsigned min_points = 1);
+		
+		/**
+		 * @brief Set the edge length of the tiles created by buildTiledMap().
+		 * @details The size is rounded to a multiple of the map resolution.
+		 * Changing it discards the current tiled map.
+		 * @param size in meters
+		 */
+		void setMapTileSize(double size);
+		
+		/**
+		 * @brief Set whether to store measurements in compact form.
+		 * @details If enabled, the point cloud of each measurement is quantized
+		 * to 16 bit per coordinate after it has been added to the graph.
+		 * @param c
+		 */
+		void setCompactStorage(bool c);
+		
+		/**
+		 * @brief Set whether to use place recognition for loop closures.
+		 * @details If enabled, a ScanContext descriptor of each new vertex is
+		 * stored in a database. Loop candidates from the neighbor search are
+		 * ranked by descriptor distance and dropped if it exceeds max_distance,
+		 * before any registration is attempted. Additionally, up to the given
+		 * number of the most similar places are proposed as candidates, even if
+		 * they are outside of the neighbor radius. As the graph may have drifted
+		 * between them, these are registered with the yaw from the descriptor
+		 * as initial guess. The database is also used by relocalize().
+		 * @param enable
+		 * @param max_distance maximum descriptor distance (0 to 1) of a candidate
+		 * @param candidates number of candidates proposed from the database
+		 */
+		void setPlaceRecognition(bool enable, float max_distance = 0.4, unsigned candidates = 3);
+		
+		/**
+		 * @brief Find the pose of a measurement within the existing map.
+		 * @details Queries the place recognition database and registers the
+		 * measurement against the patches of the most similar vertices, using
+		 * the yaw from the descriptor as initial guess.
+		 * @param m
+		 * @param vertex receives the vertex that the measurement was matched with
+		 * @return pose of the measurement in the map frame
+		 * @throw NoMatch
+		 */
+		Transform relocalize(const PointCloudMeasurement::Ptr& m, IdType& vertex);
+				
 		/**
 		 * @brief Reduces the size of the source cloud by sampling with the given resolution.
 		 * @param source
@@ -159,6 +394,7 @@ namespace slam3d
 		/**
 		 * @brief Removes outliers from given pointcloud.
 		 * @details A point is considered an outlier if it has less then min_neighbors within radius.
+		 * See radiusOutlierFilter() for details.
 		 * @param source
 		 * @param radius
 		 * @param min_neighbors
@@ -168,47 +404,183 @@ namespace slam3d
 		/**
 		 * @brief Creates a single point cloud that contains all measurements in vertices.
 		 * @details The individual point clouds are transformed by their current pose in the graph,
-		 * no additional alignement or optimization is performed during this.
+		 * no additional alignement or optimization is performed during this. The output is
+		 * allocated once and each point is transformed directly into the origin frame,
+		 * the vertices are distributed over the configured number of threads.
 		 * @param vertices
+		 * @param origin frame of the accumulated pointcloud
 		 * @return accumulated pointcloud
 		 * @throw BadMeasurementType
 		 */
-		PointCloud::Ptr getAccumulatedCloud(const VertexObjectList& vertices) const;
+		PointCloud::Ptr getAccumulatedCloud(const VertexObjectList& vertices,
+		                                    const Transform& origin = Transform::Identity()) const;
 		
 		/**
 		 * @brief Build an accumulated point cloud map from given vertices.
+		 * @details With incremental mapping enabled, vertices that are not
+		 * given anymore are removed from the map.
 		 * @param vertices
 		 */
 		PointCloud::Ptr buildMap(const VertexObjectList& vertices) const;
 		
+		/**
+		 * @brief Build the map from given vertices as a set of fixed-size tiles.
+		 * @details A persistent tiled voxel map is kept between calls. Only
+		 * vertices that are new or whose pose has changed are re-posed, and
+		 * only the tiles touched by them are rebuilt. Each tile lists the
+		 * vertices that contributed points to it. Voxels with less than the
+		 * minimum points set in setIncrementalMapping() are omitted.
+		 * @param vertices
+		 * @param changed_only return only tiles changed since the last call,
+		 * tiles that have been removed are returned with an empty cloud
+		 */
+		MapTileList buildTiledMap(const VertexObjectList& vertices, bool changed_only = true) const;
+		
 		/**
 		 * @brief Fill ground plane around center.
 		 * @details Estimates a ground plane within the given cloud using RANSAC 
 		 * and fills this plane with additional points within radius around the
 		 * origin. If no ground plane exists in the scan, the result is
 		 * undefined, e.g. RANSAC will just return any plane in the scan.
+		 * The points are placed on rings with a distance of the map resolution.
 		 * @param cloud
 		 * @param radius
+		 * @param skip_covered do not add points to map voxels that already contain points
 		 */
-		void fillGroundPlane(PointCloud::Ptr cloud, ScalarType radius);
+		void fillGroundPlane(PointCloud::Ptr cloud, ScalarType radius, bool skip_covered = false);
+		
+		/**
+		 * @brief Get the result of the last successful registration.
+		 * @details If constraints are created by multiple threads, this is
+		 * the result of the registration that finished last.
+		 */
+		RegistrationResult getLastRegistrationResult() const;
 	
 	protected:
-		Transform align(PointCloudMeasurement::Ptr source, PointCloudMeasurement::Ptr target,
-		                const Transform& guess, const RegistrationParameters& config);
+		/**
+		 * @brief Get the registration data of a measurement for the given configuration.
+		 * @details The data is taken from the measurement's cache if available,
+		 * otherwise it is created (and cached if enabled).
+		 * @param m
+		 * @param config
+		 */
+		boost::shared_ptr<PreprocessedCloud> preprocess(const PointCloudMeasurement::Ptr& m,
+		                                                const RegistrationParameters& config) const;
 
-		Transform doICP(PointCloud::Ptr source, PointCloud::Ptr target,
-		                const Transform& guess, const RegistrationParameters& config);
+		/**
+		 * @brief Register target to source, starting at the given guess.
+		 * @details If the configuration has more than one pyramid level, the
+		 * clouds are first registered at coarser densities and each result is
+		 * used as guess for the next finer level. When the fitness converges
+		 * (see RegistrationParameters::pyramid_epsilon), the remaining coarse
+		 * levels are skipped. Failures on coarse levels are ignored, the finest
+		 * level with the unscaled configuration is always processed and has to
+		 * succeed.
+		 * @param source
+		 * @param target
+		 * @param guess
+		 * @param config
+		 * @throw NoMatch
+		 */
+		RegistrationResult align(PointCloudMeasurement::Ptr source, PointCloudMeasurement::Ptr target,
+		                         const Transform& guess, const RegistrationParameters& config);
+
+		RegistrationResult alignLevel(PointCloudMeasurement::Ptr source, PointCloudMeasurement::Ptr target,
+		                              const Transform& guess, const RegistrationParameters& config);
+
+		RegistrationResult doICP(const PreprocessedCloud& source, const PreprocessedCloud& target,
+		                         const Transform& guess, const RegistrationParameters& config);
+
+		RegistrationResult doNDT(PreprocessedCloud& source, const PreprocessedCloud& target,
+		                         const Transform& guess, const RegistrationParameters& config);
+
+		virtual void vertexAdded(IdType vertex);
+
+		/**
+		 * @brief Mark the registration data of a measurement as recently used.
+		 * @details Releases the data of the least recently used measurements
+		 * if the cache size is exceeded.
+		 * @param m
+		 */
+		void touchRegistrationCache(const PointCloudMeasurement::Ptr& m) const;
+
+		/**
+		 * @brief Compute and cache the registration data of all pyramid levels.
+		 * @details Registration in the pipeline then only uses the cached data,
+		 * so it does not depend on whether the previous scan has already been
+		 * compacted by the mapping stage.
+		 */
+		virtual void preprocessMeasurement(const Measurement::Ptr& scan);
+
+		/**
+		 * @brief Move the given vertices to their current pose in a voxel map
+		 * and remove all other contributions from it.
+		 * @param map
+		 * @param vertices
+		 * @return number of vertices that have been added or re-posed
+		 */
+		unsigned updateVoxelMap(IncrementalMap& map, const VertexObjectList& vertices) const;
+
+		virtual void rankLoopCandidates(IdType vertex, std::vector<IdType>& candidates);
+		virtual Transform getLoopGuess(IdType candidate, IdType vertex);
 
-		Transform doNDT(PointCloud::Ptr source, PointCloud::Ptr target,
-		                const Transform& guess, const RegistrationParameters& config);
+		/**
+		 * @brief Compute the place recognition descriptor of a measurement in robot frame.
+		 * @param m
+		 */
+		ScanContext::ConstPtr createDescriptor(const PointCloudMeasurement::Ptr& m) const;
+
+		/**
+		 * @brief Update the voxel map of the keyframes used for odometry.
+		 * @details The keyframes are added to or removed from a persistent
+		 * IncrementalMap with the density of the fine registration (or the
+		 * map resolution, if no downsampling is used). A new measurement is
+		 * only created if the map has changed, so that the registration data
+		 * cached within it is reused for all scans until the next keyframe.
+		 * @param keyframes
+		 */
+		virtual Measurement::Ptr updateLocalMap(const VertexObjectList& keyframes);
 
 	protected:
 		RegistrationParameters mFineConfiguration;
 		RegistrationParameters mCoarseConfiguration;
+		bool mCacheRegistrationData;
+		unsigned mRegistrationCacheSize;
+		IdType mLastCachedVertex;
+		
+		// Measurements with cached registration data, most recently used first
+		typedef std::pair<const PointCloudMeasurement*, boost::weak_ptr<PointCloudMeasurement> > RegistrationCacheEntry;
+		typedef std::list<RegistrationCacheEntry> RegistrationCacheList;
+		mutable RegistrationCacheList mRegistrationCacheOrder;
+		mutable std::map<const PointCloudMeasurement*, RegistrationCacheList::iterator> mRegistrationCacheIndex;
+		mutable std::mutex mRegistrationCacheMutex;
+		unsigned mNumberOfThreads;
+		bool mCompactStorage;
 		
 		double   mMapResolution;
 		double   mMapOutlierRadius;
 		unsigned mMapOutlierNeighbors;
+		unsigned mMapMinPoints;
+		
+		mutable boost::shared_ptr<IncrementalMap> mIncrementalMap;
+		mutable boost::shared_ptr<IncrementalMap> mTiledMap;
+		mutable std::mutex mIncrementalMapMutex;
+		double mMapTileSize;
+		
+		boost::shared_ptr<ScanContextDatabase> mPlaceDatabase;
+		float mPlaceMaxDistance;
+		unsigned mPlaceCandidates;
+		
+		// Yaw of the last ranked vertex relative to the places proposed for it
+		IdType mProposedVertex;
+		std::map<IdType, ScalarType> mProposedYaws;
+		std::mutex mProposedMutex;
+		
+		boost::shared_ptr<IncrementalMap> mLocalVoxelMap;
+		PointCloudMeasurement::Ptr mLocalMapCloud;
+		
+		RegistrationResult mLastRegistrationResult;
+		mutable std::mutex mLastRegistrationMutex;
 	};
 }
 
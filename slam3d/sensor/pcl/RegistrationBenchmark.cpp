@@ -0,0 +1,219 @@
+#include "PointCloudSensor.hpp"
+
+#include <slam3d/core/Logger.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+using namespace slam3d;
+
+#ifndef SLAM3D_TEST_DATA
+#define SLAM3D_TEST_DATA "test"
+#endif
+
+// Read raw pcl::PointXYZ records as stored in test/cloud*.bin
+PointCloud::Ptr loadCloud(const std::string& file)
+{
+	PointCloud::Ptr cloud(new PointCloud);
+	std::ifstream in(file.c_str(), std::ios::binary);
+	PointType p;
+	while(in.read((char*)p.data, sizeof(p.data)))
+	{
+		cloud->push_back(p);
+	}
+	return cloud;
+}
+
+struct BenchmarkCase
+{
+	std::string name;
+	RegistrationAlgorithm algorithm;
+	double density;
+	bool loop;
+};
+
+struct BenchmarkResult
+{
+	std::vector<double> times;
+	std::vector<unsigned> iterations;
+	std::vector<double> fitness;
+	unsigned failures;
+};
+
+double percentile(std::vector<double> values, double p)
+{
+	if(values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	size_t i = std::min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5));
+	return values[i];
+}
+
+template <typename T>
+double mean(const std::vector<T>& values)
+{
+	if(values.empty())
+		return 0;
+	double sum = 0;
+	for(typename std::vector<T>::const_iterator v = values.begin(); v != values.end(); ++v)
+		sum += *v;
+	return sum / values.size();
+}
+
+// Usage: pcl_registration_benchmark [-i iterations] [-t threads] [-d density]... [-c] [-o results.csv] [cloud.bin]...
+// Consecutive clouds are registered with each other, without any files the sample clouds
+// from the test directory are used. Registration data is not cached unless -c is given,
+// so that each run includes the preprocessing.
+int main(int argc, char** argv)
+{
+	unsigned iterations = 10;
+	unsigned threads = 1;
+	bool cache = false;
+	std::string output = "registration_benchmark.csv";
+	std::vector<double> densities;
+	std::vector<std::string> files;
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			densities.push_back(atof(argv[++i]));
+		else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else if(strcmp(argv[i], "-c") == 0)
+			cache = true;
+		else
+			files.push_back(argv[i]);
+	}
+	if(files.empty())
+	{
+		for(int i = 1; i <= 4; i++)
+			files.push_back(std::string(SLAM3D_TEST_DATA) + "/cloud" + std::to_string(i) + ".bin");
+	}
+	if(densities.empty())
+	{
+		densities.push_back(0.1);
+		densities.push_back(0.2);
+		densities.push_back(0.5);
+	}
+	if(iterations == 0)
+		iterations = 1;
+
+	std::vector<PointCloudMeasurement::Ptr> measurements;
+	for(std::vector<std::string>::iterator f = files.begin(); f != files.end(); ++f)
+	{
+		PointCloud::Ptr cloud = loadCloud(*f);
+		if(cloud->empty())
+		{
+			std::cerr << "Could not load point cloud from " << *f << std::endl;
+			continue;
+		}
+		measurements.push_back(PointCloudMeasurement::Ptr(
+			new PointCloudMeasurement(cloud, "Robot", "Benchmark", Transform::Identity())));
+	}
+	if(measurements.size() < 2)
+	{
+		std::cerr << "At least two point clouds are required." << std::endl;
+		return 1;
+	}
+
+	// Fine matching uses only the fine configuration,
+	// loop matching initializes it with the coarse one.
+	std::vector<BenchmarkCase> cases;
+	RegistrationAlgorithm algorithms[] = {GICP, NDT};
+	const char* names[] = {"GICP", "NDT"};
+	for(unsigned a = 0; a < 2; a++)
+	{
+		for(std::vector<double>::iterator d = densities.begin(); d != densities.end(); ++d)
+		{
+			BenchmarkCase c;
+			c.algorithm = algorithms[a];
+			c.density = *d;
+			c.loop = false;
+			c.name = std::string(names[a]) + "/fine";
+			cases.push_back(c);
+			c.loop = true;
+			c.name = std::string(names[a]) + "/coarse+fine";
+			cases.push_back(c);
+		}
+	}
+
+	Clock clock;
+	Logger logger(clock);
+	logger.setLogLevel(ERROR);
+
+	std::ofstream csv(output.c_str());
+	csv << "case,density,source,target,run,time_ms,iterations,fitness,success" << std::endl;
+
+	std::cout << std::setw(18) << "case" << std::setw(9) << "density" << std::setw(10) << "p50[ms]"
+	          << std::setw(10) << "p90[ms]" << std::setw(10) << "p99[ms]" << std::setw(10) << "max[ms]"
+	          << std::setw(8) << "iter" << std::setw(12) << "fitness" << std::setw(10) << "failed" << std::endl;
+
+	for(std::vector<BenchmarkCase>::iterator c = cases.begin(); c != cases.end(); ++c)
+	{
+		PointCloudSensor sensor("Benchmark", &logger);
+		sensor.setCacheRegistrationData(cache);
+
+		RegistrationParameters fine;
+		fine.registration_algorithm = c->algorithm;
+		fine.point_cloud_density = c->density;
+		fine.num_threads = threads;
+		RegistrationParameters coarse = fine;
+		coarse.point_cloud_density = c->density * 2;
+		coarse.max_correspondence_distance = fine.max_correspondence_distance * 2;
+		coarse.max_fitness_score = fine.max_fitness_score * 4;
+		sensor.setRegistrationParameters(fine, false);
+		sensor.setRegistrationParameters(coarse, true);
+
+		// Each case starts with empty caches
+		for(std::vector<PointCloudMeasurement::Ptr>::iterator m = measurements.begin(); m != measurements.end(); ++m)
+			(*m)->clearPreprocessedClouds();
+
+		BenchmarkResult result;
+		result.failures = 0;
+		for(size_t m = 0; m + 1 < measurements.size(); m++)
+		{
+			for(unsigned run = 0; run < iterations; run++)
+			{
+				bool success = true;
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				try
+				{
+					sensor.createConstraint(measurements[m], measurements[m+1], Transform::Identity(), c->loop);
+				}catch(NoMatch& e)
+				{
+					success = false;
+				}
+				double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				result.times.push_back(time);
+
+				RegistrationResult reg = sensor.getLastRegistrationResult();
+				if(success)
+				{
+					result.iterations.push_back(reg.iterations);
+					result.fitness.push_back(reg.fitness);
+				}else
+				{
+					result.failures++;
+				}
+				csv << c->name << "," << c->density << "," << m << "," << m+1 << "," << run << "," << time << ","
+				    << (success ? reg.iterations : 0) << "," << (success ? reg.fitness : 0) << "," << success << std::endl;
+			}
+		}
+
+		std::cout << std::setw(18) << c->name << std::setw(9) << c->density
+		          << std::setw(10) << percentile(result.times, 0.5) << std::setw(10) << percentile(result.times, 0.9)
+		          << std::setw(10) << percentile(result.times, 0.99) << std::setw(10) << percentile(result.times, 1.0)
+		          << std::setw(8) << mean(result.iterations) << std::setw(12) << mean(result.fitness)
+		          << std::setw(10) << result.failures << std::endl;
+	}
+	std::cout << "Results written to " << output << std::endl;
+	return 0;
+}
@@ -48,6 +48,24 @@ namespace slam3d
 		// maximum fitness score (e.g., sum of squared distances from the source to the target)
 		// to accept the registration result
 		double max_fitness_score;
+
+		// number of threads for covariance and score computation, also passed to
+		// PCL's registration if the installed version is multithreaded (GICP
+		// since PCL 1.14), 0 uses the number of cores, NDT iterations are
+		// always single-threaded
+		unsigned num_threads;
+
+		// number of levels of the resolution pyramid, registration starts with
+		// point_cloud_density * pyramid_factor^(levels-1) and ends with point_cloud_density
+		unsigned pyramid_levels;
+
+		// factor between the voxel sizes of two consecutive pyramid levels
+		double pyramid_factor;
+
+		// skip the remaining coarse levels and continue at point_cloud_density when
+		// the (resolution normalized) fitness score changes by less than this
+		// fraction between two levels
+		double pyramid_epsilon;
 		
 	// General registration parameters
 	// -------------------------------
@@ -93,6 +111,10 @@ namespace slam3d
 		RegistrationParameters() : registration_algorithm(GICP),
 		                           point_cloud_density(0.2),
 		                           max_fitness_score(2.0),
+		                           num_threads(1),
+		                           pyramid_levels(1),
+		                           pyramid_factor(2.0),
+		                           pyramid_epsilon(0.05),
 		                           euclidean_fitness_epsilon(1.0),
 		                           transformation_epsilon(1e-5),
 		                           max_correspondence_distance(2.5),
@@ -0,0 +1,198 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "ScanContext.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+using namespace slam3d;
+
+ScanContext::ScanContext(const PointCloud& cloud, unsigned rings, unsigned sectors,
+                         float max_radius, float height_offset)
+ : mRings(rings), mSectors(sectors), mBins(rings * sectors, 0.0f), mNorms(sectors, 0.0f), mRingKey(rings, 0.0f)
+{
+	const float two_pi = 2.0 * M_PI;
+	for(PointCloud::const_iterator p = cloud.begin(); p != cloud.end(); ++p)
+	{
+		float range = std::sqrt(p->x * p->x + p->y * p->y);
+		if(!(range < max_radius))
+			continue;
+		float angle = std::atan2(p->y, p->x);
+		if(angle < 0)
+			angle += two_pi;
+		unsigned ring = std::min<unsigned>(range / max_radius * mRings, mRings - 1);
+		unsigned sector = std::min<unsigned>(angle / two_pi * mSectors, mSectors - 1);
+		float& bin = mBins[sector * mRings + ring];
+		bin = std::max(bin, p->z + height_offset);
+	}
+
+	for(unsigned s = 0; s < mSectors; s++)
+	{
+		float norm = 0;
+		for(unsigned r = 0; r < mRings; r++)
+		{
+			float value = mBins[s * mRings + r];
+			norm += value * value;
+			mRingKey[r] += value / mSectors;
+		}
+		mNorms[s] = std::sqrt(norm);
+	}
+}
+
+float ScanContext::distance(const ScanContext& other, unsigned& shift) const
+{
+	if(other.mRings != mRings || other.mSectors != mSectors)
+		throw std::invalid_argument("ScanContext descriptors have different sizes.");
+
+	// A sector s of other corresponds to sector (s + shift) of this one
+	float best = 1.0;
+	shift = 0;
+	for(unsigned k = 0; k < mSectors; k++)
+	{
+		float sum = 0;
+		unsigned count = 0;
+		for(unsigned s = 0; s < mSectors; s++)
+		{
+			unsigned t = (s + k) % mSectors;
+			if(mNorms[t] == 0 || other.mNorms[s] == 0)
+				continue;
+			const float* a = &mBins[t * mRings];
+			const float* b = &other.mBins[s * mRings];
+			float dot = 0;
+			for(unsigned r = 0; r < mRings; r++)
+				dot += a[r] * b[r];
+			sum += 1.0f - dot / (mNorms[t] * other.mNorms[s]);
+			count++;
+		}
+		if(count > 0 && sum / count < best)
+		{
+			best = sum / count;
+			shift = k;
+		}
+	}
+	return best;
+}
+
+float ScanContext::distance(const ScanContext& other) const
+{
+	unsigned shift;
+	return distance(other, shift);
+}
+
+ScalarType ScanContext::getYaw(unsigned shift) const
+{
+	ScalarType yaw = 2.0 * M_PI * shift / mSectors;
+	if(yaw > M_PI)
+		yaw -= 2.0 * M_PI;
+	return yaw;
+}
+
+float ScanContext::ringKeyDistance(const ScanContext& other) const
+{
+	float sum = 0;
+	for(unsigned r = 0; r < mRings && r < other.mRings; r++)
+	{
+		float d = mRingKey[r] - other.mRingKey[r];
+		sum += d * d;
+	}
+	return sum;
+}
+
+ScanContextDatabase::ScanContextDatabase(unsigned preselection)
+ : mPreselection(preselection)
+{
+}
+
+void ScanContextDatabase::add(IdType id, const ScanContext::ConstPtr& descriptor)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	mDescriptors[id] = descriptor;
+}
+
+void ScanContextDatabase::remove(IdType id)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	mDescriptors.erase(id);
+}
+
+ScanContext::ConstPtr ScanContextDatabase::get(IdType id) const
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	std::map<IdType, ScanContext::ConstPtr>::const_iterator it = mDescriptors.find(id);
+	if(it == mDescriptors.end())
+		return ScanContext::ConstPtr();
+	return it->second;
+}
+
+size_t ScanContextDatabase::size() const
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	return mDescriptors.size();
+}
+
+std::vector<PlaceMatch> ScanContextDatabase::query(const ScanContext& descriptor, float max_distance) const
+{
+	// Preselect by the rotation invariant ring keys
+	std::vector< std::pair<float, ScanContext::ConstPtr> > keys;
+	std::vector<IdType> ids;
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+		keys.reserve(mDescriptors.size());
+		for(std::map<IdType, ScanContext::ConstPtr>::const_iterator d = mDescriptors.begin(); d != mDescriptors.end(); ++d)
+		{
+			keys.push_back(std::make_pair(descriptor.ringKeyDistance(*d->second), d->second));
+			ids.push_back(d->first);
+		}
+	}
+
+	std::vector<size_t> order(keys.size());
+	for(size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	size_t n = std::min<size_t>(mPreselection, order.size());
+	std::partial_sort(order.begin(), order.begin() + n, order.end(),
+		[&keys](size_t a, size_t b){ return keys[a].first < keys[b].first; });
+
+	// Compare the full descriptors of the preselected entries
+	std::vector<PlaceMatch> matches;
+	for(size_t i = 0; i < n; i++)
+	{
+		const ScanContext& candidate = *keys[order[i]].second;
+		unsigned shift;
+		float distance = candidate.distance(descriptor, shift);
+		if(distance > max_distance)
+			continue;
+		PlaceMatch match;
+		match.id = ids[order[i]];
+		match.distance = distance;
+		match.yaw = candidate.getYaw(shift);
+		matches.push_back(match);
+	}
+	std::sort(matches.begin(), matches.end(),
+		[](const PlaceMatch& a, const PlaceMatch& b){ return a.distance < b.distance; });
+	return matches;
+}
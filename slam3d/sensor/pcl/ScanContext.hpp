@@ -0,0 +1,171 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_PCL_SCANCONTEXT_HPP
+#define SLAM3D_PCL_SCANCONTEXT_HPP
+
+#include <slam3d/core/Types.hpp>
+#include <slam3d/sensor/pcl/Filters.hpp>
+
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace slam3d
+{
+	/**
+	 * @class ScanContext
+	 * @brief Global descriptor of a point cloud for place recognition.
+	 * @details The plane around the sensor is divided into rings and sectors,
+	 * each bin stores the maximum height of the points within it (Kim and Kim,
+	 * "Scan Context", IROS 2018). Two descriptors are compared column-wise for
+	 * all rotations, so the distance is invariant to the yaw of the sensor and
+	 * also yields an estimate of the relative yaw. The mean of each ring forms
+	 * the ring key, a rotation invariant vector for fast preselection.
+	 *
+	 * The cloud has to be given in a frame with the z-axis pointing up.
+	 */
+	class ScanContext
+	{
+	public:
+		typedef boost::shared_ptr<const ScanContext> ConstPtr;
+
+		/**
+		 * @brief Compute the descriptor of a point cloud.
+		 * @param cloud
+		 * @param rings number of radial bins
+		 * @param sectors number of angular bins
+		 * @param max_radius points farther away are ignored
+		 * @param height_offset added to all heights, which are clamped at zero
+		 */
+		ScanContext(const PointCloud& cloud, unsigned rings = 20, unsigned sectors = 60,
+		            float max_radius = 80.0, float height_offset = 2.0);
+
+		/**
+		 * @brief Get the distance to another descriptor of the same size.
+		 * @param other
+		 * @param shift receives the number of sectors by which other is rotated
+		 * @return mean cosine distance of the columns, between 0 and 1
+		 * @throw std::invalid_argument
+		 */
+		float distance(const ScanContext& other, unsigned& shift) const;
+
+		/**
+		 * @brief Get the distance to another descriptor of the same size.
+		 * @param other
+		 */
+		float distance(const ScanContext& other) const;
+
+		/**
+		 * @brief Get the yaw angle that corresponds to a shift returned by distance().
+		 * @param shift
+		 */
+		ScalarType getYaw(unsigned shift) const;
+
+		/**
+		 * @brief Get the squared distance between the ring keys.
+		 * @param other
+		 */
+		float ringKeyDistance(const ScanContext& other) const;
+
+		unsigned getRings() const { return mRings; }
+		unsigned getSectors() const { return mSectors; }
+
+	private:
+		unsigned mRings;
+		unsigned mSectors;
+		std::vector<float> mBins;   // sector-major, mRings values per sector
+		std::vector<float> mNorms;  // norm of each sector
+		std::vector<float> mRingKey;
+	};
+
+	/**
+	 * @struct PlaceMatch
+	 * @brief Result of a query to the ScanContextDatabase.
+	 */
+	struct PlaceMatch
+	{
+		IdType id;
+		float distance;
+		ScalarType yaw; // yaw of the query relative to the match
+	};
+
+	/**
+	 * @class ScanContextDatabase
+	 * @brief Index of ScanContext descriptors.
+	 * @details Queries preselect the entries with the closest ring keys and
+	 * compare only those with the full descriptor. All methods are thread-safe.
+	 */
+	class ScanContextDatabase
+	{
+	public:
+		/**
+		 * @brief Constructor
+		 * @param preselection number of entries that are compared with the full descriptor
+		 */
+		ScanContextDatabase(unsigned preselection = 20);
+
+		/**
+		 * @brief Add or replace the descriptor of the given id.
+		 * @param id
+		 * @param descriptor
+		 */
+		void add(IdType id, const ScanContext::ConstPtr& descriptor);
+
+		/**
+		 * @brief Remove the descriptor of the given id.
+		 * @param id
+		 */
+		void remove(IdType id);
+
+		/**
+		 * @brief Get the descriptor of the given id.
+		 * @return descriptor or an empty pointer
+		 */
+		ScanContext::ConstPtr get(IdType id) const;
+
+		/**
+		 * @brief Find the entries that are most similar to the given descriptor.
+		 * @param descriptor
+		 * @param max_distance matches with larger distance are dropped
+		 * @return matches ordered by increasing distance
+		 */
+		std::vector<PlaceMatch> query(const ScanContext& descriptor, float max_distance) const;
+
+		/**
+		 * @brief Get the number of descriptors.
+		 */
+		size_t size() const;
+
+	private:
+		std::map<IdType, ScanContext::ConstPtr> mDescriptors;
+		unsigned mPreselection;
+		mutable std::mutex mMutex;
+	};
+}
+
+#endif
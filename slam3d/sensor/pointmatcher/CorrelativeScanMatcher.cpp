@@ -0,0 +1,274 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "CorrelativeScanMatcher.hpp"
+
+#include <slam3d/core/Sensor.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+using namespace slam3d;
+
+// Maximum of each window of w consecutive elements, including the windows
+// that are only partially within the input, so out has n + w - 1 elements.
+static void slidingMax(const float* in, int n, int stride, int w, float* out, int out_stride)
+{
+	std::deque<int> window;
+	for(int k = 0; k < n + w - 1; k++)
+	{
+		if(k < n)
+		{
+			while(!window.empty() && in[window.back() * stride] <= in[k * stride])
+				window.pop_back();
+			window.push_back(k);
+		}
+		while(window.front() <= k - w)
+			window.pop_front();
+		out[k * out_stride] = in[window.front() * stride];
+	}
+}
+
+CorrelativeScanMatcher::CorrelativeScanMatcher(const Points2D& reference, const CorrelativeScanMatcherParameters& params)
+ : mParameters(params), mSizeX(0), mSizeY(0)
+{
+	computeGrids(reference);
+}
+
+void CorrelativeScanMatcher::computeGrids(const Points2D& reference)
+{
+	const double res = mParameters.resolution;
+	const double radius = 3.0 * mParameters.sigma;
+	const int kernel = std::ceil(radius / res);
+
+	// Likelihood grid covering the reference with the kernel around it
+	Eigen::Vector2d min(0, 0), max(0, 0);
+	if(!reference.empty())
+	{
+		min = max = reference[0];
+		for(Points2D::const_iterator p = reference.begin(); p != reference.end(); ++p)
+		{
+			min = min.cwiseMin(*p);
+			max = max.cwiseMax(*p);
+		}
+	}
+	mOrigin = min - Eigen::Vector2d(radius + res, radius + res);
+	mSizeX = std::ceil((max[0] - mOrigin[0] + radius + res) / res);
+	mSizeY = std::ceil((max[1] - mOrigin[1] + radius + res) / res);
+
+	std::vector<float> likelihood(mSizeX * mSizeY, 0);
+	const double factor = -0.5 / (mParameters.sigma * mParameters.sigma);
+	for(Points2D::const_iterator p = reference.begin(); p != reference.end(); ++p)
+	{
+		int cx = std::floor(((*p)[0] - mOrigin[0]) / res);
+		int cy = std::floor(((*p)[1] - mOrigin[1]) / res);
+		for(int y = std::max(0, cy - kernel); y <= std::min(mSizeY - 1, cy + kernel); y++)
+		{
+			for(int x = std::max(0, cx - kernel); x <= std::min(mSizeX - 1, cx + kernel); x++)
+			{
+				Eigen::Vector2d center = mOrigin + Eigen::Vector2d(x + 0.5, y + 0.5) * res;
+				float value = std::exp((center - *p).squaredNorm() * factor);
+				float& cell = likelihood[y * mSizeX + x];
+				cell = std::max(cell, value);
+			}
+		}
+	}
+
+	// Separable window maximum for each level
+	mGrids.resize(mParameters.branch_and_bound_depth + 1);
+	for(unsigned level = 0; level < mGrids.size(); level++)
+	{
+		PrecomputationGrid& grid = mGrids[level];
+		grid.width = 1 << level;
+		grid.size_x = mSizeX + grid.width - 1;
+		grid.size_y = mSizeY + grid.width - 1;
+		grid.cells.resize(grid.size_x * grid.size_y);
+
+		std::vector<float> rows(grid.size_x * mSizeY);
+		for(int y = 0; y < mSizeY; y++)
+			slidingMax(&likelihood[y * mSizeX], mSizeX, 1, grid.width, &rows[y * grid.size_x], 1);
+		for(int x = 0; x < grid.size_x; x++)
+			slidingMax(&rows[x], mSizeY, grid.size_x, grid.width, &grid.cells[x], grid.size_x);
+	}
+}
+
+float CorrelativeScanMatcher::score(const PrecomputationGrid& grid, const std::vector<Eigen::Vector2i>& scan, int x, int y) const
+{
+	float sum = 0;
+	for(std::vector<Eigen::Vector2i>::const_iterator p = scan.begin(); p != scan.end(); ++p)
+	{
+		sum += grid.get((*p)[0] + x, (*p)[1] + y);
+	}
+	return sum / scan.size();
+}
+
+void CorrelativeScanMatcher::scoreCandidates(const PrecomputationGrid& grid, const DiscreteScans& scans,
+                                             std::vector<Candidate>& candidates) const
+{
+	for(std::vector<Candidate>::iterator c = candidates.begin(); c != candidates.end(); ++c)
+	{
+		c->score = score(grid, scans[c->angle], c->x, c->y);
+	}
+	std::sort(candidates.begin(), candidates.end(), std::greater<Candidate>());
+}
+
+CorrelativeScanMatcher::Candidate CorrelativeScanMatcher::branchAndBound(const DiscreteScans& scans,
+	const std::vector<Candidate>& candidates, unsigned level, int window, float min_score) const
+{
+	Candidate best;
+	best.angle = UINT_MAX;
+	best.score = min_score;
+	if(level == 0)
+	{
+		if(!candidates.empty() && candidates[0].score > min_score)
+			best = candidates[0];
+		return best;
+	}
+
+	// Candidates are sorted, so all following ones are bounded by the current
+	const int half = 1 << (level - 1);
+	for(std::vector<Candidate>::const_iterator c = candidates.begin(); c != candidates.end(); ++c)
+	{
+		if(c->score <= best.score)
+			break;
+
+		std::vector<Candidate> children;
+		children.reserve(4);
+		for(int dy = 0; dy <= half; dy += half)
+		{
+			for(int dx = 0; dx <= half; dx += half)
+			{
+				Candidate child = *c;
+				child.x += dx;
+				child.y += dy;
+				if(child.x <= window && child.y <= window)
+					children.push_back(child);
+			}
+		}
+		scoreCandidates(mGrids[level - 1], scans, children);
+		Candidate result = branchAndBound(scans, children, level - 1, window, best.score);
+		if(result.score > best.score)
+			best = result;
+	}
+	return best;
+}
+
+// Replace the points within each cell of the given size by their centroid
+static Points2D subsample(const Points2D& points, double res)
+{
+	std::unordered_map<uint64_t, size_t> cells;
+	Points2D sums;
+	std::vector<unsigned> counts;
+	for(Points2D::const_iterator p = points.begin(); p != points.end(); ++p)
+	{
+		int64_t x = std::floor((*p)[0] / res);
+		int64_t y = std::floor((*p)[1] / res);
+		uint64_t key = ((uint64_t)x << 32) ^ (uint32_t)y;
+		std::pair<std::unordered_map<uint64_t, size_t>::iterator, bool> cell = cells.insert(std::make_pair(key, sums.size()));
+		if(cell.second)
+		{
+			sums.push_back(*p);
+			counts.push_back(1);
+		}else
+		{
+			sums[cell.first->second] += *p;
+			counts[cell.first->second]++;
+		}
+	}
+	for(size_t i = 0; i < sums.size(); i++)
+		sums[i] /= counts[i];
+	return sums;
+}
+
+ScanMatchResult CorrelativeScanMatcher::match(const Points2D& scan, const Transform& guess) const
+{
+	if(scan.empty())
+		throw NoMatch("Scan for correlative matching is empty.");
+
+	const double res = mParameters.resolution;
+	const Points2D reduced = subsample(scan, res);
+	const Eigen::Vector2d translation = guess.translation().head<2>();
+	const double yaw = std::atan2(guess.linear()(1,0), guess.linear()(0,0));
+
+	// Angular step so that the farthest point moves by about one cell
+	double range = 0;
+	for(Points2D::const_iterator p = reduced.begin(); p != reduced.end(); ++p)
+		range = std::max(range, p->norm());
+	double step = mParameters.angular_window;
+	if(range > res)
+		step = std::min(step, std::acos(1.0 - (res * res) / (2.0 * range * range)));
+	const int steps = (step > 0) ? std::ceil(mParameters.angular_window / step) : 0;
+
+	// Discretize the scan for each angle within the window
+	DiscreteScans scans(2 * steps + 1);
+	for(int a = -steps; a <= steps; a++)
+	{
+		Eigen::Rotation2Dd rotation(yaw + a * step);
+		std::vector<Eigen::Vector2i>& discrete = scans[a + steps];
+		discrete.reserve(reduced.size());
+		for(Points2D::const_iterator p = reduced.begin(); p != reduced.end(); ++p)
+		{
+			Eigen::Vector2d q = (rotation * (*p) + translation - mOrigin) / res;
+			discrete.push_back(Eigen::Vector2i(std::floor(q[0]), std::floor(q[1])));
+		}
+	}
+
+	// Candidates on the coarsest level cover the whole linear window
+	const unsigned depth = mGrids.size() - 1;
+	const int width = 1 << depth;
+	const int window = std::ceil(mParameters.linear_window / res);
+	std::vector<Candidate> candidates;
+	for(unsigned a = 0; a < scans.size(); a++)
+	{
+		for(int y = -window; y <= window; y += width)
+		{
+			for(int x = -window; x <= window; x += width)
+			{
+				Candidate c;
+				c.angle = a;
+				c.x = x;
+				c.y = y;
+				candidates.push_back(c);
+			}
+		}
+	}
+	scoreCandidates(mGrids[depth], scans, candidates);
+
+	Candidate best = branchAndBound(scans, candidates, depth, window, mParameters.min_score);
+	if(best.angle == UINT_MAX)
+		throw NoMatch("Correlative scan matching did not reach the minimum score.");
+
+	ScanMatchResult result;
+	result.transform = Transform::Identity();
+	result.transform.translation().head<2>() = translation + Eigen::Vector2d(best.x, best.y) * res;
+	result.transform.linear() = Eigen::AngleAxis<ScalarType>(yaw + ((int)best.angle - steps) * step,
+	                                                          Eigen::Vector3d::UnitZ()).toRotationMatrix();
+	result.score = best.score;
+	return result;
+}
@@ -0,0 +1,161 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2019 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_POINTMATCHER_CORRELATIVESCANMATCHER_HPP
+#define SLAM3D_POINTMATCHER_CORRELATIVESCANMATCHER_HPP
+
+#include <slam3d/core/Types.hpp>
+
+#include <cmath>
+#include <vector>
+
+namespace slam3d
+{
+	typedef std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > Points2D;
+
+	/**
+	 * @struct CorrelativeScanMatcherParameters
+	 * @brief Parameters of the correlative scan matcher.
+	 */
+	struct CorrelativeScanMatcherParameters
+	{
+		double resolution;
+		double sigma;
+		double linear_window;
+		double angular_window;
+		unsigned branch_and_bound_depth;
+		double min_score;
+
+		CorrelativeScanMatcherParameters() :
+			resolution(0.05),
+			sigma(0.1),
+			linear_window(4.0),
+			angular_window(M_PI / 4.0),
+			branch_and_bound_depth(6),
+			min_score(0.5){}
+	};
+
+	/**
+	 * @struct ScanMatchResult
+	 * @brief Result of a correlative scan match.
+	 * @details The score is the mean likelihood of the matched scan's points
+	 * in the reference grid, 1 is a perfect match.
+	 */
+	struct ScanMatchResult
+	{
+		Transform transform;
+		double score;
+	};
+
+	/**
+	 * @class CorrelativeScanMatcher
+	 * @brief Global 2D scan matcher using branch and bound search.
+	 * @details The reference scan is rendered into a likelihood grid, where
+	 * each cell holds exp(-d²/2σ²) of the distance d to the closest reference
+	 * point. A scan is matched by exhaustively searching all poses within a
+	 * linear and angular window around the guess for the highest mean
+	 * likelihood of its points (Olson, "Real-Time Correlative Scan Matching",
+	 * ICRA 2009). To make this fast, the grid is precomputed at multiple
+	 * resolutions, where a cell of level h holds the maximum of the 2^h x 2^h
+	 * cells it covers. The score on a coarse level is an upper bound for all
+	 * finer poses it covers, so branch and bound can discard most of the
+	 * search window without evaluating it (Hess et al., "Real-Time Loop
+	 * Closure in 2D LIDAR SLAM", ICRA 2016).
+	 *
+	 * The grids are built once in the constructor, so one matcher can be used
+	 * to match multiple scans against the same reference, also concurrently.
+	 */
+	class CorrelativeScanMatcher
+	{
+	public:
+		/**
+		 * @brief Build the lookup grids for a reference scan.
+		 * @param reference points in the reference frame
+		 * @param params
+		 */
+		CorrelativeScanMatcher(const Points2D& reference, const CorrelativeScanMatcherParameters& params);
+
+		/**
+		 * @brief Find the pose of a scan in the reference frame.
+		 * @details Searches the windows given in the parameters around the
+		 * guess. Only x, y and yaw of the guess are used. The points within
+		 * each cell of the grid resolution are replaced by their centroid
+		 * before matching, so dense parts of the scan do not dominate the
+		 * score and fewer points have to be rotated for each angle.
+		 * @param scan points in the scan frame
+		 * @param guess initial pose of the scan in the reference frame
+		 * @throw NoMatch if no pose reaches the minimum score
+		 */
+		ScanMatchResult match(const Points2D& scan, const Transform& guess) const;
+
+	private:
+		// Grid where each cell holds the maximum of a window of the likelihood
+		// grid, the cells from (x, y) to (x + width - 1, y + width - 1).
+		// It is extended by width - 1 cells into negative direction.
+		struct PrecomputationGrid
+		{
+			int width;
+			int size_x;
+			int size_y;
+			std::vector<float> cells;
+
+			float get(int x, int y) const
+			{
+				x += width - 1;
+				y += width - 1;
+				if(x < 0 || y < 0 || x >= size_x || y >= size_y)
+					return 0;
+				return cells[y * size_x + x];
+			}
+		};
+
+		struct Candidate
+		{
+			unsigned angle;
+			int x;
+			int y;
+			float score;
+
+			bool operator>(const Candidate& other) const { return score > other.score; }
+		};
+
+		typedef std::vector<std::vector<Eigen::Vector2i> > DiscreteScans;
+
+		void computeGrids(const Points2D& reference);
+		float score(const PrecomputationGrid& grid, const std::vector<Eigen::Vector2i>& scan, int x, int y) const;
+		void scoreCandidates(const PrecomputationGrid& grid, const DiscreteScans& scans,
+		                     std::vector<Candidate>& candidates) const;
+		Candidate branchAndBound(const DiscreteScans& scans, const std::vector<Candidate>& candidates,
+		                         unsigned level, int window, float min_score) const;
+
+		CorrelativeScanMatcherParameters mParameters;
+		Eigen::Vector2d mOrigin;
+		int mSizeX;
+		int mSizeY;
+		std::vector<PrecomputationGrid> mGrids;
+	};
+}
+
+#endif
@@ -0,0 +1,112 @@
+#define BOOST_TEST_MODULE "CorrelativeScanMatcherTest"
+
+#include "CorrelativeScanMatcher.hpp"
+
+#include <slam3d/core/Sensor.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <cmath>
+
+using namespace slam3d;
+
+// Add the points of a straight wall from a to b
+void addWall(Points2D& points, const Eigen::Vector2d& a, const Eigen::Vector2d& b)
+{
+	const unsigned n = std::ceil((b - a).norm() / 0.02);
+	for(unsigned i = 0; i <= n; i++)
+		points.push_back(a + (b - a) * i / n);
+}
+
+// An asymmetric room with a door and a box inside
+Points2D createRoom()
+{
+	Points2D room;
+	addWall(room, Eigen::Vector2d(-3, -2), Eigen::Vector2d(4, -2));
+	addWall(room, Eigen::Vector2d(4, -2), Eigen::Vector2d(4, 3));
+	addWall(room, Eigen::Vector2d(1, 3), Eigen::Vector2d(-3, 3));
+	addWall(room, Eigen::Vector2d(-3, 3), Eigen::Vector2d(-3, -2));
+	addWall(room, Eigen::Vector2d(1, 0), Eigen::Vector2d(1.5, 0));
+	addWall(room, Eigen::Vector2d(1.5, 0), Eigen::Vector2d(1.5, 0.8));
+	return room;
+}
+
+Transform createPose(double x, double y, double yaw)
+{
+	Transform pose = Transform::Identity();
+	pose.translation() = Eigen::Vector3d(x, y, 0);
+	pose.linear() = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+	return pose;
+}
+
+// Every second point of the room, as seen from the given pose
+Points2D createScan(const Points2D& room, const Transform& pose)
+{
+	Eigen::Rotation2Dd rotation(std::atan2(pose.linear()(1,0), pose.linear()(0,0)));
+	Eigen::Vector2d translation = pose.translation().head<2>();
+	Points2D scan;
+	for(size_t i = 0; i < room.size(); i += 2)
+		scan.push_back(rotation.inverse() * (room[i] - translation));
+	return scan;
+}
+
+double getYaw(const Transform& t)
+{
+	return std::atan2(t.linear()(1,0), t.linear()(0,0));
+}
+
+BOOST_AUTO_TEST_CASE(shifted_and_rotated_scan)
+{
+	CorrelativeScanMatcherParameters params;
+	params.linear_window = 1.0;
+	params.angular_window = 0.3;
+	Points2D room = createRoom();
+	CorrelativeScanMatcher matcher(room, params);
+
+	Transform truth = createPose(0.6, -0.35, 0.15);
+	ScanMatchResult result = matcher.match(createScan(room, truth), Transform::Identity());
+	BOOST_CHECK_SMALL(result.transform.translation().x() - 0.6, 2 * params.resolution);
+	BOOST_CHECK_SMALL(result.transform.translation().y() + 0.35, 2 * params.resolution);
+	BOOST_CHECK_SMALL(result.transform.translation().z(), 1e-9);
+	BOOST_CHECK_SMALL(getYaw(result.transform) - 0.15, 0.03);
+	BOOST_CHECK_GT(result.score, params.min_score);
+
+	// The window is searched around the guess
+	Transform guess = createPose(0.9, -0.6, 0.3);
+	result = matcher.match(createScan(room, truth), guess);
+	BOOST_CHECK_SMALL(result.transform.translation().x() - 0.6, 2 * params.resolution);
+	BOOST_CHECK_SMALL(result.transform.translation().y() + 0.35, 2 * params.resolution);
+	BOOST_CHECK_SMALL(getYaw(result.transform) - 0.15, 0.03);
+}
+
+BOOST_AUTO_TEST_CASE(branch_and_bound_is_exhaustive)
+{
+	CorrelativeScanMatcherParameters params;
+	params.linear_window = 0.5;
+	params.angular_window = 0.2;
+	Points2D room = createRoom();
+	Points2D scan = createScan(room, createPose(-0.2, 0.3, -0.1));
+	ScanMatchResult fast = CorrelativeScanMatcher(room, params).match(scan, Transform::Identity());
+
+	// Without precomputed levels every pose in the window is scored
+	params.branch_and_bound_depth = 0;
+	ScanMatchResult full = CorrelativeScanMatcher(room, params).match(scan, Transform::Identity());
+	BOOST_CHECK_EQUAL(fast.score, full.score);
+
+	// Neighboring angles can discretize to the same cells and tie
+	BOOST_CHECK_SMALL((fast.transform.translation() - full.transform.translation()).norm(), 1e-9);
+	BOOST_CHECK_SMALL(getYaw(fast.transform) - getYaw(full.transform), 0.03);
+}
+
+BOOST_AUTO_TEST_CASE(no_match_outside_window)
+{
+	CorrelativeScanMatcherParameters params;
+	params.linear_window = 0.5;
+	params.angular_window = 0.1;
+	Points2D room = createRoom();
+	CorrelativeScanMatcher matcher(room, params);
+
+	Points2D scan = createScan(room, Transform::Identity());
+	BOOST_CHECK_THROW(matcher.match(scan, createPose(20, 20, 0)), NoMatch);
+	BOOST_CHECK_THROW(matcher.match(Points2D(), Transform::Identity()), NoMatch);
+}
@@ -1,10 +1,111 @@
 #include "Scan2DSensor.hpp"
 
 #include <math.h>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <stdexcept>
 
 using namespace slam3d;
 
+namespace
+{
+	template <typename T>
+	void append(std::vector<char>& buffer, const T* data, size_t count = 1)
+	{
+		const char* bytes = (const char*)data;
+		buffer.insert(buffer.end(), bytes, bytes + count * sizeof(T));
+	}
+
+	template <typename T>
+	void extract(const char*& data, const char* end, T* value, size_t count = 1)
+	{
+		if((size_t)(end - data) < count * sizeof(T))
+			throw std::length_error("Scan2DMeasurement: truncated data");
+		memcpy((void*)value, data, count * sizeof(T));
+		data += count * sizeof(T);
+	}
+
+	void appendBlock(std::vector<char>& buffer, const PM::Matrix& matrix, const PM::DataPoints::Labels& labels)
+	{
+		uint64_t count = labels.size();
+		append(buffer, &count);
+		for(PM::DataPoints::Labels::const_iterator l = labels.begin(); l != labels.end(); ++l)
+		{
+			uint64_t length = l->text.size();
+			uint64_t span = l->span;
+			append(buffer, &length);
+			append(buffer, l->text.data(), length);
+			append(buffer, &span);
+		}
+		int64_t rows = matrix.rows();
+		int64_t cols = matrix.cols();
+		append(buffer, &rows);
+		append(buffer, &cols);
+		append(buffer, matrix.data(), rows * cols);
+	}
+
+	void extractBlock(const char*& data, const char* end, PM::Matrix& matrix, PM::DataPoints::Labels& labels)
+	{
+		uint64_t count;
+		extract(data, end, &count);
+		for(uint64_t i = 0; i < count; i++)
+		{
+			uint64_t length, span;
+			extract(data, end, &length);
+			if((size_t)(end - data) < length)
+				throw std::length_error("Scan2DMeasurement: truncated data");
+			std::string text(data, length);
+			data += length;
+			extract(data, end, &span);
+			labels.push_back(PM::DataPoints::Label(text, span));
+		}
+		int64_t rows, cols;
+		extract(data, end, &rows);
+		extract(data, end, &cols);
+		matrix.resize(rows, cols);
+		extract(data, end, matrix.data(), rows * cols);
+	}
+}
+
+bool Scan2DMeasurement::writePayload(std::vector<char>& buffer) const
+{
+	std::lock_guard<std::mutex> guard(mDataPointsMutex);
+	if(!mDataPoints)
+		return false;
+	appendBlock(buffer, mDataPoints->features, mDataPoints->featureLabels);
+	appendBlock(buffer, mDataPoints->descriptors, mDataPoints->descriptorLabels);
+	return true;
+}
+
+void Scan2DMeasurement::readPayload(const char* data, size_t size)
+{
+	const char* end = data + size;
+	PM::Matrix features, descriptors;
+	PM::DataPoints::Labels feature_labels, descriptor_labels;
+	extractBlock(data, end, features, feature_labels);
+	extractBlock(data, end, descriptors, descriptor_labels);
+
+	boost::shared_ptr<const PM::DataPoints> points(
+		new PM::DataPoints(features, feature_labels, descriptors, descriptor_labels));
+	std::lock_guard<std::mutex> guard(mDataPointsMutex);
+	mDataPoints = points;
+}
+
+void Scan2DMeasurement::releasePayload()
+{
+	std::lock_guard<std::mutex> guard(mDataPointsMutex);
+	mDataPoints.reset();
+}
+
+size_t Scan2DMeasurement::getPayloadSize() const
+{
+	std::lock_guard<std::mutex> guard(mDataPointsMutex);
+	if(!mDataPoints)
+		return 0;
+	return (mDataPoints->features.size() + mDataPoints->descriptors.size()) * sizeof(PM::ScalarType);
+}
+
 Scan2DSensor::Scan2DSensor(const std::string& n, Logger* l, const std::string& configFile)
 : ScanSensor(n, l)
 {
@@ -25,11 +126,17 @@ Scan2DSensor::Scan2DSensor(const std::string& n, Logger* l, const std::string& c
 		mLogger->message(INFO, (boost::format("Successfully loaded ICP configuration from: %1%") % configFile).str());
 	}
 	mWriteDebugData = false;
+	mRigidTransformation = PM::get().REG(Transformation).create("RigidTransformation");
+	mMatcher = POINTMATCHER_ICP;
+	mLoopMatcher = POINTMATCHER_ICP;
+	mCorrelativeVersion = 0;
+	mCorrelativeRefinement = true;
+	mCorrelativeCacheSize = 8;
 }
 
 Scan2DSensor::~Scan2DSensor()
 {
-	
+	shutdown();
 }
 
 Transform Scan2DSensor::convert2Dto3D(const PM::TransformationParameters& in) const
@@ -73,20 +180,50 @@ Constraint::Ptr Scan2DSensor::createConstraint(const Measurement::Ptr& source,
 		throw BadMeasurementType();
 	}
 	
-	// Transform target by odometry transform
-	std::shared_ptr<PM::Transformation> rigidTrans;
-	rigidTrans = PM::get().REG(Transformation).create("RigidTransformation");
-	const PM::DataPoints initializedTarget = rigidTrans->compute(targetScan->getDataPoints(), convert3Dto2D(guess));
-
-//	if(debug)
-//	{
-//		sourceScan->getDataPoints().save("source.vtk");
-//		initializedTarget.save("target.vtk");
-//	}
-	
-	// Perform ICP
-	PM::TransformationParameters tp = mICP(initializedTarget, sourceScan->getDataPoints());
-	Transform icp_result = guess * convert2Dto3D(tp);
+	Scan2DMatcher matcher;
+	CorrelativeScanMatcherParameters params;
+	unsigned long version;
+	bool correlative_refinement;
+	{
+		std::lock_guard<std::mutex> guard(mCorrelativeMutex);
+		matcher = loop ? mLoopMatcher : mMatcher;
+		params = mCorrelativeParameters;
+		version = mCorrelativeVersion;
+		correlative_refinement = mCorrelativeRefinement;
+	}
+
+	// Search the window around the guess
+	Transform icp_result = guess;
+	bool refine = true;
+	if(matcher == CORRELATIVE)
+	{
+		boost::shared_ptr<const CorrelativeScanMatcher> correlative = getCorrelativeMatcher(sourceScan, params, version);
+		ScanMatchResult match = correlative->match(getPoints2D(*targetScan->getDataPoints()), guess);
+		mLogger->message(DEBUG, (boost::format("Correlative scan matching score: %1%") % match.score).str());
+		guess = match.transform;
+		icp_result = match.transform;
+		refine = correlative_refinement;
+	}
+
+	if(refine)
+	{
+		// Transform target by the guess
+		const PM::DataPoints initializedTarget = mRigidTransformation->compute(*targetScan->getDataPoints(), convert3Dto2D(guess));
+
+//		if(debug)
+//		{
+//			sourceScan->getDataPoints().save("source.vtk");
+//			initializedTarget.save("target.vtk");
+//		}
+		
+		// Perform ICP, the ICP object is not reentrant
+		PM::TransformationParameters tp;
+		{
+			std::lock_guard<std::mutex> guard(mICPMutex);
+			tp = mICP(initializedTarget, *sourceScan->getDataPoints());
+		}
+		icp_result = guess * convert2Dto3D(tp);
+	}
 
 	// Transform back to robot frame
 	TransformWithCovariance twc;
@@ -98,8 +235,10 @@ Constraint::Ptr Scan2DSensor::createConstraint(const Measurement::Ptr& source,
 
 Measurement::Ptr Scan2DSensor::createCombinedMeasurement(const VertexObjectList& vertices, Transform pose) const
 {
-	// Concatenate all scans into one
-	PM::DataPoints accu = createDataPoints();
+	// Collect all scans to allocate the accumulated matrix only once
+	std::vector<Scan2DMeasurement::Ptr> scans;
+	scans.reserve(vertices.size());
+	int size = 0;
 	for(VertexObjectList::const_iterator it = vertices.begin(); it != vertices.end(); it++)
 	{
 		Scan2DMeasurement::Ptr scan = boost::dynamic_pointer_cast<Scan2DMeasurement>(it->measurement);
@@ -108,13 +247,26 @@ Measurement::Ptr Scan2DSensor::createCombinedMeasurement(const VertexObjectList&
 			mLogger->message(WARNING, "Measurement is not a Scan2D!");
 			throw BadMeasurementType();
 		}
-		accu.concatenate(transformDataPoints(scan->getDataPoints(), it->corrected_pose * scan->getSensorPose()));
+		scans.push_back(scan);
+		size += scan->getDataPoints()->features.cols();
+	}
+
+	// Transform each scan directly into the target frame
+	PM::DataPoints accu = createDataPoints();
+	accu.features.resize(3, size);
+	Transform origin = pose.inverse();
+	int offset = 0;
+	for(size_t i = 0; i < scans.size(); i++)
+	{
+		boost::shared_ptr<const PM::DataPoints> points = scans[i]->getDataPoints();
+		int n = points->features.cols();
+		transformFeatures(*points, origin * vertices[i].corrected_pose * scans[i]->getSensorPose(),
+		                  accu.features.block(0, offset, 3, n));
+		offset += n;
 	}
 
-	// Transform to target frame
-	PM::DataPoints accu_tf = transformDataPoints(accu, pose.inverse());	
 	timeval t;
-	return Scan2DMeasurement::Ptr(new Scan2DMeasurement(accu_tf, t, "AccumulatedScan", mName, Transform::Identity()));
+	return Scan2DMeasurement::Ptr(new Scan2DMeasurement(accu, t, "AccumulatedScan", mName, Transform::Identity()));
 }
 
 PM::DataPoints Scan2DSensor::createDataPoints() const
@@ -130,11 +282,113 @@ PM::DataPoints Scan2DSensor::createDataPoints() const
 
 PM::DataPoints Scan2DSensor::transformDataPoints(const PM::DataPoints& source, const Transform tf) const
 {
-	std::shared_ptr<PM::Transformation> rigidTrans = PM::get().REG(Transformation).create("RigidTransformation");
 	PM::TransformationParameters tp = convert3Dto2D(tf);
-	if (!rigidTrans->checkParameters(tp))
+	if (!mRigidTransformation->checkParameters(tp))
+	{
+		tp = mRigidTransformation->correctParameters(tp);
+	}
+	return mRigidTransformation->compute(source,tp);
+}
+
+void Scan2DSensor::transformFeatures(const PM::DataPoints& source, const Transform& tf,
+                                     Eigen::Block<PM::Matrix> target) const
+{
+	// The upper 2x2 block is no rotation if tf has roll or pitch
+	const ScalarType yaw = std::atan2(tf.linear()(1,0), tf.linear()(0,0));
+	const Eigen::Matrix<ScalarType, 2, 2> rotation = Eigen::Rotation2D<ScalarType>(yaw).toRotationMatrix();
+	const Eigen::Matrix<ScalarType, 2, 1> translation = tf.translation().head<2>();
+	target.topRows(2).noalias() = rotation * source.features.topRows(2);
+	target.topRows(2).colwise() += translation;
+	target.row(2).setOnes();
+}
+
+Points2D Scan2DSensor::getPoints2D(const PM::DataPoints& points) const
+{
+	Points2D result;
+	result.reserve(points.features.cols());
+	for(int i = 0; i < points.features.cols(); i++)
+	{
+		result.push_back(Eigen::Vector2d(points.features(0, i), points.features(1, i)));
+	}
+	return result;
+}
+
+void Scan2DSensor::setScanMatcher(Scan2DMatcher matcher, bool loop)
+{
+	std::lock_guard<std::mutex> guard(mCorrelativeMutex);
+	if(loop)
+	{
+		mLogger->message(INFO, (boost::format("loop_scan_matcher:        %1%") % matcher).str());
+		mLoopMatcher = matcher;
+	}else
+	{
+		mLogger->message(INFO, (boost::format("scan_matcher:             %1%") % matcher).str());
+		mMatcher = matcher;
+	}
+}
+
+void Scan2DSensor::setCorrelativeParameters(const CorrelativeScanMatcherParameters& params, bool refine)
+{
+	mLogger->message(INFO, " = CorrelativeScanMatcherParameters =");
+	mLogger->message(INFO, (boost::format("resolution:               %1%") % params.resolution).str());
+	mLogger->message(INFO, (boost::format("sigma:                    %1%") % params.sigma).str());
+	mLogger->message(INFO, (boost::format("linear_window:            %1%") % params.linear_window).str());
+	mLogger->message(INFO, (boost::format("angular_window:           %1%") % params.angular_window).str());
+	mLogger->message(INFO, (boost::format("branch_and_bound_depth:   %1%") % params.branch_and_bound_depth).str());
+	mLogger->message(INFO, (boost::format("min_score:                %1%") % params.min_score).str());
+	mLogger->message(INFO, (boost::format("icp_refinement:           %1%") % refine).str());
+	std::lock_guard<std::mutex> guard(mCorrelativeMutex);
+	mCorrelativeParameters = params;
+	mCorrelativeRefinement = refine;
+	mCorrelativeVersion++;
+}
+
+void Scan2DSensor::setCorrelativeCacheSize(unsigned n)
+{
+	mLogger->message(INFO, (boost::format("correlative_cache_size:   %1%") % n).str());
+	std::lock_guard<std::mutex> guard(mCorrelativeCacheMutex);
+	mCorrelativeCacheSize = n;
+	while(mCorrelativeCache.size() > mCorrelativeCacheSize)
+		mCorrelativeCache.pop_back();
+}
+
+boost::shared_ptr<const CorrelativeScanMatcher> Scan2DSensor::getCorrelativeMatcher(const Scan2DMeasurement::Ptr& source,
+	const CorrelativeScanMatcherParameters& params, unsigned long version)
+{
+	{
+		std::lock_guard<std::mutex> guard(mCorrelativeCacheMutex);
+		for(std::list<CorrelativeCacheEntry>::iterator e = mCorrelativeCache.begin(); e != mCorrelativeCache.end(); ++e)
+		{
+			if(e->version == version && e->source.lock() == source)
+			{
+				mCorrelativeCache.splice(mCorrelativeCache.begin(), mCorrelativeCache, e);
+				return e->matcher;
+			}
+		}
+	}
+
+	// Build outside of the lock, so that other sources can be matched meanwhile
+	boost::shared_ptr<const CorrelativeScanMatcher> matcher(
+		new CorrelativeScanMatcher(getPoints2D(*source->getDataPoints()), params));
+
+	std::lock_guard<std::mutex> guard(mCorrelativeCacheMutex);
+	if(mCorrelativeCacheSize == 0)
+		return matcher;
+	CorrelativeCacheEntry entry;
+	entry.source = source;
+	entry.version = version;
+	entry.matcher = matcher;
+	mCorrelativeCache.push_front(entry);
+
+	// Drop matchers of patches that no longer exist and the least recently used ones
+	for(std::list<CorrelativeCacheEntry>::iterator e = mCorrelativeCache.begin(); e != mCorrelativeCache.end();)
 	{
-		tp = rigidTrans->correctParameters(tp);
+		if(e->source.expired() || e->version != version)
+			e = mCorrelativeCache.erase(e);
+		else
+			++e;
 	}
-	return rigidTrans->compute(source,tp);
+	while(mCorrelativeCache.size() > mCorrelativeCacheSize)
+		mCorrelativeCache.pop_back();
+	return matcher;
 }
@@ -28,13 +28,23 @@
 
 #include <slam3d/core/Mapper.hpp>
 #include <slam3d/core/ScanSensor.hpp>
+#include <slam3d/sensor/pointmatcher/CorrelativeScanMatcher.hpp>
 
 #include <pointmatcher/PointMatcher.h>
 
+#include <boost/weak_ptr.hpp>
+
+#include <list>
+
 namespace slam3d
 {
 	typedef PointMatcher<ScalarType> PM;
 
+	/**
+	 * @brief Method used to match two 2D scans.
+	 */
+	enum Scan2DMatcher {POINTMATCHER_ICP, CORRELATIVE};
+
 	/**
 	 * @class Scan2DMeasurement
 	 * @brief 
@@ -47,12 +57,39 @@ namespace slam3d
 		Scan2DMeasurement(const PM::DataPoints& points, timeval t,
 	                    const std::string& r, const std::string& s,
 	                    const Transform& p, const boost::uuids::uuid id = boost::uuids::nil_uuid())
-		: Measurement(r, s, p, id), mDataPoints(points) { mStamp = t; }
+		: Measurement(r, s, p, id), mDataPoints(new PM::DataPoints(points)) { mStamp = t; }
+
+		/**
+		 * @brief Get the points of the scan.
+		 * @details The points are read back if they have been paged out.
+		 */
+		boost::shared_ptr<const PM::DataPoints> getDataPoints() const
+		{
+			accessPayload();
+			std::unique_lock<std::mutex> guard(mDataPointsMutex);
+			while(mStore && !mDataPoints)
+			{
+				// Paged out again by another thread
+				guard.unlock();
+				accessPayload();
+				guard.lock();
+			}
+			return mDataPoints;
+		}
 
-		const PM::DataPoints& getDataPoints() { return mDataPoints; }
+		/**
+		 * @brief Serialize features and descriptors with their labels.
+		 * @details Time fields are not stored, the scans of the
+		 * Scan2DSensor do not have any.
+		 */
+		bool writePayload(std::vector<char>& buffer) const;
+		void readPayload(const char* data, size_t size);
+		void releasePayload();
+		size_t getPayloadSize() const;
 
 	protected:
-		PM::DataPoints mDataPoints;
+		boost::shared_ptr<const PM::DataPoints> mDataPoints;
+		mutable std::mutex mDataPointsMutex;
 	};
 
 	/**
@@ -118,14 +155,89 @@ namespace slam3d
 		 */
 		PM::DataPoints transformDataPoints(const PM::DataPoints& source, const Transform tf) const;
 
+		/**
+		 * @brief Transform the (x,y) coordinates of the points into a given block of a feature matrix.
+		 * @details The target block must have three rows (x,y,w) and as many
+		 * columns as there are points, the w row is set to 1. Only x, y and
+		 * yaw of the transformation are applied, so that the points are
+		 * rotated rigidly even if tf has roll or pitch.
+		 * @param source
+		 * @param tf
+		 * @param target
+		 */
+		void transformFeatures(const PM::DataPoints& source, const Transform& tf,
+		                       Eigen::Block<PM::Matrix> target) const;
+
 		/**
 		 * @brief Activate writing of source and target pointclouds when perfomring loop closures.
 		 * @param debug
 		 */
 		void writeDebugData(bool debug = true) { mWriteDebugData = debug; }
 
+		/**
+		 * @brief Set the method used to match scans.
+		 * @details The correlative scan matcher searches a wide window around
+		 * the guess and is therefore suited for loop closures with a poor guess.
+		 * @param matcher
+		 * @param loop whether to set the method for loop closures or for sequential scans
+		 */
+		void setScanMatcher(Scan2DMatcher matcher, bool loop);
+
+		/**
+		 * @brief Set the parameters of the correlative scan matcher.
+		 * @param params
+		 * @param refine whether to refine the result with ICP
+		 */
+		void setCorrelativeParameters(const CorrelativeScanMatcherParameters& params, bool refine = true);
+
+		/**
+		 * @brief Set how many correlative scan matchers are kept for reuse.
+		 * @details Building the lookup grids of a matcher is expensive, so the
+		 * matcher of a source patch is kept as long as the patch is reused (see
+		 * ScanSensor::setPatchCacheSize) and the parameters do not change.
+		 * The least recently used matcher is discarded when the cache is full.
+		 * @param n maximum number of cached matchers, 0 to disable the cache
+		 */
+		void setCorrelativeCacheSize(unsigned n);
+
+		/**
+		 * @brief Get the (x,y) coordinates of all points.
+		 * @param points
+		 */
+		Points2D getPoints2D(const PM::DataPoints& points) const;
+
+	protected:
+		/**
+		 * @brief Get a matcher with the source patch as reference from the cache or build it.
+		 * @param source the source patch
+		 * @param params parameters of the matcher
+		 * @param version version of the parameters
+		 */
+		boost::shared_ptr<const CorrelativeScanMatcher> getCorrelativeMatcher(const Scan2DMeasurement::Ptr& source,
+			const CorrelativeScanMatcherParameters& params, unsigned long version);
+
 	protected:
 		PM::ICP mICP;
+		std::mutex mICPMutex;
+		std::shared_ptr<PM::Transformation> mRigidTransformation;
+
+		// The matcher settings are read by concurrent linking jobs
+		Scan2DMatcher mMatcher;
+		Scan2DMatcher mLoopMatcher;
+		CorrelativeScanMatcherParameters mCorrelativeParameters;
+		unsigned long mCorrelativeVersion;
+		bool mCorrelativeRefinement;
+		std::mutex mCorrelativeMutex;
+
+		struct CorrelativeCacheEntry
+		{
+			boost::weak_ptr<Scan2DMeasurement> source;
+			unsigned long version;
+			boost::shared_ptr<const CorrelativeScanMatcher> matcher;
+		};
+		std::list<CorrelativeCacheEntry> mCorrelativeCache;
+		unsigned mCorrelativeCacheSize;
+		std::mutex mCorrelativeCacheMutex;
 
 		bool mWriteDebugData; 
 	};
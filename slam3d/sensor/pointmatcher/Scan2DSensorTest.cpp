@@ -0,0 +1,127 @@
+#define BOOST_TEST_MODULE "Scan2DSensorTest"
+
+#include "Scan2DSensor.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <cmath>
+
+using namespace slam3d;
+
+Transform createPose(double x, double y, double z, double roll, double pitch, double yaw)
+{
+	Transform pose = Transform::Identity();
+	pose.translation() = Eigen::Vector3d(x, y, z);
+	pose.linear() = (Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ())
+	               * Eigen::AngleAxisd(pitch, Eigen::Vector3d::UnitY())
+	               * Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitX())).toRotationMatrix();
+	return pose;
+}
+
+// A scan of n points on a line, placed at the given vertex pose
+VertexObject createVertex(Scan2DSensor& sensor, IdType id, unsigned n, const Transform& pose, const Transform& sensor_pose)
+{
+	PM::DataPoints points = sensor.createDataPoints();
+	points.features.resize(3, n);
+	for(unsigned i = 0; i < n; i++)
+	{
+		points.features(0, i) = 1.0 + 0.1 * i;
+		points.features(1, i) = 0.5 - 0.2 * i;
+		points.features(2, i) = 1;
+	}
+	timeval t;
+	VertexObject v;
+	v.index = id;
+	v.corrected_pose = pose;
+	v.measurement = Measurement::Ptr(new Scan2DMeasurement(points, t, "Robot", "Scan2D", sensor_pose));
+	return v;
+}
+
+// Expected position of a point after applying x, y and yaw of tf
+Eigen::Vector2d transformPoint(const Transform& tf, const Eigen::Vector2d& p)
+{
+	Eigen::Rotation2Dd rotation(std::atan2(tf.linear()(1,0), tf.linear()(0,0)));
+	return rotation * p + tf.translation().head<2>();
+}
+
+BOOST_AUTO_TEST_CASE(accumulate_scans)
+{
+	Clock clock;
+	Logger logger(clock);
+	Scan2DSensor sensor("Scan2D", &logger, "");
+
+	VertexObjectList vertices;
+	vertices.push_back(createVertex(sensor, 1, 5, createPose(0, 0, 0, 0, 0, 0), Transform::Identity()));
+	vertices.push_back(createVertex(sensor, 2, 3, createPose(1, 2, 0, 0, 0, 0.5), createPose(0.2, 0, 0, 0, 0, M_PI)));
+	vertices.push_back(createVertex(sensor, 3, 4, createPose(-1, 0.5, 0, 0, 0, -1.0), Transform::Identity()));
+	Transform origin = createPose(0.5, -0.5, 0, 0, 0, 0.3);
+
+	Scan2DMeasurement::Ptr accu = boost::dynamic_pointer_cast<Scan2DMeasurement>(
+		sensor.createCombinedMeasurement(vertices, origin));
+	BOOST_REQUIRE(accu);
+	boost::shared_ptr<const PM::DataPoints> points = accu->getDataPoints();
+	BOOST_REQUIRE_EQUAL(points->features.rows(), 3);
+	BOOST_REQUIRE_EQUAL(points->features.cols(), 12);
+
+	// The scans follow each other in the order of the vertices
+	int column = 0;
+	for(VertexObjectList::iterator v = vertices.begin(); v != vertices.end(); ++v)
+	{
+		Scan2DMeasurement::Ptr scan = boost::dynamic_pointer_cast<Scan2DMeasurement>(v->measurement);
+		const PM::Matrix& features = scan->getDataPoints()->features;
+		Transform tf = origin.inverse() * v->corrected_pose * scan->getSensorPose();
+		for(int i = 0; i < features.cols(); i++, column++)
+		{
+			Eigen::Vector2d expected = transformPoint(tf, Eigen::Vector2d(features(0, i), features(1, i)));
+			BOOST_CHECK_SMALL(points->features(0, column) - expected[0], 1e-9);
+			BOOST_CHECK_SMALL(points->features(1, column) - expected[1], 1e-9);
+			BOOST_CHECK_EQUAL(points->features(2, column), 1);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(accumulate_with_roll_and_pitch)
+{
+	Clock clock;
+	Logger logger(clock);
+	Scan2DSensor sensor("Scan2D", &logger, "");
+
+	// Roll and pitch are ignored, the scan is rotated rigidly by the yaw
+	VertexObjectList vertices;
+	vertices.push_back(createVertex(sensor, 1, 6, createPose(1, -1, 0.3, 0.3, -0.2, 0.5), Transform::Identity()));
+	Scan2DMeasurement::Ptr accu = boost::dynamic_pointer_cast<Scan2DMeasurement>(
+		sensor.createCombinedMeasurement(vertices, Transform::Identity()));
+	BOOST_REQUIRE(accu);
+
+	const PM::Matrix& features = accu->getDataPoints()->features;
+	const PM::Matrix& original = boost::dynamic_pointer_cast<Scan2DMeasurement>(
+		vertices[0].measurement)->getDataPoints()->features;
+	BOOST_REQUIRE_EQUAL(features.cols(), 6);
+	Eigen::Rotation2Dd rotation(0.5);
+	for(int i = 0; i < features.cols(); i++)
+	{
+		Eigen::Vector2d p(original(0, i), original(1, i));
+		Eigen::Vector2d expected = rotation * p + Eigen::Vector2d(1, -1);
+		BOOST_CHECK_SMALL(features(0, i) - expected[0], 1e-9);
+		BOOST_CHECK_SMALL(features(1, i) - expected[1], 1e-9);
+
+		// Distances within the scan are kept
+		Eigen::Vector2d q(features(0, i), features(1, i));
+		BOOST_CHECK_SMALL((q - Eigen::Vector2d(1, -1)).norm() - p.norm(), 1e-9);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(accumulate_wrong_type)
+{
+	Clock clock;
+	Logger logger(clock);
+	Scan2DSensor sensor("Scan2D", &logger, "");
+
+	VertexObjectList vertices;
+	VertexObject v;
+	v.index = 1;
+	v.corrected_pose = Transform::Identity();
+	v.measurement = Measurement::Ptr(new Measurement("Robot", "Scan2D", Transform::Identity()));
+	vertices.push_back(v);
+	BOOST_CHECK_THROW(sensor.createCombinedMeasurement(vertices, Transform::Identity()), BadMeasurementType);
+}
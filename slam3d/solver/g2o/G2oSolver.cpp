@@ -107,7 +107,7 @@ void G2oSolver::addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3)
 	// Set the measurement (odometry distance between vertices)
 	const TransformWithCovariance& twc = se3->getRelativePose();
 	constraint->setMeasurement(twc.transform.cast<double>());            // slam3d::Transform  aka Eigen::Isometry3d
-	constraint->setInformation(twc.covariance.inverse().cast<double>()); // slam3d::Covariance<6> aka Eigen::Matrix<double,6,6>
+	constraint->setInformation(se3->getInformation().cast<double>());    // slam3d::Information<6> aka Eigen::Matrix<double,6,6>
 	
 	// Add the constraint to the optimizer
 	mInt->optimizer.addEdge(constraint);
@@ -119,7 +119,7 @@ void G2oSolver::addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav)
 	boost::unique_lock<boost::mutex> guard(mMutex);
 	g2o::EdgeDirectionPrior* prior = new g2o::EdgeDirectionPrior(grav->getDirection(), grav->getReference());
 	prior->vertices()[0] = mInt->optimizer.vertex(vertex);
-	prior->setInformation(grav->getCovariance().inverse().cast<double>());
+	prior->setInformation(grav->getInformation().cast<double>());
 	
 	mInt->optimizer.addEdge(prior);
 	mInt->newEdges.insert(prior);
@@ -130,7 +130,7 @@ void G2oSolver::addEdgePosition(IdType vertex, PositionConstraint::Ptr pos)
 	boost::unique_lock<boost::mutex> guard(mMutex);
 	g2o::EdgePositionPrior* prior = new g2o::EdgePositionPrior(pos->getPosition(), pos->getSensorPose());
 	prior->vertices()[0] = mInt->optimizer.vertex(vertex);
-	prior->setInformation(pos->getCovariance().inverse().cast<double>());
+	prior->setInformation(pos->getInformation().cast<double>());
 	
 	mInt->optimizer.addEdge(prior);
 	mInt->newEdges.insert(prior);
@@ -141,7 +141,7 @@ void G2oSolver::addEdgeDistance(IdType source, IdType target, DistanceConstraint
 	g2o::EdgeDistance* edge = new g2o::EdgeDistance(dis->getDistance());
 	edge->vertices()[0] = mInt->optimizer.vertex(source);
 	edge->vertices()[1] = mInt->optimizer.vertex(target);
-	edge->setInformation(dis->getCovariance().inverse().cast<double>());
+	edge->setInformation(dis->getInformation().cast<double>());
 
 	mInt->optimizer.addEdge(edge);
 	mInt->newEdges.insert(edge);
@@ -227,6 +227,8 @@ void G2oSolver::clear()
 {
 	boost::unique_lock<boost::mutex> guard(mMutex);
 	mInt->optimizer.clear();
+	mInt->newVertices.clear();
+	mInt->newEdges.clear();
 	mInitialized = false;
 	mCorrections.clear();
 }
@@ -0,0 +1,57 @@
+#include "G2oSolver.hpp"
+
+#include <slam3d/core/SolverBenchmark.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace slam3d;
+
+// Usage: g2o_solver_benchmark [-s step] [-i iterations] [-n synthetic_size]... [graph.g2o|graph.graph]...
+// Without any graph files, synthetic graphs with 1000 and 5000 vertices are used.
+int main(int argc, char** argv)
+{
+	unsigned step = 100;
+	unsigned iterations = 10;
+	std::vector<unsigned> sizes;
+	std::vector<std::string> files;
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			step = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			sizes.push_back(atoi(argv[++i]));
+		else
+			files.push_back(argv[i]);
+	}
+	if(files.empty() && sizes.empty())
+	{
+		sizes.push_back(1000);
+		sizes.push_back(5000);
+	}
+
+	Clock clock;
+	Logger logger(clock);
+	logger.setLogLevel(WARNING);
+	G2oSolver solver(&logger);
+
+	for(std::vector<std::string>::iterator f = files.begin(); f != files.end(); ++f)
+	{
+		PoseGraphData data;
+		if(!loadPoseGraph(*f, data))
+		{
+			std::cerr << "Could not load pose graph from " << *f << std::endl;
+			continue;
+		}
+		benchmark_solver(&solver, data, step, iterations, std::cout);
+	}
+
+	for(std::vector<unsigned>::iterator n = sizes.begin(); n != sizes.end(); ++n)
+	{
+		benchmark_solver(&solver, createSyntheticGraph(*n), step, iterations, std::cout);
+	}
+	return 0;
+}
@@ -16,3 +16,8 @@ BOOST_AUTO_TEST_CASE(g2o_optimization)
 	test_optimization(solver);
 	delete solver;
 }
+
+BOOST_AUTO_TEST_CASE(constraint_information)
+{
+	test_constraint_information();
+}